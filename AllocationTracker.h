@@ -0,0 +1,272 @@
+#ifndef ALLOCATIONTRACKER_H
+#define ALLOCATIONTRACKER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+//Keep windows.h's min and max macros out of everything that includes this
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <crtdbg.h>
+#define ALLOCATION_THREAD_LOCAL __declspec(thread)
+#define ALLOCATION_ATOMIC_ADD(p, v) InterlockedExchangeAdd64((volatile LONGLONG*)(p), (v))
+#define ALLOCATION_TRY_LOCK(p) (InterlockedExchange((p), 1)==0)
+#define ALLOCATION_UNLOCK(p) InterlockedExchange((p), 0)
+#else
+#include <malloc.h>
+#define ALLOCATION_THREAD_LOCAL __thread
+#define ALLOCATION_ATOMIC_ADD(p, v) __sync_fetch_and_add((p), (v))
+#define ALLOCATION_TRY_LOCK(p) (__sync_lock_test_and_set((p), 1)==0)
+#define ALLOCATION_UNLOCK(p) __sync_lock_release(p)
+#endif
+
+// Counts heap allocations per frame and per subsystem. Every allocation is charged to the subsystem
+// named by the innermost ALLOCATION_SCOPE on the allocating thread, "other" outside any. Frees are
+// only counted against the total in use, so leaks are reported as the growth of the heap over a
+// frame. The counts come from the CRT's allocation hook in MSVC debug builds, and on Linux from
+// malloc and free replaced by the ones defined where ALLOCATION_TRACKER_HOOKS is defined before
+// including this, which must be a single source file of the executable.
+class AllocationTracker {
+public:
+	static const int maxTags = 32;
+
+	// The id of a named subsystem, registering it the first time. The name must outlive the tracker.
+	int tag(const char *name) {
+		//A spinlock rather than a mutex, as the hooks can't have the lock allocate
+		while (!ALLOCATION_TRY_LOCK(&tagLock)) {}
+		int id = 0;
+		for (id=0; id<tagCount; id++) if (strcmp(tagNames[id], name)==0) break;
+		if (id==tagCount) {
+			if (tagCount<maxTags) tagNames[tagCount++] = name;
+			else id = 0;
+		}
+		ALLOCATION_UNLOCK(&tagLock);
+		return id;
+	}
+
+	// budget is the most allocations allowed in a frame once warmupFrames have passed, -1 for no
+	// limit. A frame over budget prints what it allocated and, with abortOnExceed, aborts.
+	void setEnabled(bool _enabled, int _budget = -1, int _warmupFrames = 30, bool _abortOnExceed = false) {
+		budget = _budget; warmupFrames = _warmupFrames; abortOnExceed = _abortOnExceed;
+#if defined(_MSC_VER) && defined(_DEBUG)
+		if (_enabled && !enabled) previousHook = _CrtSetAllocHook(crtHook);
+		if (!_enabled && enabled) _CrtSetAllocHook(previousHook);
+#endif
+		enabled = _enabled;
+	}
+
+	inline bool isEnabled() { return enabled; }
+
+	static inline int &currentTag() {
+		static ALLOCATION_THREAD_LOCAL int current = 0;
+		return current;
+	}
+
+	// Set while a hook is counting on this thread, so anything allocated meanwhile (the tracker's
+	// own static initialisation included) goes straight to the real allocator uncounted
+	static inline int &hookDepth() {
+		static ALLOCATION_THREAD_LOCAL int depth = 0;
+		return depth;
+	}
+
+	// Called by the hooks
+	inline void allocated(size_t bytes) {
+		if (!enabled) return;
+		int t = currentTag();
+		ALLOCATION_ATOMIC_ADD(&frameAllocations[t], 1LL); ALLOCATION_ATOMIC_ADD(&frameBytes[t], (long long)bytes);
+		long long now = ALLOCATION_ATOMIC_ADD(&live, (long long)bytes) + bytes;
+		//Racy, but only ever loses to a higher peak from another thread by a single allocation
+		if (now>peak) peak = now;
+	}
+
+	inline void freed(size_t bytes) {
+		if (!enabled) return;
+		ALLOCATION_ATOMIC_ADD(&frameFrees, 1LL);
+		ALLOCATION_ATOMIC_ADD(&live, -(long long)bytes);
+	}
+
+	// Closes the frame, call once per frame from the main loop
+	void endFrame() {
+		if (!enabled) return;
+		long long frameTotal = 0, counts[maxTags], bytes[maxTags];
+		for (int i=0; i<tagCount; i++) {
+			counts[i] = frameAllocations[i]; ALLOCATION_ATOMIC_ADD(&frameAllocations[i], -counts[i]);
+			bytes[i] = frameBytes[i]; ALLOCATION_ATOMIC_ADD(&frameBytes[i], -bytes[i]);
+			totalAllocations[i] += counts[i]; totalBytes[i] += bytes[i];
+			if (counts[i]>maxFrameAllocations[i]) maxFrameAllocations[i] = counts[i];
+			if (bytes[i]>maxFrameBytes[i]) maxFrameBytes[i] = bytes[i];
+			frameTotal += counts[i];
+		}
+		long long frees = frameFrees; ALLOCATION_ATOMIC_ADD(&frameFrees, -frees);
+		long long growth = live - frameStartLive; frameStartLive = live;
+		frames++;
+		if (frames<=warmupFrames) return;
+
+		steadyFrames++; steadyAllocations += frameTotal;
+		if (growth>0) { growingFrames++; steadyGrowth += growth; }
+
+		if (budget>=0 && frameTotal>budget) {
+			printf("Frame %d made %lld allocations (%lld freed), over the budget of %d:\n", frames, frameTotal, frees, budget);
+			for (int i=0; i<tagCount; i++) if (counts[i]>0) printf("  %-20s %8lld allocations %10lld bytes\n", tagNames[i], counts[i], bytes[i]);
+			if (abortOnExceed) abort();
+		}
+	}
+
+	// Totals per subsystem, then heap growth over the frames after the warm up
+	void printReport(FILE *f = stdout) {
+		fprintf(f, "Allocations over %d frames (%d warm up)\n", frames, warmupFrames);
+		fprintf(f, "  %-20s %12s %12s %10s %10s %12s\n", "subsystem", "allocations", "MB", "per frame", "max/frame", "max B/frame");
+		for (int i=0; i<tagCount; i++) {
+			if (totalAllocations[i]==0) continue;
+			fprintf(f, "  %-20s %12lld %12.2f %10.1f %10lld %12lld\n", tagNames[i], totalAllocations[i], totalBytes[i]/1048576.0,
+				frames>0 ? double(totalAllocations[i])/frames : 0.0, maxFrameAllocations[i], maxFrameBytes[i]);
+		}
+		fprintf(f, "  Peak in use %.2f MB\n", peak/1048576.0);
+		if (steadyFrames>0) {
+			fprintf(f, "  Steady state: %.1f allocations per frame, heap grew in %d of %d frames, %.1f bytes per frame on average\n",
+				double(steadyAllocations)/steadyFrames, growingFrames, steadyFrames, double(steadyGrowth)/steadyFrames);
+		}
+	}
+
+private:
+	friend AllocationTracker &allocationTracker();
+
+	// Only constructed by allocationTracker(). Plain data and a spinlock, so this never touches the heap
+	AllocationTracker() {
+		enabled = false; budget = -1; warmupFrames = 30; abortOnExceed = false;
+		tagLock = 0; tagCount = 0; tagNames[tagCount++] = "other";
+		for (int i=0; i<maxTags; i++) {
+			frameAllocations[i] = frameBytes[i] = 0;
+			totalAllocations[i] = totalBytes[i] = maxFrameAllocations[i] = maxFrameBytes[i] = 0;
+		}
+		live = peak = frameFrees = frameStartLive = 0;
+		frames = steadyFrames = growingFrames = 0; steadyAllocations = steadyGrowth = 0;
+	}
+
+	volatile bool enabled;
+	int budget, warmupFrames;
+	bool abortOnExceed;
+
+#ifdef _MSC_VER
+	volatile LONG tagLock;
+#else
+	volatile int tagLock;
+#endif
+	const char *tagNames[maxTags];
+	int tagCount;
+
+	volatile long long frameAllocations[maxTags], frameBytes[maxTags];
+	volatile long long live, peak, frameFrees;
+	long long totalAllocations[maxTags], totalBytes[maxTags], maxFrameAllocations[maxTags], maxFrameBytes[maxTags];
+	long long frameStartLive, steadyAllocations, steadyGrowth;
+	int frames, steadyFrames, growingFrames;
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+	_CRT_ALLOC_HOOK previousHook;
+
+	static int __cdecl crtHook(int type, void *data, size_t size, int blockType, long request, const unsigned char *file, int line);
+#endif
+};
+
+inline AllocationTracker &allocationTracker() {
+	static AllocationTracker tracker;
+	return tracker;
+}
+
+#if defined(_MSC_VER) && defined(_DEBUG)
+inline int __cdecl AllocationTracker::crtHook(int type, void *data, size_t size, int blockType, long request, const unsigned char *file, int line) {
+	//The CRT's own blocks aren't ours to count
+	if (blockType==_CRT_BLOCK || AllocationTracker::hookDepth()>0) return TRUE;
+	AllocationTracker::hookDepth()++;
+	if (type==_HOOK_ALLOC) allocationTracker().allocated(size);
+	else if (type==_HOOK_FREE) allocationTracker().freed(_msize_dbg(data, blockType));
+	else if (type==_HOOK_REALLOC) { allocationTracker().freed(_msize_dbg(data, blockType)); allocationTracker().allocated(size); }
+	AllocationTracker::hookDepth()--;
+	return TRUE;
+}
+#endif
+
+// Charges the enclosing scope's allocations on this thread to a named subsystem
+class AllocationScope {
+public:
+	AllocationScope(int tag) { int &current = AllocationTracker::currentTag(); previous = current; current = tag; }
+	~AllocationScope() { AllocationTracker::currentTag() = previous; }
+private:
+	int previous;
+};
+
+#define ALLOCATION_JOIN2(a, b) a##b
+#define ALLOCATION_JOIN(a, b) ALLOCATION_JOIN2(a, b)
+#define ALLOCATION_SCOPE(name) \
+	static int ALLOCATION_JOIN(allocationTag, __LINE__) = allocationTracker().tag(name); \
+	AllocationScope ALLOCATION_JOIN(allocationScope, __LINE__)(ALLOCATION_JOIN(allocationTag, __LINE__))
+
+#if defined(ALLOCATION_TRACKER_HOOKS) && defined(__GLIBC__)
+//Replacements for glibc's allocator that count into the tracker and pass on to glibc's own
+extern "C" {
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t count, size_t size);
+	void *__libc_realloc(void *p, size_t size);
+	void *__libc_memalign(size_t alignment, size_t size);
+	void __libc_free(void *p);
+}
+
+//Counts a block unless this thread is already inside the tracker
+static inline void allocationHookCount(size_t freedBytes, size_t allocatedBytes) {
+	int &depth = AllocationTracker::hookDepth();
+	if (depth>0) return;
+	depth++;
+	if (freedBytes) allocationTracker().freed(freedBytes);
+	if (allocatedBytes) allocationTracker().allocated(allocatedBytes);
+	depth--;
+}
+
+extern "C" {
+	void *malloc(size_t size) {
+		void *p = __libc_malloc(size);
+		if (p) allocationHookCount(0, malloc_usable_size(p));
+		return p;
+	}
+
+	void *calloc(size_t count, size_t size) {
+		void *p = __libc_calloc(count, size);
+		if (p) allocationHookCount(0, malloc_usable_size(p));
+		return p;
+	}
+
+	void *realloc(void *p, size_t size) {
+		size_t old = p ? malloc_usable_size(p) : 0;
+		void *q = __libc_realloc(p, size);
+		if (q || size==0) allocationHookCount(old, q ? malloc_usable_size(q) : 0);
+		return q;
+	}
+
+	void *memalign(size_t alignment, size_t size) {
+		void *p = __libc_memalign(alignment, size);
+		if (p) allocationHookCount(0, malloc_usable_size(p));
+		return p;
+	}
+
+	int posix_memalign(void **p, size_t alignment, size_t size) {
+		*p = memalign(alignment, size);
+		return *p ? 0 : 12;
+	}
+
+	void *aligned_alloc(size_t alignment, size_t size) { return memalign(alignment, size); }
+
+	void free(void *p) {
+		if (p==0) return;
+		allocationHookCount(malloc_usable_size(p), 0);
+		__libc_free(p);
+	}
+}
+#endif
+
+#endif
@@ -0,0 +1,445 @@
+// Times the project's kernels on their own, on synthetic inputs, and writes the results as JSON so
+// they can be compared between releases. OpenNI is replaced by the stub in OpenNIStub, so no Kinect
+// is needed. Run from the project directory, it reads Data/kinect.yml and Media/animations.xml.
+//
+//   Benchmark [-out results.json] [-threads 1,4] [-time seconds] [-only name]
+//             [-resolutions 640x480,320x240] [-points 4800,19200] [-pairs 50,500] [-grids 80x60,160x120]
+//
+// Each kernel is run at every size and thread count given. With more than one thread every thread
+// runs the kernel on inputs of its own at the same time, which shows how well it shares the machine.
+//
+// On Linux, with OpenCV 2.x, OpenSceneGraph and TinyXML installed:
+//   g++ -O2 -IOpenNIStub -Iinclude Benchmark.cpp -o Benchmark `pkg-config --cflags --libs opencv openscenegraph` -ltinyxml
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <osg/Group>
+#include <osg/FrameStamp>
+#include <osgUtil/UpdateVisitor>
+#include <OpenThreads/Barrier>
+
+#include "Kinect.h"
+#include "Spider.h"
+#include "GroundHeightMap.h"
+#include "HeightFieldMesh.h"
+#include "ThreadPool.h"
+#include "tinyxml.h"
+
+// One kernel with inputs of its own. prepare() is run untimed before every timed run().
+class Kernel {
+public:
+	virtual ~Kernel() {}
+	virtual void prepare() {}
+	virtual void run() = 0;
+};
+
+// Makes a kernel for each thread
+class KernelFactory {
+public:
+	virtual ~KernelFactory() {}
+	virtual Kernel *create() = 0;
+};
+
+struct BenchmarkResult {
+	std::string name, size;
+	int threads, iterations;
+	double mean, p50, p90, p99, min, max, callsPerSecond;
+};
+
+// Gives every thread a synthetic Kinect of the given resolution, with the transform set to a known pose
+inline KinectAR *createKinect(int width, int height) {
+	xnStubSetResolution(width, height);
+	KinectAR *kinect = new KinectAR("Data/SamplesConfig.xml", "Data/kinect.yml");
+	kinect->getNewFrame();
+
+	//The marker a metre away, tilted 30 degrees towards the Kinect
+	float c = cos(0.5236f), s = sin(0.5236f);
+	float m[16] = { 1, 0, 0, 0,  0, c, -s, 0,  0, s, c, -1000,  0, 0, 0, 1 };
+	CvMat transform = cvMat(4, 4, CV_32FC1, m);
+	kinect->setTransform(&transform);
+	return kinect;
+}
+
+// Corresponding points related by a rigid transform with a little noise, as the Kinect calibration finds them
+class FindTransformKernel : public Kernel {
+public:
+	FindTransformKernel(int pairs) {
+		CvRNG rng = cvRNG(pairs);
+		float c = cos(0.3f), s = sin(0.3f);
+		for (int i=0; i<pairs; i++) {
+			CvPoint3D32f p = cvPoint3D32f(cvRandReal(&rng)*300, cvRandReal(&rng)*200, cvRandReal(&rng)*10);
+			source.push_back(p);
+			target.push_back(cvPoint3D32f(c*p.x - s*p.y + 50 + cvRandReal(&rng), s*p.x + c*p.y - 20 + cvRandReal(&rng), p.z + 900 + cvRandReal(&rng)));
+		}
+	}
+	virtual void run() { CvMat *m = findTransform(source, target); cvReleaseMat(&m); }
+private:
+	std::vector<CvPoint3D32f> source, target;
+};
+
+// The 4x4 symmetric eigenproblem at the heart of findTransform, which destroys its input
+class JacobiKernel : public Kernel {
+public:
+	JacobiKernel() {
+		float n[4][4] = { {4, 1, 0.5f, 0.2f}, {1, 3, 0.3f, 0.1f}, {0.5f, 0.3f, 2, 0.4f}, {0.2f, 0.1f, 0.4f, 1} };
+		memcpy(source, n, sizeof(n));
+		for (int i=0; i<4; i++) { a[i] = matrix[i]; v[i] = vectors[i]; }
+	}
+	virtual void prepare() { memcpy(matrix, source, sizeof(matrix)); }
+	virtual void run() { JacobiN(a, 4, values, v); }
+private:
+	float source[4][4], matrix[4][4], vectors[4][4], values[4];
+	float *a[4], *v[4];
+};
+
+// Each frame's depth holes are filled in place, so each run starts from a fresh frame
+class InpaintKernel : public Kernel {
+public:
+	InpaintKernel(int width, int height, bool _halfSize) { kinect = createKinect(width, height); halfSize = _halfSize; }
+	~InpaintKernel() { delete kinect; }
+	virtual void prepare() { kinect->getNewFrame(); }
+	virtual void run() { kinect->inpaintDepth(halfSize); }
+private:
+	KinectAR *kinect;
+	bool halfSize;
+};
+
+// getColour or getDepthMask, the image is released as the main loop does
+class KinectImageKernel : public Kernel {
+public:
+	KinectImageKernel(int width, int height, bool _colour) { kinect = createKinect(width, height); colour = _colour; }
+	~KinectImageKernel() { delete kinect; }
+	virtual void run() {
+		IplImage *image = colour ? kinect->getColour() : kinect->getDepthMask();
+		cvReleaseImage(&image);
+	}
+private:
+	KinectAR *kinect;
+	bool colour;
+};
+
+// The depth pixels spread evenly over the frame, as the ground map and heightfield sample them
+class TransformPointsKernel : public Kernel {
+public:
+	TransformPointsKernel(int count) {
+		kinect = createKinect(640, 480);
+		int step = MAX(1, (int)sqrt(640.0*480.0/count));
+		for (int y=0; y<480 && points.size()<count; y+=step) for (int x=0; x<640 && points.size()<count; x+=step) points.push_back(cvPoint(x, y));
+	}
+	~TransformPointsKernel() { delete kinect; }
+	virtual void run() { CvPoint3D32f *p = kinect->getTransformedPoints(&points[0], points.size()); free(p); }
+private:
+	KinectAR *kinect;
+	std::vector<CvPoint> points;
+};
+
+// What Renderer::updateHeightMap hands the render thread and the mesh update it leads to there. The
+// Renderer itself needs a window, so its copy of the grid is made here. A bump moves across the grid
+// so some tiles change each run.
+class HeightMapKernel : public Kernel {
+public:
+	HeightMapKernel(int _cols, int _rows) {
+		cols = _cols; rows = _rows; frame = 0;
+		grid.resize(cols*rows);
+		mesh = new HeightFieldMesh(cols, rows);
+	}
+	virtual void prepare() {
+		float bx = (frame++ % cols)*4.0f;
+		for (int y=0; y<rows; y++) for (int x=0; x<cols; x++) {
+			float dx = x*4.0f-bx, dy = y*4.0f-rows*2.0f;
+			grid[y*cols+x] = cvPoint3D32f(x*4.0f, -y*4.0f, 40*exp(-(dx*dx+dy*dy)/800.0f));
+		}
+	}
+	virtual void run() {
+		pending.assign(grid.begin(), grid.end());
+		mesh->update(&pending[0]);
+	}
+private:
+	int cols, rows, frame;
+	std::vector<CvPoint3D32f> grid, pending;
+	osg::ref_ptr<HeightFieldMesh> mesh;
+};
+
+// One update traversal of a spider walking a loop of waypoints over uneven ground. This replaces
+// createAnimationPath, which the motion controller took over from.
+class SpiderUpdateKernel : public Kernel {
+public:
+	SpiderUpdateKernel() {
+		ground = new GroundHeightMap(0, 0, 300, 200, 10);
+		std::vector<CvPoint3D32f> points;
+		for (int y=0; y<200; y+=5) for (int x=0; x<300; x+=5) points.push_back(cvPoint3D32f(x, -y, 10*sin(x*0.05f)*cos(y*0.05f)));
+		ground->update(&points[0], points.size());
+
+		spider = new Spider(new osg::Group(), "Media/animations.xml");
+		spider->setGroundHeightMap(ground);
+		spider->setPosition(50, 50, 0);
+		waypoints.push_back(osg::Vec3(250, 50, 0)); waypoints.push_back(osg::Vec3(250, 150, 0));
+		waypoints.push_back(osg::Vec3(50, 150, 0)); waypoints.push_back(osg::Vec3(50, 50, 0));
+
+		frameStamp = new osg::FrameStamp();
+		visitor.setFrameStamp(frameStamp.get());
+		frame = 0;
+	}
+	~SpiderUpdateKernel() { delete spider; delete ground; }
+	virtual void prepare() {
+		if (!spider->isAnimating()) spider->moveAlong(waypoints);
+		frameStamp->setFrameNumber(++frame); frameStamp->setSimulationTime(frame/60.0);
+		visitor.setTraversalNumber(frame);
+	}
+	virtual void run() { spider->getModel()->accept(visitor); }
+private:
+	GroundHeightMap *ground;
+	Spider *spider;
+	std::vector<osg::Vec3> waypoints;
+	osg::ref_ptr<osg::FrameStamp> frameStamp;
+	osgUtil::UpdateVisitor visitor;
+	int frame;
+};
+
+// Parses animations.xml from memory and reads out its clips as readAnimationClips does
+class AnimationXmlKernel : public Kernel {
+public:
+	AnimationXmlKernel(const std::string &_text) { text = _text; }
+	virtual void run() {
+		TiXmlDocument doc; doc.Parse(text.c_str());
+		clips.clear();
+		for (TiXmlElement *animation = doc.FirstChildElement(); animation; animation = animation->NextSiblingElement())
+			clips.push_back(AnimationClip(animation->Attribute("name"), atoi(animation->Attribute("start")), atoi(animation->Attribute("end"))));
+	}
+private:
+	std::string text;
+	std::vector<AnimationClip> clips;
+};
+
+// Factories for each kernel at one size
+class FindTransformFactory : public KernelFactory {
+public:
+	FindTransformFactory(int _pairs) { pairs = _pairs; }
+	virtual Kernel *create() { return new FindTransformKernel(pairs); }
+private:
+	int pairs;
+};
+
+class JacobiFactory : public KernelFactory {
+public:
+	virtual Kernel *create() { return new JacobiKernel(); }
+};
+
+class InpaintFactory : public KernelFactory {
+public:
+	InpaintFactory(CvSize _size, bool _halfSize) { size = _size; halfSize = _halfSize; }
+	virtual Kernel *create() { return new InpaintKernel(size.width, size.height, halfSize); }
+private:
+	CvSize size;
+	bool halfSize;
+};
+
+class KinectImageFactory : public KernelFactory {
+public:
+	KinectImageFactory(CvSize _size, bool _colour) { size = _size; colour = _colour; }
+	virtual Kernel *create() { return new KinectImageKernel(size.width, size.height, colour); }
+private:
+	CvSize size;
+	bool colour;
+};
+
+class TransformPointsFactory : public KernelFactory {
+public:
+	TransformPointsFactory(int _count) { count = _count; }
+	virtual Kernel *create() { return new TransformPointsKernel(count); }
+private:
+	int count;
+};
+
+class HeightMapFactory : public KernelFactory {
+public:
+	HeightMapFactory(CvSize _size) { size = _size; }
+	virtual Kernel *create() { return new HeightMapKernel(size.width, size.height); }
+private:
+	CvSize size;
+};
+
+class SpiderUpdateFactory : public KernelFactory {
+public:
+	virtual Kernel *create() { return new SpiderUpdateKernel(); }
+};
+
+class AnimationXmlFactory : public KernelFactory {
+public:
+	AnimationXmlFactory(const std::string &_text) { text = _text; }
+	virtual Kernel *create() { return new AnimationXmlKernel(text); }
+private:
+	std::string text;
+};
+
+// Runs one kernel per thread, all starting together, until each has run for minSeconds
+class BenchmarkJob : public ParallelJob {
+public:
+	BenchmarkJob(std::vector<Kernel*> &_kernels, double _minSeconds) : kernels(_kernels), barrier(_kernels.size()) {
+		minSeconds = _minSeconds; times.resize(kernels.size()); elapsed.resize(kernels.size());
+	}
+
+	virtual void run(int index) {
+		Kernel *kernel = kernels[index];
+		osg::Timer *timer = osg::Timer::instance();
+		for (int i=0; i<3; i++) { kernel->prepare(); kernel->run(); }
+
+		barrier.block(kernels.size());
+		osg::Timer_t start = timer->tick();
+		while (timer->delta_s(start, timer->tick())<minSeconds || times[index].size()<10) {
+			kernel->prepare();
+			osg::Timer_t t0 = timer->tick();
+			kernel->run();
+			times[index].push_back(timer->delta_u(t0, timer->tick()));
+		}
+		elapsed[index] = timer->delta_s(start, timer->tick());
+	}
+
+	std::vector<std::vector<double> > times;
+	std::vector<double> elapsed;
+
+private:
+	std::vector<Kernel*> &kernels;
+	OpenThreads::Barrier barrier;
+	double minSeconds;
+};
+
+inline double percentile(const std::vector<double> &sorted, double fraction) {
+	int i = (int)(fraction*(sorted.size()-1) + 0.5);
+	return sorted[MIN(MAX(i, 0), (int)sorted.size()-1)];
+}
+
+BenchmarkResult runBenchmark(const std::string &name, const std::string &size, int threads, KernelFactory *factory, double minSeconds) {
+	std::vector<Kernel*> kernels;
+	for (int i=0; i<threads; i++) kernels.push_back(factory->create());
+
+	ThreadPool pool(threads);
+	BenchmarkJob job(kernels, minSeconds);
+	pool.parallelFor(threads, &job);
+
+	std::vector<double> all; double sum = 0, elapsed = 0;
+	for (int i=0; i<threads; i++) {
+		all.insert(all.end(), job.times[i].begin(), job.times[i].end());
+		elapsed = MAX(elapsed, job.elapsed[i]);
+	}
+	std::sort(all.begin(), all.end());
+	for (int i=0; i<all.size(); i++) sum += all[i];
+
+	BenchmarkResult r;
+	r.name = name; r.size = size; r.threads = threads; r.iterations = all.size();
+	r.mean = sum/all.size(); r.p50 = percentile(all, 0.5); r.p90 = percentile(all, 0.9); r.p99 = percentile(all, 0.99);
+	r.min = all.front(); r.max = all.back(); r.callsPerSecond = all.size()/elapsed;
+
+	for (int i=0; i<threads; i++) delete kernels[i];
+	printf("%-22s %-10s %3d threads %8d runs  mean %10.2f us  p50 %10.2f us  p99 %10.2f us  %10.0f /s\n",
+		name.c_str(), size.c_str(), threads, r.iterations, r.mean, r.p50, r.p99, r.callsPerSecond);
+	return r;
+}
+
+bool writeResults(const char *filename, const std::vector<BenchmarkResult> &results, double minSeconds) {
+	FILE *f = fopen(filename, "w");
+	if (f==0) { printf("Could not write %s\n", filename); return false; }
+	fprintf(f, "{\n  \"processors\": %d,\n  \"minSeconds\": %g,\n  \"results\": [\n", OpenThreads::GetNumberOfProcessors(), minSeconds);
+	for (int i=0; i<results.size(); i++) {
+		const BenchmarkResult &r = results[i];
+		fprintf(f, "    {\"name\": \"%s\", \"size\": \"%s\", \"threads\": %d, \"iterations\": %d, \"mean_us\": %.3f, \"p50_us\": %.3f, "
+			"\"p90_us\": %.3f, \"p99_us\": %.3f, \"min_us\": %.3f, \"max_us\": %.3f, \"calls_per_s\": %.1f}%s\n",
+			r.name.c_str(), r.size.c_str(), r.threads, r.iterations, r.mean, r.p50, r.p90, r.p99, r.min, r.max, r.callsPerSecond,
+			i+1<results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	fclose(f);
+	return true;
+}
+
+// Comma separated numbers, or sizes as WxH
+std::vector<int> parseList(const char *list) {
+	std::vector<int> values;
+	for (const char *p = list; *p; ) {
+		values.push_back(atoi(p));
+		while (*p && *p!=',') p++;
+		if (*p) p++;
+	}
+	return values;
+}
+
+std::vector<CvSize> parseSizes(const char *list) {
+	std::vector<CvSize> sizes;
+	for (const char *p = list; *p; ) {
+		int w = 0, h = 0;
+		if (sscanf(p, "%dx%d", &w, &h)==2) sizes.push_back(cvSize(w, h));
+		while (*p && *p!=',') p++;
+		if (*p) p++;
+	}
+	return sizes;
+}
+
+std::string sizeName(CvSize size) {
+	char name[32]; sprintf(name, "%dx%d", size.width, size.height);
+	return name;
+}
+
+std::string countName(int count) {
+	char name[32]; sprintf(name, "%d", count);
+	return name;
+}
+
+int main(int argc, char **argv) {
+	const char *out = "benchmark.json", *only = 0;
+	const char *threadList = "1", *resolutionList = "640x480,320x240", *pointList = "4800,19200", *pairList = "50,500", *gridList = "80x60,160x120";
+	double minSeconds = 1;
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-out")==0 && i+1<argc) out = argv[++i];
+		else if (strcmp(argv[i], "-threads")==0 && i+1<argc) threadList = argv[++i];
+		else if (strcmp(argv[i], "-time")==0 && i+1<argc) minSeconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "-only")==0 && i+1<argc) only = argv[++i];
+		else if (strcmp(argv[i], "-resolutions")==0 && i+1<argc) resolutionList = argv[++i];
+		else if (strcmp(argv[i], "-points")==0 && i+1<argc) pointList = argv[++i];
+		else if (strcmp(argv[i], "-pairs")==0 && i+1<argc) pairList = argv[++i];
+		else if (strcmp(argv[i], "-grids")==0 && i+1<argc) gridList = argv[++i];
+		else { printf("Unknown option %s\n", argv[i]); return 1; }
+	}
+
+	std::vector<int> threads = parseList(threadList), points = parseList(pointList), pairs = parseList(pairList);
+	std::vector<CvSize> resolutions = parseSizes(resolutionList), grids = parseSizes(gridList);
+
+	std::string animationXml;
+	if (FILE *f = fopen("Media/animations.xml", "rb")) {
+		char buffer[4096]; size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), f))>0) animationXml.append(buffer, n);
+		fclose(f);
+	} else {
+		printf("Could not read Media/animations.xml, run from the project directory\n");
+		return 1;
+	}
+
+	//Every kernel at every size, each with a label for the results
+	std::vector<std::string> names, sizes; std::vector<KernelFactory*> factories;
+	for (int i=0; i<pairs.size(); i++) { names.push_back("findTransform"); sizes.push_back(countName(pairs[i])); factories.push_back(new FindTransformFactory(pairs[i])); }
+	names.push_back("JacobiN"); sizes.push_back("4x4"); factories.push_back(new JacobiFactory());
+	for (int i=0; i<resolutions.size(); i++) {
+		std::string s = sizeName(resolutions[i]);
+		names.push_back("inpaintDepth.full"); sizes.push_back(s); factories.push_back(new InpaintFactory(resolutions[i], false));
+		names.push_back("inpaintDepth.half"); sizes.push_back(s); factories.push_back(new InpaintFactory(resolutions[i], true));
+		names.push_back("getDepthMask"); sizes.push_back(s); factories.push_back(new KinectImageFactory(resolutions[i], false));
+		names.push_back("getColour"); sizes.push_back(s); factories.push_back(new KinectImageFactory(resolutions[i], true));
+	}
+	for (int i=0; i<points.size(); i++) { names.push_back("getTransformedPoints"); sizes.push_back(countName(points[i])); factories.push_back(new TransformPointsFactory(points[i])); }
+	for (int i=0; i<grids.size(); i++) { names.push_back("updateHeightMap"); sizes.push_back(sizeName(grids[i])); factories.push_back(new HeightMapFactory(grids[i])); }
+	names.push_back("spiderUpdate"); sizes.push_back("1"); factories.push_back(new SpiderUpdateFactory());
+	names.push_back("parseAnimationXml"); sizes.push_back(countName(animationXml.size())); factories.push_back(new AnimationXmlFactory(animationXml));
+
+	std::vector<BenchmarkResult> results;
+	for (int k=0; k<factories.size(); k++) {
+		if (only && names[k].find(only)==std::string::npos) continue;
+		for (int t=0; t<threads.size(); t++) results.push_back(runBenchmark(names[k], sizes[k], MAX(1, threads[t]), factories[k], minSeconds));
+	}
+	for (int k=0; k<factories.size(); k++) delete factories[k];
+
+	return writeResults(out, results, minSeconds) ? 0 : 1;
+}
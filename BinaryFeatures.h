@@ -0,0 +1,319 @@
+#ifndef BINARYFEATURES_H
+#define BINARYFEATURES_H
+
+#include <cv.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BINARY_AVX2
+#endif
+
+//MSVC uses the POPCNT instruction when BINARY_POPCNT is defined, as the Release configuration does.
+//Those builds need a CPU that has it (Intel Nehalem, AMD Barcelona or later).
+#if defined(__GNUC__)
+#define BINARY_POPCOUNT32(x) __builtin_popcount(x)
+#elif defined(_MSC_VER) && defined(BINARY_POPCNT)
+#include <intrin.h>
+#define BINARY_POPCOUNT32(x) __popcnt(x)
+#endif
+
+// Number of bytes in each binary descriptor
+#define BINARY_DESCRIPTOR_SIZE 32
+
+struct BinaryFeature {
+	float x, y;        // Position in the input image
+	float angle;       // Orientation in radians
+	float response;    // FAST score
+	int level;         // Pyramid level the feature was found on
+};
+
+struct BinaryMatch {
+	int queryIdx, trainIdx;
+	int distance;
+};
+
+inline unsigned int popCount32(unsigned int v) {
+#ifdef BINARY_POPCOUNT32
+	return BINARY_POPCOUNT32(v);
+#else
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+	return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+}
+
+// Hamming distance between two 256 bit descriptors
+inline int hammingDistance(const unsigned char *a, const unsigned char *b) {
+#ifdef BINARY_AVX2
+	const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+	const __m256i lowMask = _mm256_set1_epi8(0x0f);
+	__m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)a), _mm256_loadu_si256((const __m256i*)b));
+	__m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(x, lowMask)),
+		_mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(x, 4), lowMask)));
+	__m256i sums = _mm256_sad_epu8(counts, _mm256_setzero_si256());
+	return _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+#else
+	const unsigned int *a32 = (const unsigned int*)a, *b32 = (const unsigned int*)b;
+	int distance = 0;
+	for (int i=0; i<BINARY_DESCRIPTOR_SIZE/4; i++) distance += popCount32(a32[i]^b32[i]);
+	return distance;
+#endif
+}
+
+// Brute force Hamming matching with Lowe's ratio test
+inline void matchBinaryDescriptors(const std::vector<unsigned char> &query, const std::vector<unsigned char> &train, std::vector<BinaryMatch> &matches, float ratio = 0.8f, int maxDistance = 64) {
+	int nQuery = query.size()/BINARY_DESCRIPTOR_SIZE, nTrain = train.size()/BINARY_DESCRIPTOR_SIZE;
+	matches.clear();
+	if (nTrain<2) return;
+
+	for (int q=0; q<nQuery; q++) {
+		const unsigned char *qd = &query[q*BINARY_DESCRIPTOR_SIZE];
+		int best = 257, second = 257, bestIdx = -1;
+		for (int t=0; t<nTrain; t++) {
+			int d = hammingDistance(qd, &train[t*BINARY_DESCRIPTOR_SIZE]);
+			if (d<best) { second = best; best = d; bestIdx = t; }
+			else if (d<second) second = d;
+		}
+		if (best<=maxDistance && best < ratio*second) {
+			BinaryMatch m; m.queryIdx = q; m.trainIdx = bestIdx; m.distance = best;
+			matches.push_back(m);
+		}
+	}
+}
+
+// Locality sensitive hashing over binary descriptors for matching against many markers at once.
+// Each table keys a descriptor on a fixed pseudo random subset of its bits and a query also probes
+// every bucket one bit flip away, so close descriptors are found with high probability while only
+// a small fraction of the database has its Hamming distance measured.
+class BinaryLSHIndex {
+public:
+	BinaryLSHIndex(int _tables = 8, int _keyBits = 16) {
+		tables = _tables; keyBits = _keyBits; train = 0; queryId = 0;
+
+		unsigned int seed = 0x9E3779B9;
+		keyPositions.resize(tables*keyBits);
+		for (int i=0; i<keyPositions.size(); i++) { seed = seed*1664525u + 1013904223u; keyPositions[i] = (seed>>8) % (BINARY_DESCRIPTOR_SIZE*8); }
+	}
+
+	// Index the descriptors, which must stay unchanged until the next build
+	void build(const std::vector<unsigned char> &descriptors) {
+		train = &descriptors;
+		int n = descriptors.size()/BINARY_DESCRIPTOR_SIZE, buckets = 1<<keyBits;
+
+		bucketStart.assign(tables*(buckets+1), 0);
+		entries.resize(tables*n);
+		for (int t=0; t<tables; t++) {
+			int *start = &bucketStart[t*(buckets+1)];
+			std::vector<unsigned int> keys(n);
+			for (int i=0; i<n; i++) { keys[i] = hashKey(t, &descriptors[i*BINARY_DESCRIPTOR_SIZE]); start[keys[i]+1]++; }
+			for (int b=0; b<buckets; b++) start[b+1] += start[b];
+
+			std::vector<int> fill(start, start+buckets);
+			for (int i=0; i<n; i++) entries[t*n + fill[keys[i]]++] = i;
+		}
+
+		visited.assign(n, 0); queryId = 0;
+	}
+
+	// As matchBinaryDescriptors, with the nearest and second nearest taken from the probed buckets
+	void match(const std::vector<unsigned char> &query, std::vector<BinaryMatch> &matches, float ratio = 0.8f, int maxDistance = 64) {
+		int nQuery = query.size()/BINARY_DESCRIPTOR_SIZE, n = train ? train->size()/BINARY_DESCRIPTOR_SIZE : 0, buckets = 1<<keyBits;
+		matches.clear();
+		if (n<2) return;
+
+		for (int q=0; q<nQuery; q++) {
+			const unsigned char *qd = &query[q*BINARY_DESCRIPTOR_SIZE];
+			int best = 257, second = 257, bestIdx = -1;
+			if (++queryId==0) { visited.assign(n, 0); queryId = 1; }
+
+			for (int t=0; t<tables; t++) {
+				const int *start = &bucketStart[t*(buckets+1)], *tableEntries = &entries[t*n];
+				unsigned int key = hashKey(t, qd);
+				for (int flip=-1; flip<keyBits; flip++) {
+					unsigned int probe = flip<0 ? key : key^(1u<<flip);
+					for (int e=start[probe]; e<start[probe+1]; e++) {
+						int i = tableEntries[e];
+						if (visited[i]==queryId) continue;
+						visited[i] = queryId;
+
+						int d = hammingDistance(qd, &(*train)[i*BINARY_DESCRIPTOR_SIZE]);
+						if (d<best) { second = best; best = d; bestIdx = i; }
+						else if (d<second) second = d;
+					}
+				}
+			}
+
+			if (bestIdx>=0 && best<=maxDistance && best < ratio*second) {
+				BinaryMatch m; m.queryIdx = q; m.trainIdx = bestIdx; m.distance = best;
+				matches.push_back(m);
+			}
+		}
+	}
+
+private:
+	int tables, keyBits;
+	std::vector<int> keyPositions;
+	std::vector<int> bucketStart, entries;
+	const std::vector<unsigned char> *train;
+	std::vector<unsigned int> visited;
+	unsigned int queryId;
+
+	unsigned int hashKey(int table, const unsigned char *desc) {
+		const int *pos = &keyPositions[table*keyBits];
+		unsigned int key = 0;
+		for (int b=0; b<keyBits; b++) key |= ((desc[pos[b]>>3]>>(pos[b]&7))&1u) << b;
+		return key;
+	}
+};
+
+// ORB style features: FAST corners on an image pyramid, oriented by their intensity centroid and
+// described with 256 rotated BRIEF intensity comparisons on a smoothed image.
+class BinaryFeatureExtractor {
+public:
+	BinaryFeatureExtractor(int _maxFeatures = 500, int _levels = 4, float _scaleFactor = 1.3f, int _fastThreshold = 20) {
+		maxFeatures = _maxFeatures; levels = _levels; scaleFactor = _scaleFactor; fastThreshold = _fastThreshold;
+		createPattern();
+	}
+
+	~BinaryFeatureExtractor() { releasePyramid(); }
+
+	// Extract features from a greyscale image, BINARY_DESCRIPTOR_SIZE bytes of descriptor per feature
+	void extract(IplImage *grey, std::vector<BinaryFeature> &features, std::vector<unsigned char> &descriptors) {
+		features.clear(); descriptors.clear();
+		buildPyramid(grey);
+
+		//Share the features between the levels in proportion to their area
+		float levelShare = 0, area = 1;
+		for (int l=0; l<levels; l++) { levelShare += area; area /= scaleFactor*scaleFactor; }
+		float nPerLevel = maxFeatures/levelShare;
+
+		std::vector<cv::KeyPoint> keypoints;
+		for (int l=0; l<levels; l++) {
+			IplImage *level = pyramid.at(l);
+			keypoints.clear();
+			cv::FAST(cv::Mat(level), keypoints, fastThreshold, true);
+
+			//Discard features too close to the border for the descriptor pattern
+			int n = 0;
+			for (int i=0; i<keypoints.size(); i++) {
+				const cv::Point2f &p = keypoints[i].pt;
+				if (p.x>=border && p.y>=border && p.x<level->width-border && p.y<level->height-border) keypoints[n++] = keypoints[i];
+			}
+			keypoints.resize(n);
+
+			//Keep the strongest corners
+			int keep = int(nPerLevel+0.5f); nPerLevel /= scaleFactor*scaleFactor;
+			if (keypoints.size()>keep) {
+				std::nth_element(keypoints.begin(), keypoints.begin()+keep, keypoints.end(), compareResponse);
+				keypoints.resize(keep);
+			}
+
+			float scale = pow(scaleFactor, l);
+			int first = descriptors.size(); descriptors.resize(first + keypoints.size()*BINARY_DESCRIPTOR_SIZE);
+			for (int i=0; i<keypoints.size(); i++) {
+				BinaryFeature f;
+				f.angle = calcOrientation(level, int(keypoints[i].pt.x+0.5f), int(keypoints[i].pt.y+0.5f));
+				f.x = keypoints[i].pt.x*scale; f.y = keypoints[i].pt.y*scale;
+				f.response = keypoints[i].response; f.level = l;
+				describe(smoothed.at(l), int(keypoints[i].pt.x+0.5f), int(keypoints[i].pt.y+0.5f), f.angle, &descriptors[first + i*BINARY_DESCRIPTOR_SIZE]);
+				features.push_back(f);
+			}
+		}
+	}
+
+private:
+	int maxFeatures, levels, fastThreshold;
+	float scaleFactor;
+
+	std::vector<IplImage*> pyramid, smoothed;
+
+	static const int patchSize = 31, halfPatch = 15, border = 23, angleBins = 30;
+	int umax[halfPatch+1];
+	// For each orientation bin, 256 pairs of (x,y) offsets
+	std::vector<signed char> rotatedPattern[angleBins];
+
+	static bool compareResponse(const cv::KeyPoint &a, const cv::KeyPoint &b) { return a.response > b.response; }
+
+	void releasePyramid() {
+		for (int i=1; i<pyramid.size(); i++) cvReleaseImage(&pyramid.at(i));
+		for (int i=0; i<smoothed.size(); i++) cvReleaseImage(&smoothed.at(i));
+		pyramid.clear(); smoothed.clear();
+	}
+
+	void buildPyramid(IplImage *grey) {
+		if (pyramid.size()!=levels || pyramid.at(0)->width!=grey->width || pyramid.at(0)->height!=grey->height) {
+			releasePyramid();
+			pyramid.push_back(grey);
+			for (int l=1; l<levels; l++) {
+				float scale = pow(scaleFactor, l);
+				pyramid.push_back(cvCreateImage(cvSize(cvRound(grey->width/scale), cvRound(grey->height/scale)), IPL_DEPTH_8U, 1));
+			}
+			for (int l=0; l<levels; l++) smoothed.push_back(cvCreateImage(cvGetSize(pyramid.at(l)), IPL_DEPTH_8U, 1));
+		}
+		pyramid.at(0) = grey;
+		for (int l=1; l<levels; l++) cvResize(grey, pyramid.at(l), CV_INTER_AREA);
+		for (int l=0; l<levels; l++) cvSmooth(pyramid.at(l), smoothed.at(l), CV_GAUSSIAN, 7, 7, 2);
+	}
+
+	// Generate a fixed pseudo random BRIEF test pattern and its rotations
+	void createPattern() {
+		for (int v=0; v<=halfPatch; v++) umax[v] = cvRound(sqrt(double(halfPatch*halfPatch - v*v)));
+
+		std::vector<float> pattern(512*2);
+		unsigned int seed = 0x2545F491;
+		for (int i=0; i<512*2; i++) {
+			//Approximately Gaussian samples (sum of uniforms), sigma of patchSize/5, clipped to the patch
+			float sum = 0;
+			for (int k=0; k<4; k++) { seed = seed*1664525u + 1013904223u; sum += (seed>>8)/float(1<<24); }
+			float v = (sum-2.0f)*sqrt(3.0f)*(patchSize/5.0f);
+			pattern[i] = MAX(-halfPatch, MIN(halfPatch, v));
+		}
+
+		for (int b=0; b<angleBins; b++) {
+			float a = b*2*CV_PI/angleBins, c = cos(a), s = sin(a);
+			rotatedPattern[b].resize(512*2);
+			for (int i=0; i<512; i++) {
+				float x = pattern[i*2], y = pattern[i*2+1];
+				rotatedPattern[b][i*2] = (signed char)cvRound(x*c - y*s);
+				rotatedPattern[b][i*2+1] = (signed char)cvRound(x*s + y*c);
+			}
+		}
+	}
+
+	// Angle of the vector from the keypoint to the intensity centroid of the circular patch
+	float calcOrientation(IplImage *im, int x, int y) {
+		int m01 = 0, m10 = 0, step = im->widthStep;
+		const unsigned char *centre = (const unsigned char*)im->imageData + y*step + x;
+
+		for (int u=-halfPatch; u<=halfPatch; u++) m10 += u*centre[u];
+		for (int v=1; v<=halfPatch; v++) {
+			int vSum = 0;
+			for (int u=-umax[v]; u<=umax[v]; u++) {
+				int above = centre[u - v*step], below = centre[u + v*step];
+				vSum += below - above; m10 += u*(below + above);
+			}
+			m01 += v*vSum;
+		}
+		return atan2((float)m01, (float)m10);
+	}
+
+	void describe(IplImage *im, int x, int y, float angle, unsigned char *desc) {
+		int bin = cvRound(angle*angleBins/(2*CV_PI)); bin = ((bin%angleBins)+angleBins)%angleBins;
+		const signed char *p = &rotatedPattern[bin][0];
+		const unsigned char *centre = (const unsigned char*)im->imageData + y*im->widthStep + x;
+		int step = im->widthStep;
+
+		for (int i=0; i<BINARY_DESCRIPTOR_SIZE; i++) {
+			unsigned char byte = 0;
+			for (int b=0; b<8; b++, p+=4) {
+				if (centre[p[1]*step + p[0]] < centre[p[3]*step + p[2]]) byte |= 1<<b;
+			}
+			desc[i] = byte;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef BINARYREGISTRATION_H
+#define BINARYREGISTRATION_H
+
+#include <cv.h>
+#include <highgui.h>
+#include <string>
+#include <vector>
+
+#include "MarkerRegistration.h"
+#include "BinaryFeatures.h"
+
+// Natural feature registration using binary descriptors and Hamming distance matching, a faster
+// alternative to the SURF based OPIRA registration. The descriptors of all markers share one LSH
+// index, so the cost of matching a frame grows slowly with the number of markers.
+class BinaryRegistration : public MarkerRegistration {
+public:
+	BinaryRegistration(int maxFeatures = 500) : extractor(maxFeatures, 4), markerExtractor(maxFeatures*2, 6) {
+		grey = 0; minInliers = 12; indexDirty = false;
+	}
+
+	~BinaryRegistration() {
+		if (grey) cvReleaseImage(&grey);
+	}
+
+	std::vector<MarkerTransform> performRegistration(IplImage *frame_input, CvMat *captureParams, CvMat *captureDistortion) {
+		std::vector<MarkerTransform> retVal;
+
+		if (grey==0 || grey->width!=frame_input->width || grey->height!=frame_input->height) {
+			if (grey) cvReleaseImage(&grey);
+			grey = cvCreateImage(cvGetSize(frame_input), IPL_DEPTH_8U, 1);
+		}
+		if (frame_input->nChannels==1) cvCopy(frame_input, grey); else cvCvtColor(frame_input, grey, CV_BGR2GRAY);
+
+		extractor.extract(grey, features, descriptors);
+		if (markers.empty()) return retVal;
+
+		//Match against every marker at once, then share the matches out between the markers
+		if (indexDirty) buildIndex();
+		index.match(descriptors, matches);
+
+		for (int m=0; m<markers.size(); m++) markerMatches[m].clear();
+		for (int i=0; i<matches.size(); i++) markerMatches[descriptorMarker[matches[i].trainIdx]].push_back(i);
+
+		for (int m=0; m<markers.size(); m++) {
+			if (markerMatches[m].size()<minInliers) continue;
+			BinaryMarker &marker = markers.at(m);
+
+			std::vector<CvPoint2D32f> markerPts(markerMatches[m].size()), framePts(markerMatches[m].size());
+			for (int i=0; i<markerMatches[m].size(); i++) {
+				const BinaryMatch &match = matches[markerMatches[m][i]];
+				const BinaryFeature &f = features[match.queryIdx], &mf = allFeatures[match.trainIdx];
+				framePts[i] = cvPoint2D32f(f.x, f.y); markerPts[i] = cvPoint2D32f(mf.x, mf.y);
+			}
+
+			MarkerTransform mt;
+			if (estimateMarkerTransform(markerPts, framePts, marker.name, marker.size, marker.scale, captureParams, captureDistortion, minInliers, mt)) retVal.push_back(mt);
+		}
+
+		return retVal;
+	}
+
+	void addResizedMarker(std::string markerName, int maxLengthSize) {
+		addMarker(markerName, maxLengthSize, 0);
+	}
+
+	// The marker is measured in units such that its longest side is maxLengthScale long
+	void addResizedScaledMarker(std::string markerName, int maxLengthSize, int maxLengthScale) {
+		addMarker(markerName, maxLengthSize, maxLengthScale);
+	}
+
+	void removeMarker(std::string markerName) {
+		for (std::vector<BinaryMarker>::iterator m = markers.begin(); m!=markers.end(); m++) {
+			if (m->name==markerName) { markers.erase(m); indexDirty = true; return; }
+		}
+	}
+
+private:
+	struct BinaryMarker {
+		std::string name;
+		CvSize size;
+		float scale;
+		std::vector<BinaryFeature> features;
+		std::vector<unsigned char> descriptors;
+	};
+
+	BinaryFeatureExtractor extractor, markerExtractor;
+	std::vector<BinaryMarker> markers;
+	int minInliers;
+
+	//Descriptors of all the markers, indexed together
+	BinaryLSHIndex index;
+	std::vector<BinaryFeature> allFeatures;
+	std::vector<unsigned char> allDescriptors;
+	std::vector<int> descriptorMarker;
+	std::vector<std::vector<int> > markerMatches;
+	bool indexDirty;
+
+	IplImage *grey;
+	std::vector<BinaryFeature> features;
+	std::vector<unsigned char> descriptors;
+	std::vector<BinaryMatch> matches;
+
+	bool addMarker(std::string markerName, int maxLengthSize, int maxLengthScale) {
+		IplImage *markerIm = cvLoadImage(markerName.c_str(), CV_LOAD_IMAGE_GRAYSCALE);
+		if (markerIm==0) { printf("Could not load marker %s\n", markerName.c_str()); return false; }
+
+		BinaryMarker marker; marker.name = markerName;
+		float resize = float(maxLengthSize)/float(MAX(markerIm->width, markerIm->height));
+		marker.size = cvSize(cvRound(markerIm->width*resize), cvRound(markerIm->height*resize));
+		marker.scale = maxLengthScale>0 ? float(maxLengthScale)/float(MAX(marker.size.width, marker.size.height)) : 1;
+
+		IplImage *resized = cvCreateImage(marker.size, IPL_DEPTH_8U, 1);
+		cvResize(markerIm, resized, CV_INTER_AREA);
+		markerExtractor.extract(resized, marker.features, marker.descriptors);
+		cvReleaseImage(&resized); cvReleaseImage(&markerIm);
+
+		markers.push_back(marker); indexDirty = true;
+		return true;
+	}
+
+	void buildIndex() {
+		allFeatures.clear(); allDescriptors.clear(); descriptorMarker.clear();
+		for (int m=0; m<markers.size(); m++) {
+			allFeatures.insert(allFeatures.end(), markers[m].features.begin(), markers[m].features.end());
+			allDescriptors.insert(allDescriptors.end(), markers[m].descriptors.begin(), markers[m].descriptors.end());
+			descriptorMarker.resize(allFeatures.size(), m);
+		}
+		index.build(allDescriptors);
+		markerMatches.resize(markers.size());
+		indexDirty = false;
+	}
+};
+
+#endif
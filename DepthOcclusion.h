@@ -0,0 +1,191 @@
+#ifndef DEPTHOCCLUSION_H
+#define DEPTHOCCLUSION_H
+
+#include <cv.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DEPTHOCCLUSION_SSE2
+#endif
+
+#include <osg/Projection>
+#include <osg/MatrixTransform>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/TextureRectangle>
+#include <osg/ColorMask>
+#include <osg/Depth>
+#include <osg/Program>
+#include <osg/Uniform>
+
+// Reprojects Kinect depth into the AR camera's view. Each depth pixel goes through the Kinect's
+// real world conversion, the Kinect to marker transform, the marker pose and the camera projection,
+// which all fold into one matrix per frame, so the per pixel work is a few multiply-adds. The result
+// is the view depth (clip w, in marker units) of the nearest surface at each camera pixel, with rows
+// in OpenGL window order (bottom row first) and 0 where nothing was seen.
+class DepthReprojector {
+public:
+	DepthReprojector(int _width, int _height, const double *_projMat) {
+		width = _width; height = _height;
+		memcpy(projMat, _projMat, 16*sizeof(double));
+		depthMap.resize(width*height);
+	}
+
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+
+	// kinectTransform maps Kinect real world points to marker space (KinectAR::getTransform), transMat
+	// is the marker's pose in the AR camera as rendered
+	const std::vector<unsigned short> &reproject(const unsigned short *depth, CvSize depthSize, float xzFactor, float yzFactor, CvMat *kinectTransform, const double *transMat) {
+		std::fill(depthMap.begin(), depthMap.end(), 0);
+
+		//Clip space = projection * pose * (flip z to the marker frame) * Kinect transform * real world
+		double P[16], T[16], K[16], PT[16], M[16];
+		for (int r=0; r<4; r++) for (int c=0; c<4; c++) {
+			P[r*4+c] = projMat[c*4+r]; T[r*4+c] = transMat[c*4+r];
+			K[r*4+c] = cvmGet(kinectTransform, r, c) * (r==2 ? -1 : 1);
+		}
+		multiply(P, T, PT); multiply(PT, K, M);
+
+		//Real world X and Y are linear in depth, so the column and row terms are precomputed
+		colX.resize(depthSize.width); colY.resize(depthSize.width); colW.resize(depthSize.width);
+		for (int u=0; u<depthSize.width; u++) {
+			float a = (float(u)/depthSize.width - 0.5f)*xzFactor;
+			colX[u] = M[0]*a; colY[u] = M[4]*a; colW[u] = M[12]*a;
+		}
+
+		for (int v=0; v<depthSize.height; v++) {
+			float b = (0.5f - float(v)/depthSize.height)*yzFactor;
+			float rowX = M[1]*b + M[2], rowY = M[5]*b + M[6], rowW = M[13]*b + M[14];
+			const unsigned short *d = depth + v*depthSize.width;
+			int u = 0;
+
+#ifdef DEPTHOCCLUSION_SSE2
+			__m128 rx = _mm_set1_ps(rowX), ry = _mm_set1_ps(rowY), rw = _mm_set1_ps(rowW);
+			__m128 tx = _mm_set1_ps(M[3]), ty = _mm_set1_ps(M[7]), tw = _mm_set1_ps(M[15]);
+			__m128 halfW = _mm_set1_ps(width*0.5f), halfH = _mm_set1_ps(height*0.5f), nearW = _mm_set1_ps(1.0f);
+			__m128i zero = _mm_setzero_si128();
+			int ix[4], iy[4]; float w[4];
+			for (; u+4<=depthSize.width; u+=4) {
+				__m128i d16 = _mm_loadl_epi64((const __m128i*)(d+u));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi16(d16, zero))==0xFFFF) continue;
+				__m128 z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(d16, zero));
+
+				__m128 cx = _mm_add_ps(_mm_mul_ps(z, _mm_add_ps(_mm_loadu_ps(&colX[u]), rx)), tx);
+				__m128 cy = _mm_add_ps(_mm_mul_ps(z, _mm_add_ps(_mm_loadu_ps(&colY[u]), ry)), ty);
+				__m128 cw = _mm_add_ps(_mm_mul_ps(z, _mm_add_ps(_mm_loadu_ps(&colW[u]), rw)), tw);
+
+				//Points behind the camera (or without depth, which gives w = tw) are dropped below
+				__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(cw, nearW));
+				__m128 sx = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cx, inv), halfW), halfW);
+				__m128 sy = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cy, inv), halfH), halfH);
+				_mm_storeu_si128((__m128i*)ix, _mm_cvttps_epi32(sx));
+				_mm_storeu_si128((__m128i*)iy, _mm_cvttps_epi32(sy));
+				_mm_storeu_ps(w, cw);
+
+				for (int k=0; k<4; k++) if (d[u+k]) splat(ix[k], iy[k], w[k]);
+			}
+#endif
+			for (; u<depthSize.width; u++) {
+				if (d[u]==0) continue;
+				float z = d[u];
+				float cx = z*(colX[u]+rowX) + M[3], cy = z*(colY[u]+rowY) + M[7], cw = z*(colW[u]+rowW) + M[15];
+				if (cw<1.0f) continue;
+				splat(int((cx/cw)*width*0.5f + width*0.5f), int((cy/cw)*height*0.5f + height*0.5f), cw);
+			}
+		}
+
+		return depthMap;
+	}
+
+private:
+	int width, height;
+	double projMat[16];
+	std::vector<unsigned short> depthMap;
+	std::vector<float> colX, colY, colW;
+
+	static void multiply(const double *a, const double *b, double *out) {
+		for (int r=0; r<4; r++) for (int c=0; c<4; c++) {
+			out[r*4+c] = a[r*4]*b[c] + a[r*4+1]*b[4+c] + a[r*4+2]*b[8+c] + a[r*4+3]*b[12+c];
+		}
+	}
+
+	// The Kinect is sparser than the camera where it sees a surface obliquely, so each point covers 2x2 pixels
+	inline void splat(int x, int y, float w) {
+		if (w<1.0f || x<0 || y<0 || x>=width-1 || y>=height-1) return;
+		unsigned short value = w>65535.0f ? 65535 : (unsigned short)w;
+		unsigned short *p = &depthMap[y*width + x];
+		if (p[0]==0 || value<p[0]) p[0] = value;
+		if (p[1]==0 || value<p[1]) p[1] = value;
+		if (p[width]==0 || value<p[width]) p[width] = value;
+		if (p[width+1]==0 || value<p[width+1]) p[width+1] = value;
+	}
+};
+
+// A full screen depth only pass writing the reprojected Kinect depth into the depth buffer, so real
+// objects in front of virtual ones hide them. It belongs first in the foreground camera, after the
+// camera's depth clear, and converts view depth back to window depth with the camera's projection.
+class DepthOcclusionPass : public osg::Projection {
+public:
+	DepthOcclusionPass(int _width, int _height, const double *projMat) : osg::Projection(osg::Matrix::ortho2D(0, _width, 0, _height)) {
+		width = _width; height = _height;
+
+		depthImage = new osg::Image();
+		depthImage->allocateImage(width, height, 1, GL_LUMINANCE, GL_UNSIGNED_SHORT);
+		memset(depthImage->data(), 0, depthImage->getTotalSizeInBytes());
+		depthImage->setInternalTextureFormat(GL_LUMINANCE16);
+		depthImage->setDataVariance(osg::Object::DYNAMIC);
+
+		osg::ref_ptr<osg::TextureRectangle> texture = new osg::TextureRectangle(depthImage.get());
+		texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+		texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+
+		osg::ref_ptr<osg::Geometry> quad = osg::createTexturedQuadGeometry(osg::Vec3(0, 0, 0), osg::X_AXIS * width, osg::Y_AXIS * height, 0, 0, width, height);
+		quad->setUseDisplayList(false);
+		osg::ref_ptr<osg::Geode> geode = new osg::Geode(); geode->addDrawable(quad.get());
+
+		osg::StateSet *ss = geode->getOrCreateStateSet();
+		ss->setDataVariance(osg::Object::DYNAMIC);
+		ss->setTextureAttributeAndModes(0, texture.get());
+		ss->setAttributeAndModes(new osg::ColorMask(false, false, false, false));
+		ss->setAttributeAndModes(new osg::Depth(osg::Depth::ALWAYS, 0, 1, true));
+		ss->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+		ss->setRenderBinDetails(-1, "RenderBin");
+
+		//With clip z = A*z + B and clip w = C*z, window depth is 0.5*(A/C + B/w) + 0.5
+		osg::ref_ptr<osg::Program> program = new osg::Program();
+		program->addShader(new osg::Shader(osg::Shader::FRAGMENT,
+			"#extension GL_ARB_texture_rectangle : enable\n"
+			"uniform sampler2DRect depthMap;\n"
+			"uniform float depthA, depthB;\n"
+			"void main() {\n"
+			"	float w = texture2DRect(depthMap, gl_TexCoord[0].xy).r * 65535.0;\n"
+			"	if (w<=0.0) discard;\n"
+			"	gl_FragDepth = clamp(0.5*(depthA + depthB/w) + 0.5, 0.0, 1.0);\n"
+			"}\n"));
+		ss->setAttributeAndModes(program.get());
+		ss->addUniform(new osg::Uniform("depthMap", 0));
+		ss->addUniform(new osg::Uniform("depthA", float(projMat[10]/projMat[11])));
+		ss->addUniform(new osg::Uniform("depthB", float(projMat[14])));
+
+		osg::ref_ptr<osg::MatrixTransform> absolute = new osg::MatrixTransform();
+		absolute->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+		absolute->addChild(geode.get());
+		addChild(absolute.get());
+	}
+
+	// Map of width x height view depths from DepthReprojector
+	void setDepthMap(const unsigned short *depthMap) {
+		memcpy(depthImage->data(), depthMap, width*height*sizeof(unsigned short));
+		depthImage->dirty();
+	}
+
+private:
+	int width, height;
+	osg::ref_ptr<osg::Image> depthImage;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef GROUNDHEIGHTMAP_H
+#define GROUNDHEIGHTMAP_H
+
+#include <cv.h>
+#include <math.h>
+#include <vector>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+// Height of the surface over the marker plane, rebuilt from each Kinect frame's points in marker space
+// so spiders can look up the height under them without touching the Kinect. Each cell holds the mean
+// height of the points that fell in it, cells no point fell in take the height of the nearest cell that
+// had some. The map is built in a back buffer and swapped in, so it can be read from the render thread
+// while the main loop builds the next one. Cells are in the spider's frame, which has y negated from
+// the Kinect's marker space.
+class GroundHeightMap {
+public:
+	GroundHeightMap(float minX, float minY, float maxX, float maxY, float cellSize) {
+		setArea(minX, minY, maxX, maxY, cellSize);
+	}
+
+	// Resizes the map to a new area, it reads as flat until the next update
+	void setArea(float _minX, float _minY, float _maxX, float _maxY, float _cellSize) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(swapMutex);
+		minX = _minX; minY = _minY; cellSize = _cellSize;
+		cols = MAX(1, (int)ceil((_maxX-minX)/cellSize)); rows = MAX(1, (int)ceil((_maxY-minY)/cellSize));
+		heights[0].assign(cols*rows, 0); heights[1].assign(cols*rows, 0);
+		sum.assign(cols*rows, 0); hits.assign(cols*rows, 0);
+		front = 0; valid = false;
+	}
+
+	int getCols() { return cols; }
+	int getRows() { return rows; }
+	float getCellSize() { return cellSize; }
+	float getMinX() { return minX; }
+	float getMinY() { return minY; }
+
+	// Copies out the current map, row by row, returns false if there is none yet
+	bool copyGrid(std::vector<float> &grid) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(swapMutex);
+		if (!valid) return false;
+		grid.assign(heights[front].begin(), heights[front].end());
+		return true;
+	}
+
+	// Rebuilds the map from count points in the Kinect's marker space. Keeps the last map if none land on it.
+	void update(const CvPoint3D32f *points, int count) {
+		std::fill(sum.begin(), sum.end(), 0.0f); std::fill(hits.begin(), hits.end(), 0);
+		for (int i=0; i<count; i++) {
+			int c = (int)floor((points[i].x-minX)/cellSize), r = (int)floor((-points[i].y-minY)/cellSize);
+			if (c<0 || r<0 || c>=cols || r>=rows) continue;
+			sum[r*cols+c] += points[i].z; hits[r*cols+c]++;
+		}
+
+		//Holes are filled outwards from the cells with points, each taking the height of the cell that reached it first
+		std::vector<float> &back = heights[1-front];
+		queue.clear();
+		for (int i=0; i<cols*rows; i++) {
+			if (hits[i]>0) { back[i] = sum[i]/hits[i]; queue.push_back(i); }
+		}
+		if (queue.empty()) return;
+		for (int q=0; q<queue.size(); q++) {
+			int i = queue[q], c = i%cols, r = i/cols;
+			if (c>0) fill(i, i-1);
+			if (c<cols-1) fill(i, i+1);
+			if (r>0) fill(i, i-cols);
+			if (r<rows-1) fill(i, i+cols);
+		}
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(swapMutex);
+		front = 1-front; valid = true;
+	}
+
+	// Height at (x, y) in the spider's frame, interpolated between cell centres and clamped at the edges
+	float getHeight(float x, float y) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(swapMutex);
+		return sample(x, y);
+	}
+
+	// Heights for n points at once, under a single lock
+	void getHeights(const float *x, const float *y, float *z, int n) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(swapMutex);
+		for (int i=0; i<n; i++) z[i] = sample(x[i], y[i]);
+	}
+
+private:
+	float minX, minY, cellSize;
+	int cols, rows, front;
+	bool valid;
+	std::vector<float> heights[2], sum;
+	std::vector<int> hits, queue;
+	OpenThreads::Mutex swapMutex;
+
+	// Hits doubles as the visited mark while filling
+	inline void fill(int from, int to) {
+		if (hits[to]!=0) return;
+		hits[to] = -1; heights[1-front][to] = heights[1-front][from];
+		queue.push_back(to);
+	}
+
+	inline float sample(float x, float y) {
+		if (!valid) return 0;
+		const std::vector<float> &h = heights[front];
+		float fx = MIN(MAX((x-minX)/cellSize-0.5f, 0.0f), float(cols-1));
+		float fy = MIN(MAX((y-minY)/cellSize-0.5f, 0.0f), float(rows-1));
+		int c0 = (int)fx, r0 = (int)fy, c1 = MIN(c0+1, cols-1), r1 = MIN(r0+1, rows-1);
+		float tx = fx-c0, ty = fy-r0;
+		float top = h[r0*cols+c0] + (h[r0*cols+c1]-h[r0*cols+c0])*tx;
+		float bottom = h[r1*cols+c0] + (h[r1*cols+c1]-h[r1*cols+c0])*tx;
+		return top + (bottom-top)*ty;
+	}
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef HEIGHTFIELDMESH_H
+#define HEIGHTFIELDMESH_H
+
+#include <cv.h>
+#include <math.h>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/PrimitiveSet>
+
+// A grid of cols x rows shared vertices drawn as indexed triangles from vertex buffer objects. The
+// grid is split into tiles, each its own geometry, and an update only re-uploads the tiles in which
+// some vertex moved by more than epsilon.
+class HeightFieldMesh : public osg::Geode {
+public:
+	HeightFieldMesh(int _cols, int _rows, int _tileCells = 32, float _epsilon = 2.0f) : osg::Geode() {
+		cols = _cols; rows = _rows; tileCells = _tileCells; epsilon = _epsilon;
+
+		for (int y0=0; y0<rows-1; y0+=tileCells) {
+			for (int x0=0; x0<cols-1; x0+=tileCells) {
+				Tile t;
+				t.x0 = x0; t.y0 = y0;
+				t.width = MIN(tileCells, cols-1-x0)+1; t.height = MIN(tileCells, rows-1-y0)+1;
+
+				t.vertices = new osg::Vec3Array(t.width*t.height);
+				for (int y=0; y<t.height; y++) for (int x=0; x<t.width; x++) (*t.vertices)[y*t.width+x].set(x0+x, y0+y, 0);
+
+				//Two triangles per cell, tiles are small enough for 16 bit indices
+				osg::ref_ptr<osg::DrawElementsUShort> indices = new osg::DrawElementsUShort(GL_TRIANGLES);
+				for (int y=0; y<t.height-1; y++) {
+					for (int x=0; x<t.width-1; x++) {
+						unsigned short i = y*t.width+x;
+						indices->push_back(i); indices->push_back(i+1); indices->push_back(i+t.width+1);
+						indices->push_back(i); indices->push_back(i+t.width+1); indices->push_back(i+t.width);
+					}
+				}
+
+				t.geometry = new osg::Geometry();
+				t.geometry->setUseDisplayList(false);
+				t.geometry->setUseVertexBufferObjects(true);
+				t.geometry->setDataVariance(osg::Object::DYNAMIC);
+				t.geometry->setVertexArray(t.vertices.get());
+				t.geometry->addPrimitiveSet(indices.get());
+				addDrawable(t.geometry.get());
+				tiles.push_back(t);
+			}
+		}
+	}
+
+	int getCols() { return cols; }
+	int getRows() { return rows; }
+
+	void setColour(const osg::Vec4 &colour) {
+		osg::ref_ptr<osg::Vec4Array> col = new osg::Vec4Array(); col->push_back(colour);
+		for (int i=0; i<tiles.size(); i++) {
+			tiles[i].geometry->setColorArray(col.get());
+			tiles[i].geometry->setColorBinding(osg::Geometry::BIND_OVERALL);
+		}
+	}
+
+	// Move the vertices to points (cols x rows, row major), returns the number of tiles uploaded
+	int update(const CvPoint3D32f *points) {
+		int uploaded = 0;
+		for (int i=0; i<tiles.size(); i++) {
+			Tile &t = tiles[i];
+			if (!tileChanged(t, points)) continue;
+
+			for (int y=0; y<t.height; y++) {
+				const CvPoint3D32f *src = points + (t.y0+y)*cols + t.x0;
+				osg::Vec3 *dst = &(*t.vertices)[y*t.width];
+				for (int x=0; x<t.width; x++) dst[x].set(src[x].x, src[x].y, src[x].z);
+			}
+			t.vertices->dirty();
+			t.geometry->dirtyBound();
+			uploaded++;
+		}
+		return uploaded;
+	}
+
+private:
+	struct Tile {
+		int x0, y0, width, height;
+		osg::ref_ptr<osg::Vec3Array> vertices;
+		osg::ref_ptr<osg::Geometry> geometry;
+	};
+
+	int cols, rows, tileCells;
+	float epsilon;
+	std::vector<Tile> tiles;
+
+	bool tileChanged(const Tile &t, const CvPoint3D32f *points) {
+		for (int y=0; y<t.height; y++) {
+			const CvPoint3D32f *src = points + (t.y0+y)*cols + t.x0;
+			const osg::Vec3 *cur = &(*t.vertices)[y*t.width];
+			for (int x=0; x<t.width; x++) {
+				if (fabs(src[x].z-cur[x].z())>epsilon || fabs(src[x].x-cur[x].x())>epsilon || fabs(src[x].y-cur[x].y())>epsilon) return true;
+			}
+		}
+		return false;
+	}
+};
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef HEIGHTFIELDRAYCASTER_H
+#define HEIGHTFIELDRAYCASTER_H
+
+#include <float.h>
+#include <math.h>
+#include <vector>
+
+#include "GroundHeightMap.h"
+#include "ThreadPool.h"
+
+// Ray and segment queries against a GroundHeightMap, each cell taken as a flat box at its height. The
+// cells are summarised in a hierarchy of levels, each holding the lowest and highest height of 2x2
+// cells of the level below. A ray walks the cells of the coarsest level it can with a DDA, skipping any
+// cell it passes wholly above and dropping a level where it doesn't. Queries are batched as parallel
+// arrays: rays that pass above the whole map are rejected in one pass over the batch, which gathers the
+// rest into a list to be traced across a thread pool. Build and query from the same thread.
+class HeightFieldRaycaster {
+public:
+	HeightFieldRaycaster(int threads = 0) : pool(threads) {
+		cols = rows = 0; minX = minY = 0; cellSize = 1;
+	}
+
+	// Rebuilds from the map's current heights, returns false and keeps the last ones if it has none yet
+	bool update(GroundHeightMap *map) {
+		if (!map->copyGrid(base)) return false;
+		build(&base[0], map->getCols(), map->getRows(), map->getMinX(), map->getMinY(), map->getCellSize());
+		return true;
+	}
+
+	// Rebuilds from cols x rows heights, row by row, of cells cellSize across from (minX, minY)
+	void build(const float *heights, int _cols, int _rows, float _minX, float _minY, float _cellSize) {
+		cols = _cols; rows = _rows; minX = _minX; minY = _minY; cellSize = _cellSize;
+		maxX = minX + cols*cellSize; maxY = minY + rows*cellSize;
+		eps = cellSize*1e-3f;
+
+		levels.resize(1);
+		levels[0].cols = cols; levels[0].rows = rows; levels[0].size = cellSize;
+		levels[0].minH.assign(heights, heights+cols*rows); levels[0].maxH.assign(heights, heights+cols*rows);
+
+		while (levels.back().cols>1 || levels.back().rows>1) {
+			levels.resize(levels.size()+1);
+			Level &below = levels[levels.size()-2], &level = levels.back();
+			level.cols = (below.cols+1)/2; level.rows = (below.rows+1)/2; level.size = below.size*2;
+			level.minH.resize(level.cols*level.rows); level.maxH.resize(level.cols*level.rows);
+			for (int r=0; r<level.rows; r++) {
+				for (int c=0; c<level.cols; c++) {
+					float lo = FLT_MAX, hi = -FLT_MAX;
+					for (int y=2*r; y<MIN(2*r+2, below.rows); y++) {
+						for (int x=2*c; x<MIN(2*c+2, below.cols); x++) {
+							lo = MIN(lo, below.minH[y*below.cols+x]); hi = MAX(hi, below.maxH[y*below.cols+x]);
+						}
+					}
+					level.minH[r*level.cols+c] = lo; level.maxH[r*level.cols+c] = hi;
+				}
+			}
+		}
+	}
+
+	bool isBuilt() { return cols>0; }
+
+	// First hit of n rays from (ox, oy, oz) along unit directions (dx, dy, dz), no further than length.
+	// hitT gets the distance to the hit, FLT_MAX for a miss. Returns the number of hits.
+	int raycast(const float *ox, const float *oy, const float *oz, const float *dx, const float *dy, const float *dz,
+		const float *length, int n, float *hitT)
+	{
+		Batch b = {ox, oy, oz, dx, dy, dz, length, hitT, false};
+		return trace(b, n);
+	}
+
+	// Whether each of n segments from (x0, y0, z0) to (x1, y1, z1) passes through the surface
+	int occluded(const float *x0, const float *y0, const float *z0, const float *x1, const float *y1, const float *z1,
+		int n, unsigned char *blocked)
+	{
+		segDX.resize(n); segDY.resize(n); segDZ.resize(n); segLength.resize(n); segT.resize(n);
+		if (n==0) return 0;
+		for (int i=0; i<n; i++) {
+			float dx = x1[i]-x0[i], dy = y1[i]-y0[i], dz = z1[i]-z0[i];
+			float l = sqrt(dx*dx+dy*dy+dz*dz), inv = l>0 ? 1/l : 0;
+			segDX[i] = dx*inv; segDY[i] = dy*inv; segDZ[i] = dz*inv; segLength[i] = l;
+		}
+		Batch b = {x0, y0, z0, &segDX[0], &segDY[0], &segDZ[0], &segLength[0], &segT[0], true};
+		int hits = trace(b, n);
+		for (int i=0; i<n; i++) blocked[i] = segT[i]<FLT_MAX;
+		return hits;
+	}
+
+	// Height of the cell under (x, y), or -FLT_MAX off the map
+	float getHeight(float x, float y) {
+		if (cols==0 || x<minX || y<minY || x>=maxX || y>=maxY) return -FLT_MAX;
+		return levels[0].maxH[int((y-minY)/cellSize)*cols + int((x-minX)/cellSize)];
+	}
+
+private:
+	struct Level {
+		int cols, rows;
+		float size;
+		std::vector<float> minH, maxH;
+	};
+
+	struct Batch {
+		const float *ox, *oy, *oz, *dx, *dy, *dz, *length;
+		float *hitT;
+		bool anyHit;
+	};
+
+	int cols, rows;
+	float minX, minY, maxX, maxY, cellSize, eps;
+	std::vector<Level> levels;
+	std::vector<float> base, segDX, segDY, segDZ, segLength, segT;
+	std::vector<int> pending;
+	ThreadPool pool;
+
+	int trace(const Batch &b, int n) {
+		if (n==0) return 0;
+		if (cols==0) { for (int i=0; i<n; i++) b.hitT[i] = FLT_MAX; return 0; }
+
+		//Rays that stay above the highest cell can't hit anything, which is most of them when looking across the table
+		float top = levels.back().maxH[0];
+		pending.clear();
+		for (int i=0; i<n; i++) {
+			float lowest = MIN(b.oz[i], b.oz[i] + b.dz[i]*b.length[i]);
+			b.hitT[i] = FLT_MAX;
+			if (lowest<=top) pending.push_back(i);
+		}
+
+		//Only worth waking the pool for a big batch
+		if (pending.size()<256) {
+			for (int p=0; p<pending.size(); p++) traceRay(b, pending[p]);
+		} else {
+			int chunks = pool.getThreadCount()*4;
+			TraceJob job(this, &b, chunks); pool.parallelFor(chunks, &job);
+		}
+
+		int hits = 0;
+		for (int i=0; i<n; i++) hits += b.hitT[i]<FLT_MAX;
+		return hits;
+	}
+
+	void traceRay(const Batch &b, int i) {
+		float ox = b.ox[i], oy = b.oy[i], oz = b.oz[i], dx = b.dx[i], dy = b.dy[i], dz = b.dz[i];
+
+		//Clip to the map, nothing stands outside it
+		float t0 = 0, t1 = b.length[i];
+		if (!clip(ox, dx, minX, maxX, t0, t1) || !clip(oy, dy, minY, maxY, t0, t1)) return;
+
+		int topLevel = levels.size()-1, level = topLevel;
+		float t = t0;
+		while (t<t1) {
+			const Level &L = levels[level];
+			//Look the cell up a little past t, so a ray on a cell boundary finds the cell it is entering
+			float px = ox + dx*(t+eps), py = oy + dy*(t+eps);
+			int c = MIN(MAX((int)floor((px-minX)/L.size), 0), L.cols-1);
+			int r = MIN(MAX((int)floor((py-minY)/L.size), 0), L.rows-1);
+
+			float tx = dx>0 ? (minX+(c+1)*L.size-ox)/dx : dx<0 ? (minX+c*L.size-ox)/dx : FLT_MAX;
+			float ty = dy>0 ? (minY+(r+1)*L.size-oy)/dy : dy<0 ? (minY+r*L.size-oy)/dy : FLT_MAX;
+			float te = MIN(MIN(tx, ty), t1);
+			float za = oz + dz*t, zb = oz + dz*te;
+			int cell = r*L.cols + c;
+
+			if (MIN(za, zb)>L.maxH[cell]) {
+				//Wholly above this cell, skip it and try coarser cells from here
+				t = te>t ? te : t+eps;
+				if (level<topLevel) level++;
+			} else if (b.anyHit && MAX(za, zb)<L.minH[cell]) {
+				//Wholly below every cell in this block, it hits somewhere in it
+				b.hitT[i] = t; return;
+			} else if (level>0) {
+				level--;
+			} else {
+				float h = L.maxH[cell];
+				if (za<=h) { b.hitT[i] = t; return; }
+				b.hitT[i] = t + (h-za)/dz; return;
+			}
+		}
+	}
+
+	// Narrows [t0, t1] to where o + d*t lies between lo and hi, false if it never does
+	static bool clip(float o, float d, float lo, float hi, float &t0, float &t1) {
+		if (fabs(d)<1e-12f) return o>=lo && o<=hi;
+		float ta = (lo-o)/d, tb = (hi-o)/d;
+		if (ta>tb) { float s = ta; ta = tb; tb = s; }
+		t0 = MAX(t0, ta); t1 = MIN(t1, tb);
+		return t0<=t1;
+	}
+
+	class TraceJob : public ParallelJob {
+	public:
+		TraceJob(HeightFieldRaycaster *_caster, const Batch *_batch, int _chunks) { caster = _caster; batch = _batch; chunks = _chunks; }
+		virtual void run(int index) {
+			int begin, end; caster->pool.getRange(caster->pending.size(), index, chunks, begin, end);
+			for (int p=begin; p<end; p++) caster->traceRay(*batch, caster->pending[p]);
+		}
+	private:
+		HeightFieldRaycaster *caster;
+		const Batch *batch;
+		int chunks;
+	};
+};
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include <osg/Geometry>
+#include <osg/Texture2D>
+#include <osg/TextureRectangle>
+#include <osg/Program>
+#include <osg/Uniform>
+#include "VertexAnimation.h"
+
+// Sprites of the animated spider for the far field, rendered on the CPU at load into one atlas. Each
+// clip is sampled at a few phases and each sample seen from a ring of directions above the spider,
+// so a billboard only has to pick the cell for its clip, phase and the angle it is seen from.
+class ImpostorAtlas {
+public:
+	ImpostorAtlas(VertexAnimation *animation, int _views = 8, int _samples = 8, int _cellSize = 32, float _elevation = 45, float decimation = 1.0f/24) {
+		views = _views; samples = _samples; cellSize = _cellSize;
+		float elevation = osg::DegreesToRadians(_elevation);
+
+		osg::BoundingBox bb = animation->getBound();
+		centre = bb.center(); radius = bb.radius();
+
+		int cells = animation->getClipCount()*samples*views;
+		columns = 1024/cellSize; rows = (cells+columns-1)/columns;
+		image = new osg::Image();
+		image->allocateImage(columns*cellSize, MAX(rows, 1)*cellSize, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+		memset(image->data(), 0, image->getTotalSizeInBytes());
+
+		//The decimated mesh is plenty at sprite size
+		std::vector<unsigned int> triangles = animation->decimate(decimation);
+		osg::Image *diffuse = getDiffuseImage(animation->getStateSet());
+
+		std::vector<osg::Vec3> positions(animation->getVertexCount()), normals(animation->getVertexCount());
+		for (int c=0; c<animation->getClipCount(); c++) {
+			for (int s=0; s<samples; s++) {
+				int frame = animation->getClipStart(c) + s*animation->getClipLength(c)/samples;
+				for (int i=0; i<animation->getVertexCount(); i++) {
+					positions[i] = animation->getPosition(frame, i) - centre;
+					normals[i] = animation->getNormal(frame, i);
+				}
+				for (int v=0; v<views; v++) {
+					float azimuth = 2*osg::PI*v/views;
+					osg::Vec3 toEye(cos(elevation)*cos(azimuth), cos(elevation)*sin(azimuth), sin(elevation));
+					int cell = (c*samples + s)*views + v;
+					renderCell(cell%columns, cell/columns, toEye, positions, normals, triangles, animation, diffuse);
+				}
+			}
+		}
+
+		texture = new osg::TextureRectangle(image.get());
+		texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+		texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+	}
+
+	// A quad from (-1,-1) to (1,1) for the billboards
+	osg::Geometry *createGeometry() {
+		osg::Geometry *geom = new osg::Geometry();
+		geom->setUseDisplayList(false);
+		geom->setUseVertexBufferObjects(true);
+		osg::Vec3Array *corners = new osg::Vec3Array();
+		corners->push_back(osg::Vec3(-1, -1, 0)); corners->push_back(osg::Vec3(1, -1, 0));
+		corners->push_back(osg::Vec3(1, 1, 0)); corners->push_back(osg::Vec3(-1, 1, 0));
+		geom->setVertexArray(corners);
+		geom->addPrimitiveSet(new osg::DrawArrays(GL_QUADS, 0, 4));
+		return geom;
+	}
+
+	// Binds the atlas to unit along with the uniforms impostorSource() needs
+	void apply(osg::StateSet *ss, int unit, float scale) {
+		ss->setTextureAttributeAndModes(unit, texture.get());
+		ss->addUniform(new osg::Uniform("impostorAtlas", unit));
+		ss->addUniform(new osg::Uniform("impostorCentre", centre*scale));
+		ss->addUniform(new osg::Uniform("impostorRadius", radius*scale));
+		ss->addUniform(new osg::Uniform("impostorViews", float(views)));
+		ss->addUniform(new osg::Uniform("impostorSamples", float(samples)));
+		ss->addUniform(new osg::Uniform("impostorColumns", float(columns)));
+		ss->addUniform(new osg::Uniform("impostorCellSize", float(cellSize)));
+	}
+
+	// GLSL declaring impostorPosition(), which places this billboard corner and sets its atlas coordinates
+	// for a spider at position with heading, playing clip at phase (0 to 1 through the clip)
+	static const char *impostorSource() {
+		return
+			"uniform vec3 impostorCentre;\n"
+			"uniform float impostorRadius, impostorViews, impostorSamples, impostorColumns, impostorCellSize;\n"
+			"vec4 impostorPosition(vec3 position, float heading, float clip, float phase) {\n"
+			"	float c = cos(heading), s = sin(heading);\n"
+			"	vec3 centre = position + vec3(c*impostorCentre.x - s*impostorCentre.y, s*impostorCentre.x + c*impostorCentre.y, impostorCentre.z);\n"
+			"	vec3 toEye = (gl_ModelViewMatrixInverse*vec4(0.0, 0.0, 0.0, 1.0)).xyz - centre;\n"
+			"	float view = mod(floor((atan(toEye.y, toEye.x) - heading)/6.2831853*impostorViews + 0.5), impostorViews);\n"
+			"	float cell = (clip*impostorSamples + floor(phase*impostorSamples))*impostorViews + view;\n"
+			"	vec2 origin = vec2(mod(cell, impostorColumns), floor(cell/impostorColumns))*impostorCellSize;\n"
+			"	gl_TexCoord[0].xy = origin + (gl_Vertex.xy*0.5 + 0.5)*impostorCellSize;\n"
+			"	vec4 eye = gl_ModelViewMatrix*vec4(centre, 1.0);\n"
+			"	return gl_ProjectionMatrix*(eye + vec4(gl_Vertex.xy*impostorRadius, 0.0, 0.0));\n"
+			"}\n";
+	}
+
+private:
+	int views, samples, cellSize, columns, rows;
+	osg::Vec3 centre;
+	float radius;
+	osg::ref_ptr<osg::Image> image;
+	osg::ref_ptr<osg::TextureRectangle> texture;
+	std::vector<float> depth;
+
+	static osg::Image *getDiffuseImage(osg::StateSet *ss) {
+		osg::Texture2D *t = ss ? dynamic_cast<osg::Texture2D*>(ss->getTextureAttribute(0, osg::StateAttribute::TEXTURE)) : 0;
+		return t ? t->getImage() : 0;
+	}
+
+	// Orthographic view along toEye of the mesh centred in the cell, z buffered and lit from the eye
+	void renderCell(int cx, int cy, const osg::Vec3 &toEye, const std::vector<osg::Vec3> &positions, const std::vector<osg::Vec3> &normals,
+		const std::vector<unsigned int> &triangles, VertexAnimation *animation, osg::Image *diffuse)
+	{
+		osg::Vec3 right(-toEye.y(), toEye.x(), 0); right.normalize();
+		osg::Vec3 up = toEye ^ right;
+		float half = cellSize*0.5f - 1, toPixels = half/radius;
+
+		depth.assign(cellSize*cellSize, -FLT_MAX);
+		unsigned char *pixels = image->data() + (cy*cellSize*image->s() + cx*cellSize)*4;
+
+		for (int t=0; t+2<triangles.size(); t+=3) {
+			float sx[3], sy[3], sz[3];
+			for (int k=0; k<3; k++) {
+				const osg::Vec3 &p = positions[triangles[t+k]];
+				sx[k] = (p*right)*toPixels + cellSize*0.5f; sy[k] = (p*up)*toPixels + cellSize*0.5f; sz[k] = p*toEye;
+			}
+			float area = (sx[1]-sx[0])*(sy[2]-sy[0]) - (sx[2]-sx[0])*(sy[1]-sy[0]);
+			if (fabs(area)<1e-6f) continue;
+
+			int x0 = MAX(0, (int)floor(MIN(sx[0], MIN(sx[1], sx[2])))), x1 = MIN(cellSize-1, (int)ceil(MAX(sx[0], MAX(sx[1], sx[2]))));
+			int y0 = MAX(0, (int)floor(MIN(sy[0], MIN(sy[1], sy[2])))), y1 = MIN(cellSize-1, (int)ceil(MAX(sy[0], MAX(sy[1], sy[2]))));
+			for (int y=y0; y<=y1; y++) {
+				for (int x=x0; x<=x1; x++) {
+					float px = x+0.5f, py = y+0.5f;
+					float w0 = ((sx[1]-px)*(sy[2]-py) - (sx[2]-px)*(sy[1]-py))/area;
+					float w1 = ((sx[2]-px)*(sy[0]-py) - (sx[0]-px)*(sy[2]-py))/area;
+					float w2 = 1-w0-w1;
+					if (w0<0 || w1<0 || w2<0) continue;
+
+					float z = w0*sz[0] + w1*sz[1] + w2*sz[2];
+					if (z<=depth[y*cellSize+x]) continue;
+					depth[y*cellSize+x] = z;
+
+					osg::Vec3 n = normals[triangles[t]]*w0 + normals[triangles[t+1]]*w1 + normals[triangles[t+2]]*w2; n.normalize();
+					float light = 0.3f + 0.7f*MAX(n*toEye, 0.0f);
+					osg::Vec4 colour(0.5f, 0.5f, 0.5f, 1.0f);
+					if (diffuse && diffuse->data()) {
+						osg::Vec2 uv = animation->getTexCoord(triangles[t])*w0 + animation->getTexCoord(triangles[t+1])*w1 + animation->getTexCoord(triangles[t+2])*w2;
+						colour = diffuse->getColor(osg::Vec2(uv.x()-floor(uv.x()), uv.y()-floor(uv.y())));
+					}
+
+					unsigned char *out = pixels + (y*image->s() + x)*4;
+					out[0] = (unsigned char)(MIN(colour.r()*light, 1.0f)*255); out[1] = (unsigned char)(MIN(colour.g()*light, 1.0f)*255);
+					out[2] = (unsigned char)(MIN(colour.b()*light, 1.0f)*255); out[3] = 255;
+				}
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <osg/Timer>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include "Profiler.h"
+
+// Follows the hand from the Kinect frame it was seen in to the first frame swapped with the spider
+// reacting to it. The spider reports when it first walks towards a target taken from a Kinect frame,
+// and the render thread reports each swap, the spans are recorded as profiler stages:
+//   latency.hand_to_update  Kinect frame to the update traversal the spider reacted in
+//   latency.hand_to_swap    Kinect frame to the swap of the frame showing the reaction
+//   latency.step_response   an injected step of the hand to the swap of the first frame reacting to it
+class LatencyProbe {
+public:
+	LatencyProbe() {
+		handToUpdate = profiler().stage("latency.hand_to_update");
+		handToSwap = profiler().stage("latency.hand_to_swap");
+		stepResponse = profiler().stage("latency.step_response");
+		pendingReaction = 0; injected = 0; stepPending = false; stepCount = 0;
+	}
+
+	// The hand jumped in the Kinect frame at t, the first reaction to a target from that frame or later is timed
+	void injectStep(osg::Timer_t t) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		injected = t; stepPending = false;
+	}
+
+	// From the update traversal, the spider first walked towards a target seen at stamp
+	void reacted(osg::Timer_t stamp) {
+		if (!profiler().isEnabled() || stamp==0) return;
+		profiler().recordSince(handToUpdate, stamp);
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		if (stamp>pendingReaction) pendingReaction = stamp;
+		if (injected && stamp>=injected) stepPending = true;
+	}
+
+	// From the render thread, once the frame is swapped
+	void frameSwapped(osg::Timer_t swap) {
+		if (!profiler().isEnabled()) return;
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		if (pendingReaction) { profiler().record(handToSwap, pendingReaction, swap); pendingReaction = 0; }
+		if (stepPending) { profiler().record(stepResponse, injected, swap); injected = 0; stepPending = false; stepCount++; }
+	}
+
+	// Steps that have been reacted to so far
+	int getStepCount() {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		return stepCount;
+	}
+
+private:
+	int handToUpdate, handToSwap, stepResponse;
+	osg::Timer_t pendingReaction, injected;
+	bool stepPending;
+	int stepCount;
+	OpenThreads::Mutex mutex;
+};
+
+inline LatencyProbe &latencyProbe() {
+	static LatencyProbe probe;
+	return probe;
+}
+
+#endif
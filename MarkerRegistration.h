@@ -0,0 +1,188 @@
+#ifndef MARKERREGISTRATION_H
+#define MARKERREGISTRATION_H
+
+#include <cv.h>
+#include <string>
+#include <vector>
+
+#include "OpiraLibrary.h"
+
+// A stage of the marker registration pipeline. Stages can wrap each other (tracking, pyramids,
+// caching) and the innermost stage is normally an OPIRA Registration object.
+class MarkerRegistration {
+public:
+	virtual ~MarkerRegistration() {}
+
+	virtual std::vector<MarkerTransform> performRegistration(IplImage *frame_input, CvMat *captureParams, CvMat *captureDistortion) = 0;
+
+	virtual void addResizedMarker(std::string markerName, int maxLengthSize) = 0;
+	virtual void addResizedScaledMarker(std::string markerName, int maxLengthSize, int maxLengthScale) = 0;
+	virtual void removeMarker(std::string markerName) = 0;
+};
+
+// Adapts an OPIRA Registration object to the MarkerRegistration interface
+class OPIRARegistration : public MarkerRegistration {
+public:
+	OPIRARegistration(Registration *_reg) { reg = _reg; }
+	~OPIRARegistration() { delete reg; }
+
+	std::vector<MarkerTransform> performRegistration(IplImage *frame_input, CvMat *captureParams, CvMat *captureDistortion) {
+		return reg->performRegistration(frame_input, captureParams, captureDistortion);
+	}
+
+	void addResizedMarker(std::string markerName, int maxLengthSize) { reg->addResizedMarker(markerName, maxLengthSize); }
+	void addResizedScaledMarker(std::string markerName, int maxLengthSize, int maxLengthScale) { reg->addResizedScaledMarker(markerName, maxLengthSize, maxLengthScale); }
+	void removeMarker(std::string markerName) { reg->removeMarker(markerName); }
+
+private:
+	Registration *reg;
+};
+
+// Gives each marker name a small integer handle, shared by the registration stages and the
+// renderer, so per frame bookkeeping can index arrays rather than compare strings. Names are found
+// through an open addressed hash table.
+class MarkerHandleTable {
+public:
+	MarkerHandleTable() { slots.resize(64, -1); }
+
+	// The handle for markerName, creating one if the name is new
+	int get(const std::string &markerName) {
+		int slot = findSlot(markerName);
+		if (slots[slot]>=0) return slots[slot];
+
+		int handle = names.size();
+		names.push_back(markerName); slots[slot] = handle;
+		if (names.size()*2>slots.size()) rehash();
+		return handle;
+	}
+
+	// The handle for markerName, or -1 if it has never been registered
+	int find(const std::string &markerName) const {
+		return slots[findSlot(markerName)];
+	}
+
+	const std::string &getName(int handle) const { return names.at(handle); }
+	int size() const { return names.size(); }
+
+private:
+	std::vector<std::string> names;
+	std::vector<int> slots;
+
+	static unsigned int hash(const std::string &s) {
+		unsigned int h = 2166136261u;
+		for (int i=0; i<s.size(); i++) { h ^= (unsigned char)s[i]; h *= 16777619u; }
+		return h;
+	}
+
+	int findSlot(const std::string &markerName) const {
+		int mask = slots.size()-1, slot = hash(markerName) & mask;
+		while (slots[slot]>=0 && names[slots[slot]]!=markerName) slot = (slot+1) & mask;
+		return slot;
+	}
+
+	void rehash() {
+		slots.assign(slots.size()*2, -1);
+		for (int i=0; i<names.size(); i++) slots[findSlot(names[i])] = i;
+	}
+};
+
+inline MarkerHandleTable &markerHandles() {
+	static MarkerHandleTable table;
+	return table;
+}
+
+// Deep copy a MarkerTransform so the copy can be clear()ed independently of the original
+inline MarkerTransform copyMarkerTransform(const MarkerTransform &src) {
+	MarkerTransform mt = src;
+	mt.homography = cvCloneMat(src.homography);
+	mt.transMat = (double *)malloc(16*sizeof(double));
+	memcpy(mt.transMat, src.transMat, 16*sizeof(double));
+	return mt;
+}
+
+// Create a MarkerTransform for stages that perform their own registration
+inline MarkerTransform makeMarkerTransform(std::string markerName, CvSize markerSize, CvMat *homography, double *transMat) {
+	MarkerTransform mt = MarkerTransform();
+	mt.marker.name = markerName; mt.marker.size = markerSize;
+	mt.homography = cvCreateMat(3,3,CV_64FC1); cvConvert(homography, mt.homography);
+	mt.transMat = (double *)malloc(16*sizeof(double));
+	memcpy(mt.transMat, transMat, 16*sizeof(double));
+	return mt;
+}
+
+inline void clearMarkerTransforms(std::vector<MarkerTransform> &mt) {
+	for (int i=0; i<mt.size(); i++) {mt.at(i).clear();} mt.clear();
+}
+
+// Project the four marker corners into the image with the homography
+inline void getMarkerCorners(CvSize markerSize, CvMat *homography, CvPoint2D32f *corners) {
+	corners[0] = cvPoint2D32f(0,0); corners[1] = cvPoint2D32f(markerSize.width,0);
+	corners[2] = cvPoint2D32f(markerSize.width,markerSize.height); corners[3] = cvPoint2D32f(0,markerSize.height);
+
+	CvMat mCorners = cvMat(4,1,CV_32FC2, corners);
+	cvPerspectiveTransform(&mCorners, &mCorners, homography);
+}
+
+// Calculate the OpenGL style (column major) marker transform from a homography. The marker is
+// centred on the origin and measured in marker pixels multiplied by scale, which matches the
+// transMat produced by OPIRA once scale has been recovered with calcMarkerScale.
+inline bool calcTransMat(CvSize markerSize, CvMat *homography, float scale, CvMat *captureParams, CvMat *captureDistortion, double *transMat) {
+	CvPoint2D32f imageCorners[4]; getMarkerCorners(markerSize, homography, imageCorners);
+
+	float hw = markerSize.width*0.5f, hh = markerSize.height*0.5f;
+	CvPoint3D32f objectCorners[4];
+	objectCorners[0] = cvPoint3D32f(-hw*scale, -hh*scale, 0); objectCorners[1] = cvPoint3D32f(hw*scale, -hh*scale, 0);
+	objectCorners[2] = cvPoint3D32f(hw*scale, hh*scale, 0); objectCorners[3] = cvPoint3D32f(-hw*scale, hh*scale, 0);
+
+	CvMat mObject = cvMat(4,1,CV_32FC3, objectCorners);
+	CvMat mImage = cvMat(4,1,CV_32FC2, imageCorners);
+
+	double _r[3], _t[3], _R[9];
+	CvMat mR = cvMat(3,1,CV_64FC1, _r), mT = cvMat(3,1,CV_64FC1, _t), mRot = cvMat(3,3,CV_64FC1, _R);
+	cvFindExtrinsicCameraParams2(&mObject, &mImage, captureParams, captureDistortion, &mR, &mT);
+	cvRodrigues2(&mR, &mRot);
+
+	transMat[0] = _R[0]; transMat[1] = _R[3]; transMat[2] = _R[6]; transMat[3] = 0;
+	transMat[4] = _R[1]; transMat[5] = _R[4]; transMat[6] = _R[7]; transMat[7] = 0;
+	transMat[8] = _R[2]; transMat[9] = _R[5]; transMat[10] = _R[8]; transMat[11] = 0;
+	transMat[12] = _t[0]; transMat[13] = _t[1]; transMat[14] = _t[2]; transMat[15] = 1;
+
+	return _t[2]>0;
+}
+
+// Recover the scale OPIRA applied to a marker by comparing its transform against an unscaled one
+inline float calcMarkerScale(const MarkerTransform &mt, CvMat *captureParams, CvMat *captureDistortion) {
+	double unscaled[16];
+	if (!calcTransMat(mt.marker.size, mt.homography, 1, captureParams, captureDistortion, unscaled)) return 1;
+
+	double lenUnscaled = sqrt(unscaled[12]*unscaled[12] + unscaled[13]*unscaled[13] + unscaled[14]*unscaled[14]);
+	double lenScaled = sqrt(mt.transMat[12]*mt.transMat[12] + mt.transMat[13]*mt.transMat[13] + mt.transMat[14]*mt.transMat[14]);
+	return lenUnscaled>0 ? lenScaled/lenUnscaled : 1;
+}
+
+// Fit a homography to matched marker and frame points with RANSAC and calculate the marker pose,
+// returning false if there aren't enough inliers or the marker is degenerate
+inline bool estimateMarkerTransform(std::vector<CvPoint2D32f> &markerPts, std::vector<CvPoint2D32f> &framePts, std::string markerName, CvSize markerSize, float scale,
+	CvMat *captureParams, CvMat *captureDistortion, int minInliers, MarkerTransform &mt) {
+	if (framePts.size()<minInliers) return false;
+
+	double _H[9]; CvMat H = cvMat(3,3,CV_64FC1,_H);
+	CvMat mMarker = cvMat(markerPts.size(),1,CV_32FC2,&markerPts[0]), mFrame = cvMat(framePts.size(),1,CV_32FC2,&framePts[0]);
+	std::vector<unsigned char> inliers(framePts.size());
+	CvMat mInliers = cvMat(1,inliers.size(),CV_8UC1,&inliers[0]);
+	if (!cvFindHomography(&mMarker, &mFrame, &H, CV_RANSAC, 3, &mInliers)) return false;
+
+	int inlierCount = 0; for (int i=0; i<inliers.size(); i++) if (inliers[i]) inlierCount++;
+	if (inlierCount<minInliers) return false;
+
+	CvPoint2D32f corners[4]; getMarkerCorners(markerSize, &H, corners);
+	CvMat mCorners = cvMat(4,1,CV_32FC2,corners);
+	if (!cvCheckContourConvexity(&mCorners)) return false;
+
+	double transMat[16];
+	if (!calcTransMat(markerSize, &H, scale, captureParams, captureDistortion, transMat)) return false;
+	mt = makeMarkerTransform(markerName, markerSize, &H, transMat);
+	return true;
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef MARKERTRACKER_H
+#define MARKERTRACKER_H
+
+#include <cv.h>
+#include <vector>
+
+#include "MarkerRegistration.h"
+
+// Follows markers from frame to frame with pyramidal KLT optical flow once they have been found
+// by the wrapped registration stage. Full registration is only performed when no marker is being
+// tracked, a track is lost, or every refreshInterval frames.
+class MarkerTracker : public MarkerRegistration {
+public:
+	MarkerTracker(MarkerRegistration *_reg, int _refreshInterval = 30) {
+		reg = _reg; refreshInterval = _refreshInterval;
+		grey = 0; prevGrey = 0; eig = 0; temp = 0; mask = 0;
+		framesSinceDetection = 0;
+		maxFeatures = 100; minInliers = 12; winSize = 15; pyrLevels = 3;
+	}
+
+	~MarkerTracker() {
+		clearTracks();
+		releaseImages();
+		delete reg;
+	}
+
+	std::vector<MarkerTransform> performRegistration(IplImage *frame_input, CvMat *captureParams, CvMat *captureDistortion) {
+		if (grey==0 || grey->width!=frame_input->width || grey->height!=frame_input->height) {
+			releaseImages(); clearTracks();
+			grey = cvCreateImage(cvGetSize(frame_input), IPL_DEPTH_8U, 1); prevGrey = cvCreateImage(cvGetSize(frame_input), IPL_DEPTH_8U, 1);
+			eig = cvCreateImage(cvGetSize(frame_input), IPL_DEPTH_32F, 1); temp = cvCreateImage(cvGetSize(frame_input), IPL_DEPTH_32F, 1);
+			mask = cvCreateImage(cvGetSize(frame_input), IPL_DEPTH_8U, 1);
+		}
+		if (frame_input->nChannels==1) cvCopy(frame_input, grey); else cvCvtColor(frame_input, grey, CV_BGR2GRAY);
+
+		//Track the existing markers, falling back to full registration if any are lost
+		bool detect = tracks.empty() || framesSinceDetection >= refreshInterval;
+		for (int i=0; i<tracks.size() && !detect; i++) {
+			if (!trackMarker(tracks.at(i), captureParams, captureDistortion)) detect = true;
+		}
+
+		if (detect) {
+			std::vector<MarkerTransform> mt = reg->performRegistration(frame_input, captureParams, captureDistortion);
+			clearTracks();
+			for (int i=0; i<mt.size(); i++) {
+				Track t; t.mt = copyMarkerTransform(mt.at(i));
+				t.scale = calcMarkerScale(mt.at(i), captureParams, captureDistortion);
+				initTrack(t);
+				tracks.push_back(t);
+			}
+			clearMarkerTransforms(mt);
+			framesSinceDetection = 0;
+		} else {
+			framesSinceDetection++;
+		}
+
+		IplImage *tmp = prevGrey; prevGrey = grey; grey = tmp;
+
+		std::vector<MarkerTransform> retVal;
+		for (int i=0; i<tracks.size(); i++) retVal.push_back(copyMarkerTransform(tracks.at(i).mt));
+		return retVal;
+	}
+
+	void addResizedMarker(std::string markerName, int maxLengthSize) {
+		clearTracks(); reg->addResizedMarker(markerName, maxLengthSize);
+	}
+
+	void addResizedScaledMarker(std::string markerName, int maxLengthSize, int maxLengthScale) {
+		clearTracks(); reg->addResizedScaledMarker(markerName, maxLengthSize, maxLengthScale);
+	}
+
+	void removeMarker(std::string markerName) {
+		clearTracks(); reg->removeMarker(markerName);
+	}
+
+	void setRefreshInterval(int frames) { refreshInterval = frames; }
+	bool isTracking() { return !tracks.empty(); }
+
+private:
+	struct Track {
+		MarkerTransform mt;
+		float scale;
+		std::vector<CvPoint2D32f> markerPoints; // Feature positions on the marker image
+		std::vector<CvPoint2D32f> framePoints;  // Feature positions in the previous frame
+		CvPoint2D32f velocity;                  // Average feature motion over the last frame
+		int initialPoints;
+	};
+
+	MarkerRegistration *reg;
+	std::vector<Track> tracks;
+
+	IplImage *grey, *prevGrey, *eig, *temp, *mask;
+	int framesSinceDetection, refreshInterval;
+	int maxFeatures, minInliers, winSize, pyrLevels;
+
+	void releaseImages() {
+		if (grey) cvReleaseImage(&grey); if (prevGrey) cvReleaseImage(&prevGrey);
+		if (eig) cvReleaseImage(&eig); if (temp) cvReleaseImage(&temp);
+		if (mask) cvReleaseImage(&mask);
+	}
+
+	void clearTracks() {
+		for (int i=0; i<tracks.size(); i++) tracks.at(i).mt.clear();
+		tracks.clear();
+	}
+
+	// Find good features inside the marker and remember where they lie on the marker image
+	void initTrack(Track &t) {
+		CvPoint2D32f corners[4]; getMarkerCorners(t.mt.marker.size, t.mt.homography, corners);
+		CvPoint iCorners[4]; for (int i=0; i<4; i++) iCorners[i] = cvPointFrom32f(corners[i]);
+		cvZero(mask); cvFillConvexPoly(mask, iCorners, 4, cvScalarAll(255));
+
+		std::vector<CvPoint2D32f> points(maxFeatures); int count = maxFeatures;
+		cvGoodFeaturesToTrack(grey, eig, temp, &points[0], &count, 0.01, 8, mask);
+		points.resize(count);
+		if (count>0) cvFindCornerSubPix(grey, &points[0], count, cvSize(5,5), cvSize(-1,-1), cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 10, 0.03));
+
+		//The corners are tracked along with the features
+		for (int i=0; i<4; i++) points.push_back(corners[i]);
+
+		double _invH[9]; CvMat invH = cvMat(3,3,CV_64FC1,_invH);
+		cvInvert(t.mt.homography, &invH);
+		std::vector<CvPoint2D32f> markerPoints(points.size());
+		CvMat mFrame = cvMat(points.size(),1,CV_32FC2,&points[0]), mMarker = cvMat(points.size(),1,CV_32FC2,&markerPoints[0]);
+		cvPerspectiveTransform(&mFrame, &mMarker, &invH);
+
+		t.markerPoints.clear(); t.framePoints.clear();
+		for (int i=0; i<points.size(); i++) {
+			if (markerPoints[i].x>=-1 && markerPoints[i].y>=-1 && markerPoints[i].x<=t.mt.marker.size.width+1 && markerPoints[i].y<=t.mt.marker.size.height+1) {
+				t.markerPoints.push_back(markerPoints[i]); t.framePoints.push_back(points[i]);
+			}
+		}
+		t.velocity = cvPoint2D32f(0,0);
+		t.initialPoints = t.framePoints.size();
+	}
+
+	bool trackMarker(Track &t, CvMat *captureParams, CvMat *captureDistortion) {
+		int count = t.framePoints.size();
+		if (count<minInliers) return false;
+
+		//Predict the feature positions with constant velocity and find the region both sets lie in
+		std::vector<CvPoint2D32f> predicted(count);
+		float minX=grey->width, minY=grey->height, maxX=0, maxY=0;
+		for (int i=0; i<count; i++) {
+			predicted[i] = cvPoint2D32f(t.framePoints[i].x+t.velocity.x, t.framePoints[i].y+t.velocity.y);
+			minX = MIN(minX, MIN(t.framePoints[i].x, predicted[i].x)); maxX = MAX(maxX, MAX(t.framePoints[i].x, predicted[i].x));
+			minY = MIN(minY, MIN(t.framePoints[i].y, predicted[i].y)); maxY = MAX(maxY, MAX(t.framePoints[i].y, predicted[i].y));
+		}
+		int margin = winSize<<pyrLevels;
+		CvRect roi = cvRect(MAX(0, int(minX)-margin), MAX(0, int(minY)-margin), 0, 0);
+		roi.width = MIN(grey->width, int(maxX)+margin) - roi.x; roi.height = MIN(grey->height, int(maxY)+margin) - roi.y;
+		if (roi.width<=winSize || roi.height<=winSize) return false;
+
+		//Track the features inside the region of interest
+		std::vector<CvPoint2D32f> prevPts(count), currPts(count);
+		for (int i=0; i<count; i++) {
+			prevPts[i] = cvPoint2D32f(t.framePoints[i].x-roi.x, t.framePoints[i].y-roi.y);
+			currPts[i] = cvPoint2D32f(predicted[i].x-roi.x, predicted[i].y-roi.y);
+		}
+		std::vector<char> status(count);
+		cvSetImageROI(prevGrey, roi); cvSetImageROI(grey, roi);
+		cvCalcOpticalFlowPyrLK(prevGrey, grey, 0, 0, &prevPts[0], &currPts[0], count, cvSize(winSize,winSize), pyrLevels, &status[0], 0,
+			cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03), CV_LKFLOW_INITIAL_GUESSES);
+		cvResetImageROI(prevGrey); cvResetImageROI(grey);
+
+		std::vector<CvPoint2D32f> markerPts, framePts, oldPts;
+		for (int i=0; i<count; i++) {
+			if (!status[i]) continue;
+			markerPts.push_back(t.markerPoints[i]);
+			framePts.push_back(cvPoint2D32f(currPts[i].x+roi.x, currPts[i].y+roi.y));
+			oldPts.push_back(t.framePoints[i]);
+		}
+		if (framePts.size()<minInliers) return false;
+
+		//Re-estimate the homography from the marker to the tracked features
+		double _H[9]; CvMat H = cvMat(3,3,CV_64FC1,_H);
+		CvMat mMarker = cvMat(markerPts.size(),1,CV_32FC2,&markerPts[0]), mFrame = cvMat(framePts.size(),1,CV_32FC2,&framePts[0]);
+		std::vector<unsigned char> inliers(framePts.size());
+		CvMat mInliers = cvMat(1,inliers.size(),CV_8UC1,&inliers[0]);
+		if (!cvFindHomography(&mMarker, &mFrame, &H, CV_RANSAC, 3, &mInliers)) return false;
+
+		t.markerPoints.clear(); t.framePoints.clear();
+		float vx=0, vy=0;
+		for (int i=0; i<inliers.size(); i++) {
+			if (!inliers[i]) continue;
+			t.markerPoints.push_back(markerPts[i]); t.framePoints.push_back(framePts[i]);
+			vx += framePts[i].x-oldPts[i].x; vy += framePts[i].y-oldPts[i].y;
+		}
+		if (t.framePoints.size()<minInliers) return false;
+		t.velocity = cvPoint2D32f(vx/t.framePoints.size(), vy/t.framePoints.size());
+
+		//The track is lost if the marker has collapsed or left the frame
+		CvPoint2D32f corners[4]; getMarkerCorners(t.mt.marker.size, &H, corners);
+		CvMat mCorners = cvMat(4,1,CV_32FC2,corners);
+		if (!cvCheckContourConvexity(&mCorners)) return false;
+		bool onScreen = false;
+		for (int i=0; i<4; i++) if (corners[i].x>=0 && corners[i].y>=0 && corners[i].x<grey->width && corners[i].y<grey->height) onScreen = true;
+		if (!onScreen) return false;
+
+		double transMat[16];
+		if (!calcTransMat(t.mt.marker.size, &H, t.scale, captureParams, captureDistortion, transMat)) return false;
+		cvConvert(&H, t.mt.homography); memcpy(t.mt.transMat, transMat, 16*sizeof(double));
+
+		//Refresh early once too many features have been dropped
+		if (t.framePoints.size() < t.initialPoints/2) framesSinceDetection = refreshInterval;
+
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef OCCUPANCYGRID_H
+#define OCCUPANCYGRID_H
+
+#include <cv.h>
+#include <math.h>
+#include <vector>
+
+// Which cells of the marker plane the spider can walk on, from Kinect points transformed to marker
+// space. A cell is blocked once at least minPoints of a frame's points in it are more than
+// obstacleHeight off the table, and free again once a frame sees it with none. Points near the hand are
+// the hand and arm, not obstacles, and are left out. Cells are in the spider's frame, which has y
+// negated from the Kinect's marker space.
+class OccupancyGrid {
+public:
+	OccupancyGrid(float _minX, float _minY, float _maxX, float _maxY, float _cellSize, float _obstacleHeight = 20, int _minPoints = 2) {
+		minX = _minX; minY = _minY; cellSize = _cellSize; obstacleHeight = _obstacleHeight; minPoints = _minPoints;
+		cols = MAX(1, (int)ceil((_maxX-minX)/cellSize)); rows = MAX(1, (int)ceil((_maxY-minY)/cellSize));
+		blocked.assign(cols*rows, 0);
+		high.assign(cols*rows, 0); seen.assign(cols*rows, 0);
+		hasHand = false; handX = handY = handRadius = 0;
+	}
+
+	// Where the hand is in the spider's frame, points within radius of it are ignored by the next updates
+	void setHand(float x, float y, float radius = 100) { handX = x; handY = y; handRadius = radius; hasHand = true; }
+	void clearHand() { hasHand = false; }
+
+	int getCols() { return cols; }
+	int getRows() { return rows; }
+	int getCellCount() { return cols*rows; }
+	float getCellSize() { return cellSize; }
+
+	bool isBlocked(int cell) { return blocked[cell]!=0; }
+	bool isBlocked(int c, int r) { return c<0 || r<0 || c>=cols || r>=rows || blocked[r*cols+c]!=0; }
+
+	// The cell containing a point of the spider's frame, or -1 outside the grid
+	int cellAt(float x, float y) {
+		int c = (int)floor((x-minX)/cellSize), r = (int)floor((y-minY)/cellSize);
+		if (c<0 || r<0 || c>=cols || r>=rows) return -1;
+		return r*cols + c;
+	}
+
+	// Centre of a cell in the spider's frame
+	void cellCentre(int cell, float &x, float &y) {
+		x = minX + (cell%cols + 0.5f)*cellSize; y = minY + (cell/cols + 0.5f)*cellSize;
+	}
+
+	// Rebuilds the grid from count points in the Kinect's marker space, returns the cells that changed
+	const std::vector<int> &update(const CvPoint3D32f *points, int count) {
+		std::fill(high.begin(), high.end(), 0); std::fill(seen.begin(), seen.end(), 0);
+		float r2 = handRadius*handRadius;
+		for (int i=0; i<count; i++) {
+			int cell = cellAt(points[i].x, -points[i].y);
+			if (cell<0) continue;
+			if (hasHand) {
+				float dx = points[i].x-handX, dy = -points[i].y-handY;
+				if (dx*dx+dy*dy<r2) continue;
+			}
+			seen[cell] = 1;
+			if (fabs(points[i].z)>obstacleHeight) high[cell]++;
+		}
+
+		//Cells not seen this frame keep their state, an object may be hiding them from the Kinect
+		changed.clear();
+		for (int i=0; i<cols*rows; i++) {
+			unsigned char b = blocked[i];
+			if (high[i]>=minPoints) b = 1; else if (seen[i] && high[i]==0) b = 0;
+			if (b!=blocked[i]) { blocked[i] = b; changed.push_back(i); }
+		}
+		return changed;
+	}
+
+private:
+	float minX, minY, cellSize, obstacleHeight;
+	int cols, rows, minPoints;
+	bool hasHand;
+	float handX, handY, handRadius;
+	std::vector<unsigned char> blocked, seen;
+	std::vector<int> high, changed;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef XNCPPWRAPPER_H
+#define XNCPPWRAPPER_H
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "XnOS.h"
+
+// Stand in for the parts of OpenNI used by KinectAR, so it can run without a Kinect or the OpenNI
+// libraries. Every context produces the same synthetic frames, a depth of a tilted table with a box
+// standing on it and holes where the sensor would see nothing, and a colour gradient, at the
+// resolution set by xnStubSetResolution before the context is initialised. Each WaitAnyUpdateAll
+// restores the frame, so a generator's buffers can be written to as the real ones can. Recordings
+// open as the same synthetic frames.
+
+typedef struct XnPoint3D { XnFloat X, Y, Z; } XnPoint3D;
+typedef struct XnFieldOfView { XnDouble fHFOV, fVFOV; } XnFieldOfView;
+
+enum XnProductionNodeType { XN_NODE_TYPE_DEPTH = 2, XN_NODE_TYPE_IMAGE = 3, XN_NODE_TYPE_PLAYER = 11 };
+
+inline const XnChar *xnGetStatusString(XnStatus status) { return status==XN_STATUS_OK ? "OK" : "OpenNI stub error"; }
+
+inline int &xnStubWidth() { static int width = 640; return width; }
+inline int &xnStubHeight() { static int height = 480; return height; }
+
+inline void xnStubSetResolution(int width, int height) { xnStubWidth() = width; xnStubHeight() = height; }
+
+namespace xn {
+
+class EnumerationErrors {
+public:
+	XnStatus ToString(XnChar *buffer, XnUInt32 size) { if (size>0) buffer[0] = 0; return XN_STATUS_OK; }
+};
+
+// The synthetic frame shared by a context's generators
+struct StubFrame {
+	int width, height;
+	XnUInt64 timestamp;
+	std::vector<XnDepthPixel> depth, depthSource;
+	std::vector<XnUInt8> image;
+
+	void create(int _width, int _height) {
+		width = _width; height = _height; timestamp = 0;
+		depthSource.resize(width*height); image.resize(width*height*3);
+		for (int y=0; y<height; y++) {
+			for (int x=0; x<width; x++) {
+				float u = float(x)/width, v = float(y)/height;
+				//The table recedes towards the top of the image
+				float z = 700 + 600*(1-v);
+				if (u>0.55f && u<0.7f && v>0.45f && v<0.65f) z -= 120;
+				//Holes along the box's edges and in a patch of glare, as the Kinect leaves them
+				bool hole = (fabs(u-0.55f)<0.01f && v>0.45f && v<0.65f) || ((u-0.25f)*(u-0.25f) + (v-0.3f)*(v-0.3f) < 0.002f);
+				depthSource[y*width+x] = hole ? 0 : XnDepthPixel(z);
+				XnUInt8 *rgb = &image[(y*width+x)*3];
+				rgb[0] = XnUInt8(255*u); rgb[1] = XnUInt8(255*v); rgb[2] = XnUInt8((x^y)&0xff);
+			}
+		}
+		depth = depthSource;
+	}
+
+	void next() { depth = depthSource; timestamp += 33333; }
+};
+
+class DepthMetaData {
+public:
+	DepthMetaData() { frame = 0; }
+	XnUInt32 XRes() const { return frame->width; }
+	XnUInt32 YRes() const { return frame->height; }
+	XnUInt64 Timestamp() const { return frame->timestamp; }
+	const XnDepthPixel *Data() const { return &frame->depth[0]; }
+	XnDepthPixel *WritableData() { return &frame->depth[0]; }
+	const XnDepthPixel &operator[](XnUInt32 index) const { return frame->depth[index]; }
+	StubFrame *frame;
+};
+
+class ImageMetaData {
+public:
+	ImageMetaData() { frame = 0; }
+	XnUInt32 XRes() const { return frame->width; }
+	XnUInt32 YRes() const { return frame->height; }
+	XnUInt64 Timestamp() const { return frame->timestamp; }
+	const XnUInt8 *Data() const { return &frame->image[0]; }
+	StubFrame *frame;
+};
+
+class ImageGenerator;
+
+class MirrorCapability {
+public:
+	XnStatus SetMirror(bool mirror) { return XN_STATUS_OK; }
+};
+
+class AlternativeViewPointCapability {
+public:
+	XnStatus SetViewPoint(ImageGenerator &other) { return XN_STATUS_OK; }
+};
+
+class ImageGenerator {
+public:
+	ImageGenerator() { frame = 0; }
+	MirrorCapability GetMirrorCap() { return MirrorCapability(); }
+	void GetMetaData(ImageMetaData &md) { md.frame = frame; }
+	StubFrame *frame;
+};
+
+// The Kinect's field of view, converting as OpenNI does
+class DepthGenerator {
+public:
+	DepthGenerator() { frame = 0; }
+	MirrorCapability GetMirrorCap() { return MirrorCapability(); }
+	AlternativeViewPointCapability GetAlternativeViewPointCap() { return AlternativeViewPointCapability(); }
+	void GetMetaData(DepthMetaData &md) { md.frame = frame; }
+
+	XnStatus GetFieldOfView(XnFieldOfView &fov) { fov.fHFOV = 1.0144686; fov.fVFOV = 0.7898090; return XN_STATUS_OK; }
+
+	XnStatus ConvertProjectiveToRealWorld(XnUInt32 count, const XnPoint3D *projective, XnPoint3D *realWorld) {
+		float xz = float(tan(1.0144686/2)*2), yz = float(tan(0.7898090/2)*2);
+		for (XnUInt32 i=0; i<count; i++) {
+			float z = projective[i].Z;
+			realWorld[i].X = (projective[i].X/frame->width - 0.5f)*z*xz;
+			realWorld[i].Y = (0.5f - projective[i].Y/frame->height)*z*yz;
+			realWorld[i].Z = z;
+		}
+		return XN_STATUS_OK;
+	}
+
+	XnStatus ConvertRealWorldToProjective(XnUInt32 count, const XnPoint3D *realWorld, XnPoint3D *projective) {
+		float xz = float(tan(1.0144686/2)*2), yz = float(tan(0.7898090/2)*2);
+		for (XnUInt32 i=0; i<count; i++) {
+			float z = realWorld[i].Z;
+			projective[i].X = z>0 ? (realWorld[i].X/(z*xz) + 0.5f)*frame->width : 0;
+			projective[i].Y = z>0 ? (0.5f - realWorld[i].Y/(z*yz))*frame->height : 0;
+			projective[i].Z = z;
+		}
+		return XN_STATUS_OK;
+	}
+
+	StubFrame *frame;
+};
+
+class Player {
+public:
+	XnStatus SetPlaybackSpeed(XnDouble speed) { return XN_STATUS_OK; }
+	XnStatus SetRepeat(bool repeat) { return XN_STATUS_OK; }
+};
+
+class Context {
+public:
+	XnStatus Init() { return XN_STATUS_OK; }
+
+	XnStatus OpenFileRecording(const XnChar *file) {
+		frame.create(xnStubWidth(), xnStubHeight());
+		return XN_STATUS_OK;
+	}
+
+	XnStatus InitFromXmlFile(const XnChar *file, EnumerationErrors *errors = 0) {
+		frame.create(xnStubWidth(), xnStubHeight());
+		return XN_STATUS_OK;
+	}
+
+	XnStatus FindExistingNode(XnProductionNodeType type, DepthGenerator &node) { node.frame = &frame; return XN_STATUS_OK; }
+	XnStatus FindExistingNode(XnProductionNodeType type, ImageGenerator &node) { node.frame = &frame; return XN_STATUS_OK; }
+	XnStatus FindExistingNode(XnProductionNodeType type, Player &node) { return XN_STATUS_OK; }
+
+	XnStatus WaitAnyUpdateAll() { frame.next(); return XN_STATUS_OK; }
+
+private:
+	StubFrame frame;
+};
+
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef XNOS_H
+#define XNOS_H
+
+// Stand in for OpenNI's XnOS.h, see XnCppWrapper.h
+
+typedef char XnChar;
+typedef unsigned int XnStatus;
+typedef unsigned int XnUInt32;
+typedef unsigned long long XnUInt64;
+typedef float XnFloat;
+typedef double XnDouble;
+typedef unsigned short XnDepthPixel;
+typedef unsigned char XnUInt8;
+
+#define XN_STATUS_OK 0
+#define XN_STATUS_NO_NODE_PRESENT 1
+
+#define XN_PLAYBACK_SPEED_FASTEST 0.0
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef PATHPLANNER_H
+#define PATHPLANNER_H
+
+#include <float.h>
+#include <math.h>
+#include <vector>
+
+#include <osg/Timer>
+#include <osg/Vec2>
+#include "OccupancyGrid.h"
+
+// D* Lite over an OccupancyGrid, 8-connected without cutting the corners of blocked cells. It searches
+// from the goal towards the start, so when the start moves or a few cells change only the affected part
+// of the previous search is repaired. A new goal cell starts a fresh search.
+class PathPlanner {
+public:
+	PathPlanner(OccupancyGrid *_grid) {
+		grid = _grid;
+		int n = grid->getCellCount();
+		g.assign(n, FLT_MAX); rhs.assign(n, FLT_MAX);
+		keyA.assign(n, 0); keyB.assign(n, 0); heapIndex.assign(n, -1);
+		start = goal = last = -1; km = 0;
+		replanTime = 0;
+	}
+
+	// Applies changed cells from OccupancyGrid::update and repairs the current plan
+	void update(const std::vector<int> &changed) {
+		if (goal<0 || changed.empty()) return;
+		osg::Timer_t t0 = osg::Timer::instance()->tick();
+
+		for (int i=0; i<changed.size(); i++) refreshCell(changed[i]);
+		computeShortestPath();
+		replanTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+	}
+
+	// Plans from (sx, sy) to (gx, gy) in the spider's frame, reusing the last search when the goal hasn't
+	// changed cell. Returns false if the goal can't be reached. The path starts at the first waypoint after
+	// the start and ends at the goal, with waypoints in line of sight of each other removed.
+	bool findPath(float sx, float sy, float gx, float gy, std::vector<osg::Vec2> &path) {
+		path.clear();
+		int s = grid->cellAt(sx, sy), e = grid->cellAt(gx, gy);
+		if (s<0 || e<0) return false;
+		osg::Timer_t t0 = osg::Timer::instance()->tick();
+
+		if (e!=goal) reset(s, e);
+		else if (s!=start) {
+			int previous = start;
+			km += heuristic(last, s); last = start = s;
+			//Walkability of the old and new start cells may have changed with the move
+			refreshCell(previous); refreshCell(start);
+		}
+		computeShortestPath();
+		replanTime = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick());
+		if (g[start]>=FLT_MAX) return false;
+
+		//Follow the cheapest neighbour down to the goal
+		std::vector<int> cells; cells.push_back(start);
+		int c = start;
+		while (c!=goal && cells.size()<grid->getCellCount()) {
+			int n[8]; int count = neighbours(c, n);
+			int best = -1; float bestCost = FLT_MAX;
+			for (int j=0; j<count; j++) {
+				float cost = edgeCost(c, n[j]) + g[n[j]];
+				if (cost<bestCost) { bestCost = cost; best = n[j]; }
+			}
+			if (best<0 || bestCost>=FLT_MAX) return false;
+			cells.push_back(best); c = best;
+		}
+
+		//String pull: keep only the cells the straight line can't skip past
+		int from = 0;
+		for (int i=2; i<cells.size(); i++) {
+			if (!lineOfSight(cells[from], cells[i])) {
+				from = i-1;
+				float x, y; grid->cellCentre(cells[from], x, y);
+				path.push_back(osg::Vec2(x, y));
+			}
+		}
+		path.push_back(osg::Vec2(gx, gy));
+		return true;
+	}
+
+	// Milliseconds taken by the last update or findPath
+	double getReplanTime() { return replanTime; }
+
+private:
+	OccupancyGrid *grid;
+	std::vector<float> g, rhs, keyA, keyB;
+	std::vector<int> heap, heapIndex;
+	int start, goal, last;
+	float km;
+	double replanTime;
+
+	void reset(int s, int e) {
+		std::fill(g.begin(), g.end(), FLT_MAX); std::fill(rhs.begin(), rhs.end(), FLT_MAX);
+		for (int i=0; i<heap.size(); i++) heapIndex[heap[i]] = -1;
+		heap.clear();
+		start = last = s; goal = e; km = 0;
+		rhs[goal] = 0; push(goal);
+	}
+
+	// Edges into and out of a cell whose walkability changed change cost, so it and its neighbours need new rhs values
+	void refreshCell(int c) {
+		updateVertex(c);
+		int n[8]; int count = neighbours(c, n);
+		for (int j=0; j<count; j++) updateVertex(n[j]);
+	}
+
+	// The start and goal cells are always walkable, the spider and the hand stand on them
+	inline bool walkable(int c) { return c==start || c==goal || !grid->isBlocked(c); }
+
+	int neighbours(int c, int *n) {
+		int cols = grid->getCols(), rows = grid->getRows();
+		int cx = c%cols, cy = c/cols, count = 0;
+		for (int dy=-1; dy<=1; dy++) for (int dx=-1; dx<=1; dx++) {
+			if ((dx==0 && dy==0) || cx+dx<0 || cy+dy<0 || cx+dx>=cols || cy+dy>=rows) continue;
+			n[count++] = (cy+dy)*cols + cx+dx;
+		}
+		return count;
+	}
+
+	float edgeCost(int a, int b) {
+		if (!walkable(a) || !walkable(b)) return FLT_MAX;
+		int cols = grid->getCols();
+		int dx = b%cols - a%cols, dy = b/cols - a/cols;
+		if (dx!=0 && dy!=0) {
+			if (!walkable(a + dx) || !walkable(a + dy*cols)) return FLT_MAX;
+			return 1.41421356f;
+		}
+		return 1;
+	}
+
+	// Octile distance, in cells
+	float heuristic(int a, int b) {
+		int cols = grid->getCols();
+		float dx = fabs(float(a%cols - b%cols)), dy = fabs(float(a/cols - b/cols));
+		return MAX(dx, dy) + 0.41421356f*MIN(dx, dy);
+	}
+
+	inline void calculateKey(int c, float &a, float &b) {
+		float m = MIN(g[c], rhs[c]);
+		b = m; a = m>=FLT_MAX ? FLT_MAX : m + heuristic(start, c) + km;
+	}
+
+	inline bool keyLess(float a1, float b1, float a2, float b2) { return a1<a2 || (a1==a2 && b1<b2); }
+
+	// rhs from scratch, the cheapest way on to the goal through a neighbour
+	void computeRhs(int c) {
+		if (c==goal) return;
+		float best = FLT_MAX;
+		int n[8]; int count = neighbours(c, n);
+		for (int j=0; j<count; j++) {
+			if (g[n[j]]>=FLT_MAX) continue;
+			float e = edgeCost(c, n[j]);
+			if (e<FLT_MAX) best = MIN(best, e + g[n[j]]);
+		}
+		rhs[c] = best;
+	}
+
+	// Queues the cell if it is inconsistent
+	void updateQueue(int c) {
+		if (heapIndex[c]>=0) remove(c);
+		if (g[c]!=rhs[c]) push(c);
+	}
+
+	void updateVertex(int c) { computeRhs(c); updateQueue(c); }
+
+	void computeShortestPath() {
+		float sa, sb;
+		while (!heap.empty()) {
+			calculateKey(start, sa, sb);
+			int u = heap[0];
+			if (!keyLess(keyA[u], keyB[u], sa, sb) && rhs[start]==g[start]) break;
+
+			float oldA = keyA[u], oldB = keyB[u], newA, newB;
+			calculateKey(u, newA, newB);
+			int n[8]; int count;
+			if (keyLess(oldA, oldB, newA, newB)) {
+				remove(u); push(u);
+			} else if (g[u]>rhs[u]) {
+				//Became cheaper, neighbours can only improve through it
+				g[u] = rhs[u]; remove(u);
+				count = neighbours(u, n);
+				for (int j=0; j<count; j++) {
+					int v = n[j];
+					if (v==goal) continue;
+					float e = edgeCost(v, u);
+					if (e<FLT_MAX && e+g[u]<rhs[v]) { rhs[v] = e+g[u]; updateQueue(v); }
+				}
+			} else {
+				//Became dearer, only neighbours that went through it need their rhs recomputed
+				float oldG = g[u];
+				g[u] = FLT_MAX;
+				updateVertex(u);
+				count = neighbours(u, n);
+				for (int j=0; j<count; j++) {
+					int v = n[j];
+					if (v==goal) continue;
+					float e = edgeCost(v, u);
+					if (e<FLT_MAX && rhs[v]==e+oldG) updateVertex(v);
+				}
+			}
+		}
+	}
+
+	bool lineOfSight(int a, int b) {
+		int cols = grid->getCols();
+		int x0 = a%cols, y0 = a/cols, x1 = b%cols, y1 = b/cols;
+		int dx = abs(x1-x0), dy = abs(y1-y0), sx = x0<x1 ? 1 : -1, sy = y0<y1 ? 1 : -1, err = dx-dy;
+		while (true) {
+			if (!walkable(y0*cols + x0)) return false;
+			if (x0==x1 && y0==y1) return true;
+			int e2 = 2*err;
+			//Stepping diagonally must not squeeze between two blocked cells
+			if (e2>-dy && e2<dx && (!walkable(y0*cols + x0+sx) || !walkable((y0+sy)*cols + x0))) return false;
+			if (e2>-dy) { err -= dy; x0 += sx; }
+			if (e2<dx) { err += dx; y0 += sy; }
+		}
+	}
+
+	// Binary heap of cells ordered by key, heapIndex tracks each cell's slot so keys can be removed
+	void push(int c) {
+		calculateKey(c, keyA[c], keyB[c]);
+		heap.push_back(c); heapIndex[c] = heap.size()-1;
+		siftUp(heap.size()-1);
+	}
+
+	void remove(int c) {
+		int i = heapIndex[c];
+		if (i<0) return;
+		heapIndex[c] = -1;
+		int lastCell = heap.back(); heap.pop_back();
+		if (i==heap.size()) return;
+		heap[i] = lastCell; heapIndex[lastCell] = i;
+		siftUp(i); siftDown(heapIndex[lastCell]);
+	}
+
+	void siftUp(int i) {
+		while (i>0) {
+			int p = (i-1)/2;
+			if (!keyLess(keyA[heap[i]], keyB[heap[i]], keyA[heap[p]], keyB[heap[p]])) break;
+			swapSlots(i, p); i = p;
+		}
+	}
+
+	void siftDown(int i) {
+		while (true) {
+			int l = 2*i+1, r = l+1, m = i;
+			if (l<heap.size() && keyLess(keyA[heap[l]], keyB[heap[l]], keyA[heap[m]], keyB[heap[m]])) m = l;
+			if (r<heap.size() && keyLess(keyA[heap[r]], keyB[heap[r]], keyA[heap[m]], keyB[heap[m]])) m = r;
+			if (m==i) break;
+			swapSlots(i, m); i = m;
+		}
+	}
+
+	inline void swapSlots(int i, int j) {
+		int t = heap[i]; heap[i] = heap[j]; heap[j] = t;
+		heapIndex[heap[i]] = i; heapIndex[heap[j]] = j;
+	}
+};
+
+#endif
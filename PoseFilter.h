@@ -0,0 +1,190 @@
+#ifndef POSEFILTER_H
+#define POSEFILTER_H
+
+#include <math.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MarkerRegistration.h"
+
+// Smooths marker poses with a constant velocity alpha-beta filter on SE(3) (position and
+// orientation quaternion each with a velocity) and extrapolates them to the display time. Markers
+// keep being reported from the prediction for a short time after they stop being detected, so the
+// registration can run at a lower rate than the renderer.
+class PoseFilter {
+public:
+	PoseFilter(double _alpha = 0.6, double _beta = 0.2, double _maxPrediction = 0.2, double _lostTimeout = 0.5) {
+		alpha = _alpha; beta = _beta; maxPrediction = _maxPrediction; lostTimeout = _lostTimeout;
+		resetDistance = 100; resetAngle = 0.5;
+	}
+
+	~PoseFilter() { clear(); }
+
+	// Feed the measurements from a registration performed on a frame captured at timestamp
+	void update(const std::vector<MarkerTransform> &mt, double timestamp) {
+		for (int i=0; i<mt.size(); i++) {
+			std::map<std::string, State>::iterator s = states.find(mt.at(i).marker.name);
+			if (s==states.end()) {
+				State state; initState(state, mt.at(i), timestamp);
+				states[mt.at(i).marker.name] = state;
+				continue;
+			}
+			updateState(s->second, mt.at(i), timestamp);
+		}
+
+		//Forget markers which haven't been seen for too long
+		for (std::map<std::string, State>::iterator s = states.begin(); s!=states.end();) {
+			if (timestamp - s->second.time > lostTimeout) { s->second.mt.clear(); states.erase(s++); } else s++;
+		}
+	}
+
+	// Filtered poses extrapolated to displayTime, to be clear()ed by the caller
+	std::vector<MarkerTransform> predict(double displayTime) {
+		std::vector<MarkerTransform> retVal;
+		for (std::map<std::string, State>::iterator s = states.begin(); s!=states.end(); s++) {
+			State &state = s->second;
+			double dt = displayTime - state.time;
+			if (dt > lostTimeout) continue;
+			dt = dt<0 ? 0 : (dt>maxPrediction ? maxPrediction : dt);
+
+			double p[3], q[4];
+			for (int i=0; i<3; i++) p[i] = state.p[i] + state.v[i]*dt;
+			integrate(state.q, state.w, dt, q);
+
+			MarkerTransform mt = copyMarkerTransform(state.mt);
+			toTransMat(p, q, mt.transMat);
+			retVal.push_back(mt);
+		}
+		return retVal;
+	}
+
+	void clear() {
+		for (std::map<std::string, State>::iterator s = states.begin(); s!=states.end(); s++) s->second.mt.clear();
+		states.clear();
+	}
+
+	void setGains(double _alpha, double _beta) { alpha = _alpha; beta = _beta; }
+
+private:
+	struct State {
+		MarkerTransform mt;      // Last measurement, used as the template for the output
+		double time;
+		double p[3], v[3];       // Position and linear velocity
+		double q[4], w[3];       // Orientation (x,y,z,w) and angular velocity (axis * rad/s)
+	};
+
+	std::map<std::string, State> states;
+	double alpha, beta, maxPrediction, lostTimeout;
+	double resetDistance, resetAngle;
+
+	void initState(State &state, const MarkerTransform &mt, double timestamp) {
+		state.mt = copyMarkerTransform(mt); state.time = timestamp;
+		fromTransMat(mt.transMat, state.p, state.q);
+		for (int i=0; i<3; i++) { state.v[i] = 0; state.w[i] = 0; }
+	}
+
+	void updateState(State &state, const MarkerTransform &mt, double timestamp) {
+		double dt = timestamp - state.time;
+		if (dt<=0) return;
+
+		double zp[3], zq[4]; fromTransMat(mt.transMat, zp, zq);
+
+		//Predict forward to the measurement time
+		double pp[3], pq[4];
+		for (int i=0; i<3; i++) pp[i] = state.p[i] + state.v[i]*dt;
+		integrate(state.q, state.w, dt, pq);
+
+		//Residuals between the measurement and the prediction
+		double rp[3], rq[4], rv[3], inv[4] = {-pq[0], -pq[1], -pq[2], pq[3]};
+		for (int i=0; i<3; i++) rp[i] = zp[i]-pp[i];
+		quatMul(zq, inv, rq); quatToRotVec(rq, rv);
+
+		//A large jump is a relocalisation rather than noise, so snap to it
+		double distance = sqrt(rp[0]*rp[0]+rp[1]*rp[1]+rp[2]*rp[2]);
+		double angle = sqrt(rv[0]*rv[0]+rv[1]*rv[1]+rv[2]*rv[2]);
+		if (distance>resetDistance || angle>resetAngle || dt>lostTimeout) {
+			state.mt.clear(); initState(state, mt, timestamp);
+			return;
+		}
+
+		for (int i=0; i<3; i++) {
+			state.p[i] = pp[i] + alpha*rp[i];
+			state.v[i] += beta*rp[i]/dt;
+			state.w[i] += beta*rv[i]/dt;
+		}
+		double corr[3] = {alpha*rv[0], alpha*rv[1], alpha*rv[2]}, dq[4];
+		rotVecToQuat(corr, dq); quatMul(dq, pq, state.q); normalise(state.q);
+
+		state.mt.clear(); state.mt = copyMarkerTransform(mt);
+		state.time = timestamp;
+	}
+
+	// Rotate q by the angular velocity w for dt seconds
+	static void integrate(const double *q, const double *w, double dt, double *out) {
+		double rv[3] = {w[0]*dt, w[1]*dt, w[2]*dt}, dq[4];
+		rotVecToQuat(rv, dq); quatMul(dq, q, out); normalise(out);
+	}
+
+	static void quatMul(const double *a, const double *b, double *out) {
+		double r[4];
+		r[0] = a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1];
+		r[1] = a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0];
+		r[2] = a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3];
+		r[3] = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+		for (int i=0; i<4; i++) out[i] = r[i];
+	}
+
+	static void normalise(double *q) {
+		double l = sqrt(q[0]*q[0]+q[1]*q[1]+q[2]*q[2]+q[3]*q[3]);
+		for (int i=0; i<4; i++) q[i] /= l;
+	}
+
+	static void rotVecToQuat(const double *rv, double *q) {
+		double angle = sqrt(rv[0]*rv[0]+rv[1]*rv[1]+rv[2]*rv[2]);
+		double s = angle>1e-9 ? sin(angle*0.5)/angle : 0.5;
+		q[0] = rv[0]*s; q[1] = rv[1]*s; q[2] = rv[2]*s; q[3] = cos(angle*0.5);
+	}
+
+	// Shortest rotation vector for the quaternion
+	static void quatToRotVec(const double *q, double *rv) {
+		double sign = q[3]<0 ? -1 : 1;
+		double s = sqrt(q[0]*q[0]+q[1]*q[1]+q[2]*q[2]);
+		double angle = 2*atan2(s, q[3]*sign);
+		double k = s>1e-9 ? sign*angle/s : 2*sign;
+		rv[0] = q[0]*k; rv[1] = q[1]*k; rv[2] = q[2]*k;
+	}
+
+	// transMat is column major, rotation in the upper 3x3 and translation in elements 12-14
+	static void fromTransMat(const double *m, double *p, double *q) {
+		p[0] = m[12]; p[1] = m[13]; p[2] = m[14];
+
+		double r00 = m[0], r01 = m[4], r02 = m[8], r10 = m[1], r11 = m[5], r12 = m[9], r20 = m[2], r21 = m[6], r22 = m[10];
+		double trace = r00 + r11 + r22;
+		if (trace>0) {
+			double s = 0.5/sqrt(trace+1);
+			q[3] = 0.25/s; q[0] = (r21-r12)*s; q[1] = (r02-r20)*s; q[2] = (r10-r01)*s;
+		} else if (r00>r11 && r00>r22) {
+			double s = 2*sqrt(1+r00-r11-r22);
+			q[3] = (r21-r12)/s; q[0] = 0.25*s; q[1] = (r01+r10)/s; q[2] = (r02+r20)/s;
+		} else if (r11>r22) {
+			double s = 2*sqrt(1+r11-r00-r22);
+			q[3] = (r02-r20)/s; q[0] = (r01+r10)/s; q[1] = 0.25*s; q[2] = (r12+r21)/s;
+		} else {
+			double s = 2*sqrt(1+r22-r00-r11);
+			q[3] = (r10-r01)/s; q[0] = (r02+r20)/s; q[1] = (r12+r21)/s; q[2] = 0.25*s;
+		}
+		normalise(q);
+	}
+
+	static void toTransMat(const double *p, const double *q, double *m) {
+		double x = q[0], y = q[1], z = q[2], w = q[3];
+		m[0] = 1-2*(y*y+z*z); m[4] = 2*(x*y-z*w);   m[8] = 2*(x*z+y*w);
+		m[1] = 2*(x*y+z*w);   m[5] = 1-2*(x*x+z*z); m[9] = 2*(y*z-x*w);
+		m[2] = 2*(x*z-y*w);   m[6] = 2*(y*z+x*w);   m[10] = 1-2*(x*x+y*y);
+		m[3] = 0; m[7] = 0; m[11] = 0;
+		m[12] = p[0]; m[13] = p[1]; m[14] = p[2]; m[15] = 1;
+	}
+};
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#include <osg/Timer>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PROFILER_THREAD_LOCAL __declspec(thread)
+#define PROFILER_FENCE() _ReadWriteBarrier()
+#else
+#define PROFILER_THREAD_LOCAL __thread
+#define PROFILER_FENCE() __sync_synchronize()
+#endif
+
+// Timings of named stages of the frame, from any thread. Each thread writes its timings to a ring
+// of its own without locking, and collect() drains every ring from one thread into a histogram per
+// stage and, while tracing, a list of events. The histograms give percentiles for a CSV summary and
+// the events are written as a Chrome trace (chrome://tracing). While disabled a timed scope costs a
+// single test of a flag.
+class Profiler {
+public:
+	Profiler() {
+		enabled = false; tracing = false; maxTraceEvents = 1000000;
+		startTick = osg::Timer::instance()->tick();
+	}
+
+	~Profiler() {
+		for (int i=0; i<rings.size(); i++) delete rings[i];
+	}
+
+	// Tracing keeps every event for writeChromeTrace, up to maxEvents
+	void setEnabled(bool _enabled, bool _tracing = false, int maxEvents = 1000000) {
+		enabled = _enabled; tracing = _tracing; maxTraceEvents = maxEvents;
+	}
+
+	inline bool isEnabled() { return enabled; }
+
+	// The id of a named stage, registering it the first time
+	int stage(const char *name) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		for (int i=0; i<stages.size(); i++) if (stages[i].name==name) return i;
+		stages.push_back(Stage(name));
+		return stages.size()-1;
+	}
+
+	// Names the calling thread in the trace
+	void nameThread(const char *name) {
+		threadRing()->name = name;
+	}
+
+	void record(int stage, osg::Timer_t begin, osg::Timer_t end) {
+		threadRing()->push(stage, begin, end);
+	}
+
+	// Records the time from begin until now, for spans that start on another thread or an earlier frame
+	inline void recordSince(int stage, osg::Timer_t begin) {
+		if (enabled && begin) record(stage, begin, osg::Timer::instance()->tick());
+	}
+
+	// Moves every thread's recorded timings into the histograms, call regularly from one thread
+	void collect() {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		for (int r=0; r<rings.size(); r++) {
+			Ring *ring = rings[r];
+			unsigned int head = ring->head;
+			PROFILER_FENCE();
+			for (unsigned int i=ring->tail; i!=head; i++) {
+				const Event &e = ring->events[i & ring->mask];
+				stages[e.stage].add(osg::Timer::instance()->delta_u(e.begin, e.end));
+				if (tracing && trace.size()<maxTraceEvents) {
+					TraceEvent t = { e.stage, r, osg::Timer::instance()->delta_u(startTick, e.begin), osg::Timer::instance()->delta_u(e.begin, e.end) };
+					trace.push_back(t);
+				}
+			}
+			PROFILER_FENCE();
+			ring->tail = head;
+		}
+	}
+
+	// Per stage count, mean, percentiles and maximum in milliseconds
+	bool writeCSV(const char *filename) {
+		collect();
+		FILE *f = fopen(filename, "w");
+		if (f==0) { printf("Could not write profile %s\n", filename); return false; }
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		fprintf(f, "stage,count,mean_ms,p50_ms,p90_ms,p99_ms,p999_ms,max_ms\n");
+		for (int i=0; i<stages.size(); i++) {
+			const Stage &s = stages[i];
+			if (s.count==0) continue;
+			fprintf(f, "%s,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", s.name.c_str(), s.count, s.sum/s.count/1000.0,
+				s.percentile(0.5)/1000.0, s.percentile(0.9)/1000.0, s.percentile(0.99)/1000.0, s.percentile(0.999)/1000.0, s.max/1000.0);
+		}
+		unsigned int dropped = 0;
+		for (int r=0; r<rings.size(); r++) dropped += rings[r]->dropped;
+		if (dropped>0) printf("Profiler dropped %u events, collect more often\n", dropped);
+		fclose(f);
+		return true;
+	}
+
+	// The same per stage summary as a table
+	void printSummary(FILE *f = stdout) {
+		collect();
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		fprintf(f, "%-32s %8s %10s %10s %10s %10s\n", "stage", "count", "mean ms", "p50 ms", "p99 ms", "p99.9 ms");
+		for (int i=0; i<stages.size(); i++) {
+			const Stage &s = stages[i];
+			if (s.count==0) continue;
+			fprintf(f, "%-32s %8u %10.3f %10.3f %10.3f %10.3f\n", s.name.c_str(), s.count, s.sum/s.count/1000.0,
+				s.percentile(0.5)/1000.0, s.percentile(0.99)/1000.0, s.percentile(0.999)/1000.0);
+		}
+	}
+
+	// Every traced event as a Chrome trace
+	bool writeChromeTrace(const char *filename) {
+		collect();
+		FILE *f = fopen(filename, "w");
+		if (f==0) { printf("Could not write trace %s\n", filename); return false; }
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		fprintf(f, "{\"traceEvents\":[\n");
+		for (int r=0; r<rings.size(); r++) {
+			fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", r, rings[r]->name.c_str());
+		}
+		for (int i=0; i<trace.size(); i++) {
+			const TraceEvent &t = trace[i];
+			fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}%s\n",
+				stages[t.stage].name.c_str(), t.thread, t.begin, t.duration, i+1<trace.size() ? "," : "");
+		}
+		fprintf(f, "]}\n");
+		fclose(f);
+		return true;
+	}
+
+	// Milliseconds at the given fraction of a stage's timings so far, 0 if it has none
+	double getPercentile(const char *name, double fraction) {
+		int s = stage(name);
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		return stages[s].count>0 ? stages[s].percentile(fraction)/1000.0 : 0;
+	}
+
+	// Forgets every timing so far, for starting a measurement after warming up
+	void reset() {
+		collect();
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		for (int i=0; i<stages.size(); i++) stages[i] = Stage(stages[i].name);
+		trace.clear();
+		startTick = osg::Timer::instance()->tick();
+	}
+
+private:
+	struct Event {
+		int stage;
+		osg::Timer_t begin, end;
+	};
+
+	// Written only by its thread and read only by collect, which never overtakes head
+	struct Ring {
+		Ring(int capacity) { events.resize(capacity); mask = capacity-1; head = tail = 0; dropped = 0; }
+		inline void push(int stage, osg::Timer_t begin, osg::Timer_t end) {
+			unsigned int h = head;
+			if (h-tail>mask) { dropped++; return; }
+			Event &e = events[h & mask];
+			e.stage = stage; e.begin = begin; e.end = end;
+			PROFILER_FENCE();
+			head = h+1;
+		}
+		std::vector<Event> events;
+		unsigned int mask, dropped;
+		volatile unsigned int head, tail;
+		std::string name;
+	};
+
+	// Microsecond timings in buckets an eighth of an octave wide, from 1us to about 70 minutes
+	struct Stage {
+		Stage() {}
+		Stage(const std::string &_name) { name = _name; count = 0; sum = max = 0; buckets.assign(bucketCount, 0); }
+		inline void add(double us) {
+			count++; sum += us; if (us>max) max = us;
+			int b = us<1 ? 0 : 1 + (int)(log(us)*(8/log(2.0)));
+			if (b>=bucketCount) b = bucketCount-1;
+			buckets[b]++;
+		}
+		// The upper edge of the bucket holding the fraction'th timing, never more than the maximum
+		double percentile(double fraction) const {
+			double target = fraction*count, seen = 0;
+			for (int b=0; b<bucketCount; b++) {
+				seen += buckets[b];
+				if (seen>=target && buckets[b]>0) { double edge = pow(2.0, b/8.0); return edge<max ? edge : max; }
+			}
+			return max;
+		}
+		std::string name;
+		unsigned int count;
+		double sum, max;
+		std::vector<unsigned int> buckets;
+		static const int bucketCount = 8*32+1;
+	};
+
+	struct TraceEvent {
+		int stage, thread;
+		double begin, duration;
+	};
+
+	volatile bool enabled;
+	bool tracing;
+	int maxTraceEvents;
+	osg::Timer_t startTick;
+	OpenThreads::Mutex mutex;
+	std::vector<Stage> stages;
+	std::vector<Ring*> rings;
+	std::vector<TraceEvent> trace;
+
+	Ring *threadRing() {
+		static PROFILER_THREAD_LOCAL Ring *ring = 0;
+		if (ring==0) {
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+			ring = new Ring(4096);
+			char name[32]; sprintf(name, "thread %d", (int)rings.size());
+			ring->name = name;
+			rings.push_back(ring);
+		}
+		return ring;
+	}
+};
+
+inline Profiler &profiler() {
+	static Profiler p;
+	return p;
+}
+
+// Times the enclosing scope as a stage, when the profiler is enabled
+class ProfileScope {
+public:
+	ProfileScope(int _stage) { stage = _stage; begin = profiler().isEnabled() ? osg::Timer::instance()->tick() : 0; }
+	~ProfileScope() { if (begin) profiler().record(stage, begin, osg::Timer::instance()->tick()); }
+private:
+	int stage;
+	osg::Timer_t begin;
+};
+
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(name) \
+	static int PROFILE_JOIN(profileStage, __LINE__) = profiler().stage(name); \
+	ProfileScope PROFILE_JOIN(profileScope, __LINE__)(PROFILE_JOIN(profileStage, __LINE__))
+
+#endif
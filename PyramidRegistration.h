@@ -0,0 +1,205 @@
+#ifndef PYRAMIDREGISTRATION_H
+#define PYRAMIDREGISTRATION_H
+
+#include <cv.h>
+#include <highgui.h>
+#include <map>
+#include <vector>
+
+#include "MarkerRegistration.h"
+
+// Coarse to fine registration. The wrapped stage detects and matches on a downsampled level of
+// the camera frame, then the homography is refined on the full resolution frame by aligning the
+// marker image against the projected marker region only.
+class PyramidRegistration : public MarkerRegistration {
+public:
+	PyramidRegistration(MarkerRegistration *_reg, int _levels = 1) {
+		reg = _reg; levels = _levels;
+		grey = 0; warped = 0;
+		scaledParams = cvCreateMat(3,3,CV_64FC1);
+		minInliers = 10; winSize = 9;
+	}
+
+	~PyramidRegistration() {
+		releasePyramid();
+		if (grey) cvReleaseImage(&grey);
+		if (warped) cvReleaseImage(&warped);
+		cvReleaseMat(&scaledParams);
+		clearTemplates();
+		delete reg;
+	}
+
+	std::vector<MarkerTransform> performRegistration(IplImage *frame_input, CvMat *captureParams, CvMat *captureDistortion) {
+		if (levels<=0) return reg->performRegistration(frame_input, captureParams, captureDistortion);
+
+		buildPyramid(frame_input);
+		float s = float(1<<levels);
+
+		//Camera intrinsics for the coarse level, distortion is independent of the image scale
+		cvConvert(captureParams, scaledParams);
+		for (int i=0; i<6; i++) scaledParams->data.db[i] /= s;
+
+		std::vector<MarkerTransform> mt = reg->performRegistration(pyramid.back(), scaledParams, captureDistortion);
+
+		for (int i=0; i<mt.size(); i++) {
+			MarkerTransform &m = mt.at(i);
+			float scale = calcMarkerScale(m, scaledParams, captureDistortion);
+
+			//Bring the homography up to full resolution and refine it
+			double _H[9]; CvMat H = cvMat(3,3,CV_64FC1,_H);
+			cvConvert(m.homography, &H);
+			for (int j=0; j<6; j++) _H[j] *= s;
+			refineHomography(m, &H);
+
+			double transMat[16];
+			if (calcTransMat(m.marker.size, &H, scale, captureParams, captureDistortion, transMat)) {
+				cvConvert(&H, m.homography); memcpy(m.transMat, transMat, 16*sizeof(double));
+			}
+		}
+
+		return mt;
+	}
+
+	void addResizedMarker(std::string markerName, int maxLengthSize) { reg->addResizedMarker(markerName, maxLengthSize); }
+	void addResizedScaledMarker(std::string markerName, int maxLengthSize, int maxLengthScale) { reg->addResizedScaledMarker(markerName, maxLengthSize, maxLengthScale); }
+
+	void removeMarker(std::string markerName) {
+		std::map<std::string, MarkerTemplate>::iterator t = templates.find(markerName);
+		if (t!=templates.end()) { cvReleaseImage(&t->second.image); templates.erase(t); }
+		reg->removeMarker(markerName);
+	}
+
+	void setLevels(int _levels) { levels = _levels; }
+	int getLevels() { return levels; }
+
+private:
+	struct MarkerTemplate {
+		IplImage *image;
+		std::vector<CvPoint2D32f> points;
+	};
+
+	MarkerRegistration *reg;
+	int levels, minInliers, winSize;
+
+	std::vector<IplImage*> pyramid;
+	IplImage *grey, *warped;
+	CvMat *scaledParams;
+	std::map<std::string, MarkerTemplate> templates;
+
+	void releasePyramid() {
+		for (int i=1; i<pyramid.size(); i++) cvReleaseImage(&pyramid.at(i));
+		pyramid.clear();
+	}
+
+	void clearTemplates() {
+		for (std::map<std::string, MarkerTemplate>::iterator t = templates.begin(); t!=templates.end(); t++) cvReleaseImage(&t->second.image);
+		templates.clear();
+	}
+
+	// Level 0 is the input frame itself, each following level is half the size of the last
+	void buildPyramid(IplImage *frame_input) {
+		if (pyramid.size()!=levels+1 || pyramid.at(1)->width!=(frame_input->width+1)/2 || pyramid.at(1)->height!=(frame_input->height+1)/2 || pyramid.at(1)->nChannels!=frame_input->nChannels) {
+			releasePyramid();
+			pyramid.push_back(frame_input);
+			for (int i=1; i<=levels; i++) {
+				CvSize size = cvSize((pyramid.at(i-1)->width+1)/2, (pyramid.at(i-1)->height+1)/2);
+				pyramid.push_back(cvCreateImage(size, frame_input->depth, frame_input->nChannels));
+			}
+		}
+		pyramid.at(0) = frame_input;
+		for (int i=1; i<=levels; i++) cvPyrDown(pyramid.at(i-1), pyramid.at(i));
+
+		if (grey==0 || grey->width!=frame_input->width || grey->height!=frame_input->height) {
+			if (grey) cvReleaseImage(&grey);
+			grey = cvCreateImage(cvGetSize(frame_input), IPL_DEPTH_8U, 1);
+		}
+		if (frame_input->nChannels==1) cvCopy(frame_input, grey); else cvCvtColor(frame_input, grey, CV_BGR2GRAY);
+	}
+
+	// The marker image at registration size, along with the features used for refinement
+	MarkerTemplate *getTemplate(const MarkerTransform &m) {
+		std::map<std::string, MarkerTemplate>::iterator t = templates.find(m.marker.name);
+		if (t!=templates.end() && t->second.image->width==m.marker.size.width && t->second.image->height==m.marker.size.height) return &t->second;
+		if (t!=templates.end()) { cvReleaseImage(&t->second.image); templates.erase(t); }
+
+		IplImage *markerIm = cvLoadImage(m.marker.name.c_str(), CV_LOAD_IMAGE_GRAYSCALE);
+		if (markerIm==0) return 0;
+
+		MarkerTemplate mTemplate;
+		mTemplate.image = cvCreateImage(m.marker.size, IPL_DEPTH_8U, 1);
+		cvResize(markerIm, mTemplate.image, CV_INTER_AREA);
+		cvReleaseImage(&markerIm);
+
+		IplImage *eig = cvCreateImage(m.marker.size, IPL_DEPTH_32F, 1), *temp = cvCreateImage(m.marker.size, IPL_DEPTH_32F, 1);
+		int count = 200; mTemplate.points.resize(count);
+		cvGoodFeaturesToTrack(mTemplate.image, eig, temp, &mTemplate.points[0], &count, 0.01, 10, 0, 3, 0, 0.04);
+		mTemplate.points.resize(count);
+		cvReleaseImage(&eig); cvReleaseImage(&temp);
+
+		templates[m.marker.name] = mTemplate;
+		return &templates[m.marker.name];
+	}
+
+	// Warp the marker image into the projected marker region and align its features to the frame
+	bool refineHomography(const MarkerTransform &m, CvMat *H) {
+		MarkerTemplate *mTemplate = getTemplate(m);
+		if (mTemplate==0 || mTemplate->points.size()<minInliers) return false;
+
+		CvPoint2D32f corners[4]; getMarkerCorners(m.marker.size, H, corners);
+		float minX=corners[0].x, maxX=corners[0].x, minY=corners[0].y, maxY=corners[0].y;
+		for (int i=1; i<4; i++) {
+			minX = MIN(minX, corners[i].x); maxX = MAX(maxX, corners[i].x);
+			minY = MIN(minY, corners[i].y); maxY = MAX(maxY, corners[i].y);
+		}
+		int margin = winSize<<levels;
+		CvRect roi = cvRect(MAX(0, int(minX)-margin), MAX(0, int(minY)-margin), 0, 0);
+		roi.width = MIN(grey->width, int(maxX)+margin) - roi.x; roi.height = MIN(grey->height, int(maxY)+margin) - roi.y;
+		if (roi.width<=winSize || roi.height<=winSize) return false;
+
+		//Homography from the marker to the region of interest
+		double _T[9] = {1,0,-roi.x, 0,1,-roi.y, 0,0,1}, _Hroi[9];
+		CvMat T = cvMat(3,3,CV_64FC1,_T), Hroi = cvMat(3,3,CV_64FC1,_Hroi);
+		cvMatMul(&T, H, &Hroi);
+
+		if (warped==0 || warped->width<roi.width || warped->height<roi.height) {
+			if (warped) cvReleaseImage(&warped);
+			warped = cvCreateImage(cvGetSize(grey), IPL_DEPTH_8U, 1);
+		}
+		cvSetImageROI(warped, cvRect(0,0,roi.width,roi.height));
+		cvWarpPerspective(mTemplate->image, warped, &Hroi, CV_INTER_LINEAR+CV_WARP_FILL_OUTLIERS, cvScalarAll(0));
+
+		int count = mTemplate->points.size();
+		std::vector<CvPoint2D32f> predicted(count), tracked(count);
+		CvMat mTemplatePts = cvMat(count,1,CV_32FC2,&mTemplate->points[0]), mPredicted = cvMat(count,1,CV_32FC2,&predicted[0]);
+		cvPerspectiveTransform(&mTemplatePts, &mPredicted, &Hroi);
+		tracked = predicted;
+
+		std::vector<char> status(count);
+		cvSetImageROI(grey, roi);
+		cvCalcOpticalFlowPyrLK(warped, grey, 0, 0, &predicted[0], &tracked[0], count, cvSize(winSize,winSize), levels, &status[0], 0,
+			cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03), CV_LKFLOW_INITIAL_GUESSES);
+		cvResetImageROI(grey); cvResetImageROI(warped);
+
+		std::vector<CvPoint2D32f> markerPts, framePts;
+		for (int i=0; i<count; i++) {
+			if (!status[i]) continue;
+			markerPts.push_back(mTemplate->points[i]);
+			framePts.push_back(cvPoint2D32f(tracked[i].x+roi.x, tracked[i].y+roi.y));
+		}
+		if (framePts.size()<minInliers) return false;
+
+		double _refined[9]; CvMat refined = cvMat(3,3,CV_64FC1,_refined);
+		CvMat mMarker = cvMat(markerPts.size(),1,CV_32FC2,&markerPts[0]), mFrame = cvMat(framePts.size(),1,CV_32FC2,&framePts[0]);
+		std::vector<unsigned char> inliers(framePts.size());
+		CvMat mInliers = cvMat(1,inliers.size(),CV_8UC1,&inliers[0]);
+		if (!cvFindHomography(&mMarker, &mFrame, &refined, CV_RANSAC, 2, &mInliers)) return false;
+
+		int inlierCount = 0; for (int i=0; i<inliers.size(); i++) if (inliers[i]) inlierCount++;
+		if (inlierCount<minInliers) return false;
+
+		cvCopy(&refined, H);
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef REGISTRATIONBENCHMARK_H
+#define REGISTRATIONBENCHMARK_H
+
+#include <cv.h>
+#include <highgui.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "MarkerRegistration.h"
+
+// Load camera intrinsics from a calibration file, scaled to the size of the frames being used
+inline bool loadCameraParameters(const char *filename, CvSize frameSize, CvMat **params, CvMat **distortion) {
+	CvFileStorage* fs = cvOpenFileStorage( filename, 0, CV_STORAGE_READ );
+	if (fs==0) return false;
+
+	int width = cvReadIntByName(fs, 0, "image_width", frameSize.width);
+	*params = (CvMat*)cvRead(fs, cvGetFileNodeByName(fs, 0, "camera_matrix"));
+	*distortion = (CvMat*)cvRead(fs, cvGetFileNodeByName(fs, 0, "distortion_coefficients"));
+	cvReleaseFileStorage( &fs );
+
+	double scale = double(frameSize.width)/double(width);
+	for (int i=0; i<6; i++) (*params)->data.db[i] *= scale;
+	return true;
+}
+
+// Load recorded frames from either a video file or a printf style image pattern (e.g. rec/%04d.png)
+inline std::vector<IplImage*> loadRecordedFrames(const char *source, int maxFrames = 1000) {
+	std::vector<IplImage*> frames;
+	if (strchr(source, '%')) {
+		char filename[1024];
+		for (int i=0; i<maxFrames; i++) {
+			sprintf(filename, source, i);
+			IplImage *frame = cvLoadImage(filename);
+			if (frame==0) { if (i==0) continue; else break; }
+			frames.push_back(frame);
+		}
+	} else {
+		CvCapture *capture = cvCaptureFromFile(source);
+		if (capture==0) return frames;
+		while (frames.size()<maxFrames) {
+			IplImage *frame = cvQueryFrame(capture);
+			if (frame==0) break;
+			frames.push_back(cvCloneImage(frame));
+		}
+		cvReleaseCapture(&capture);
+	}
+	return frames;
+}
+
+// Frames of the marker over a plain background for when there is no recording. The marker sways and
+// tilts a little from frame to frame, the same each time, so there is something to track.
+inline std::vector<IplImage*> createSyntheticFrames(const char *markerFile, CvSize size, int count) {
+	std::vector<IplImage*> frames;
+	IplImage *marker = cvLoadImage(markerFile);
+	if (marker==0) return frames;
+
+	CvPoint2D32f src[4] = { cvPoint2D32f(0, 0), cvPoint2D32f(marker->width, 0), cvPoint2D32f(marker->width, marker->height), cvPoint2D32f(0, marker->height) };
+	double m[9]; CvMat homography = cvMat(3, 3, CV_64FC1, m);
+	float halfWidth = size.width*0.3f, halfHeight = halfWidth*marker->height/marker->width;
+	for (int i=0; i<count; i++) {
+		float t = 2*CV_PI*i/count;
+		float cx = size.width*0.5f + size.width*0.1f*sin(t), cy = size.height*0.5f + size.height*0.08f*sin(2*t);
+		float tilt = 0.15f*cos(t), c = cos(0.2f*sin(t)), s = sin(0.2f*sin(t));
+		//The far edge is shortened as the marker tilts away
+		CvPoint2D32f dst[4];
+		float corners[4][2] = { {-halfWidth*(1-tilt), -halfHeight}, {halfWidth*(1-tilt), -halfHeight}, {halfWidth*(1+tilt), halfHeight}, {-halfWidth*(1+tilt), halfHeight} };
+		for (int j=0; j<4; j++) dst[j] = cvPoint2D32f(cx + c*corners[j][0] - s*corners[j][1], cy + s*corners[j][0] + c*corners[j][1]);
+
+		IplImage *frame = cvCreateImage(size, IPL_DEPTH_8U, 3); cvSet(frame, cvScalar(90, 100, 110));
+		cvGetPerspectiveTransform(src, dst, &homography);
+		cvWarpPerspective(marker, frame, &homography, CV_INTER_LINEAR);
+		frames.push_back(frame);
+	}
+	cvReleaseImage(&marker);
+	return frames;
+}
+
+// Runs each registration stage over the same recorded frames and reports speed and accuracy side
+// by side. The first stage is the reference: accuracy is the mean distance between the marker
+// corners each stage finds and those found by the reference on the same frame.
+inline void benchmarkRegistration(std::vector<MarkerRegistration*> &regs, std::vector<std::string> &names, const char *source, const char *cameraFile, const char *csvFile) {
+	std::vector<IplImage*> frames = loadRecordedFrames(source);
+	if (frames.empty()) { printf("No frames could be loaded from %s\n", source); return; }
+
+	CvMat *params, *distortion;
+	if (!loadCameraParameters(cameraFile, cvGetSize(frames.at(0)), &params, &distortion)) { printf("Could not load %s\n", cameraFile); return; }
+
+	FILE *csv = csvFile ? fopen(csvFile, "w") : 0;
+	if (csv) fprintf(csv, "frame,algorithm,ms,markers,corner_error\n");
+
+	//Corners found by the reference stage for each frame, keyed by marker name
+	std::vector<std::vector<std::pair<std::string, std::vector<CvPoint2D32f> > > > reference(frames.size());
+
+	printf("%-12s %10s %10s %10s %10s %10s %12s\n", "algorithm", "mean ms", "median ms", "p95 ms", "fps", "detected", "corner err");
+	for (int r=0; r<regs.size(); r++) {
+		std::vector<double> times; int detected = 0; double errorSum = 0; int errorCount = 0;
+
+		//Warm up caches and lazily allocated buffers before timing
+		std::vector<MarkerTransform> warm = regs.at(r)->performRegistration(frames.at(0), params, distortion);
+		clearMarkerTransforms(warm);
+
+		for (int f=0; f<frames.size(); f++) {
+			int64 start = cvGetTickCount();
+			std::vector<MarkerTransform> mt = regs.at(r)->performRegistration(frames.at(f), params, distortion);
+			double ms = (cvGetTickCount()-start)/(cvGetTickFrequency()*1000.0);
+			times.push_back(ms);
+			if (!mt.empty()) detected++;
+
+			double frameError = -1;
+			for (int i=0; i<mt.size(); i++) {
+				std::vector<CvPoint2D32f> corners(4); getMarkerCorners(mt.at(i).marker.size, mt.at(i).homography, &corners[0]);
+				if (r==0) { reference.at(f).push_back(std::make_pair(mt.at(i).marker.name, corners)); continue; }
+
+				for (int j=0; j<reference.at(f).size(); j++) {
+					if (reference.at(f).at(j).first!=mt.at(i).marker.name) continue;
+					double e = 0;
+					for (int c=0; c<4; c++) {
+						CvPoint2D32f a = corners[c], b = reference.at(f).at(j).second[c];
+						e += sqrt((a.x-b.x)*(a.x-b.x) + (a.y-b.y)*(a.y-b.y))/4.0;
+					}
+					errorSum += e; errorCount++; frameError = e;
+				}
+			}
+			if (csv) fprintf(csv, "%d,%s,%.3f,%d,%.3f\n", f, names.at(r).c_str(), ms, (int)mt.size(), frameError);
+			clearMarkerTransforms(mt);
+		}
+
+		double total = 0; for (int i=0; i<times.size(); i++) total += times[i];
+		std::sort(times.begin(), times.end());
+		double mean = total/times.size();
+		printf("%-12s %10.2f %10.2f %10.2f %10.1f %9.1f%% ", names.at(r).c_str(), mean, times[times.size()/2], times[int(times.size()*0.95)], 1000.0/mean, 100.0*detected/frames.size());
+		if (r==0) printf("%12s\n", "reference"); else if (errorCount) printf("%10.2fpx\n", errorSum/errorCount); else printf("%12s\n", "-");
+	}
+
+	if (csv) fclose(csv);
+	for (int i=0; i<frames.size(); i++) cvReleaseImage(&frames.at(i));
+	cvReleaseMat(&params); cvReleaseMat(&distortion);
+}
+
+#endif
@@ -1,205 +1,371 @@
-#ifndef RENDERERMODEL_H
-#define RENDERERMODEL_H
-
-#include <osgViewer/Viewer>
-#include <osgViewer/ViewerEventHandlers>
-#include <osg/Texture2D>
-#include <osg/Geode>
-#include <osg/Geometry>
-#include <osgDB/ReadFile>
-#include <osgDB/WriteFile>
-#include <osg/ShapeDrawable>
-#include <osg/MatrixTransform>
-#include <osg/PositionAttitudeTransform>
-#include <osg/io_utils>
-#include <osg/Depth>
-
-#include "Model.h"
-#include "Global.h"
-
-class keyboardEventHandler : public osgGA::GUIEventHandler {
-    public:
-		virtual bool handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIActionAdapter&) { 
-			if (ea.getEventType() == osgGA::GUIEventAdapter::KEYUP) {
-				if (ea.getKey()==osgGA::GUIEventAdapter::KEY_Escape)
-					checkKeyPress(27);
-				else 
-					checkKeyPress(ea.getKey());
-			}
-			return false;
-		}
-		virtual void accept(osgGA::GUIEventHandlerVisitor& v)   { v.visit(*this); };
-};
-
-
-class Renderer {
-public:
-	Renderer(int Width, int Height, double *projMat) {
-		_width = Width; _height = Height;
-		mVideoImage = new osg::Image();
-
-		scaleImage = cvCreateImage(cvSize(512, 512), IPL_DEPTH_8U, 3);
-
-		viewer.addEventHandler(new osgViewer::WindowSizeHandler());
-		viewer.setUpViewInWindow(100, 100, _width, _height);
-
-		viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
-		viewer.setKeyEventSetsDone(0);
-		viewer.addEventHandler(new keyboardEventHandler());
-
-		osg::ref_ptr<osg::Group> root = new osg::Group();
-		viewer.setSceneData(root.get());
-
-	
-		// ----------------------------------------------------------------
-		// Video background
-		// ----------------------------------------------------------------
-		osg::ref_ptr<osg::Camera> bgCamera = new osg::Camera();
-		bgCamera->getOrCreateStateSet()->setRenderBinDetails(0, "RenderBin");
-		bgCamera->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
-		bgCamera->setClearMask(GL_DEPTH_BUFFER_BIT);
-		bgCamera->getOrCreateStateSet()->setMode(GL_LIGHTING, GL_FALSE);
-		bgCamera->getOrCreateStateSet()->setMode(GL_DEPTH_TEST, GL_FALSE);
-		bgCamera->setProjectionMatrixAsOrtho2D(0, _width, 0, _height);
-	
-		osg::ref_ptr<osg::Geometry> geomBG = osg::createTexturedQuadGeometry(osg::Vec3(0, 0, 0), osg::X_AXIS * _width, osg::Y_AXIS * _height, 0, 1, 1, 0);
-		geomBG->getOrCreateStateSet()->setTextureAttributeAndModes(0, new osg::Texture2D(mVideoImage));
-	
-		osg::ref_ptr<osg::Geode> geodeBG = new osg::Geode();
-		geodeBG->addDrawable(geomBG.get());
-		bgCamera->addChild(geodeBG.get());
-		root->addChild(bgCamera.get());
-	
-		// ----------------------------------------------------------------
-		// Foreground 3D content
-		// ----------------------------------------------------------------
-		fgCamera = new osg::Camera();
-		fgCamera->getOrCreateStateSet()->setRenderBinDetails(1, "RenderBin");
-		fgCamera->setReferenceFrame(osg::Transform::ABSOLUTE_RF_INHERIT_VIEWPOINT);
-		fgCamera->setClearMask(GL_DEPTH_BUFFER_BIT);
-		fgCamera->setProjectionMatrix(osg::Matrixf(projMat));
-
-		// Create the Heightfield Geometry
-		/*{
-			HeightFieldPoints = new osg::Vec3Array;;
-			HeightFieldGeometry = new osg::Geometry(); 
-			HeightFieldTransform = new osg::MatrixTransform();
-
-			//Create Height Field
-			for (int i=0; i<639; i++) {
-				for (int j=0; j<479; j++) {
-					HeightFieldPoints->push_back(osg::Vec3(i-64, j-64, 0));
-					HeightFieldPoints->push_back(osg::Vec3(i-63, j-64, 0));
-					HeightFieldPoints->push_back(osg::Vec3(i-63, j-63, 0));
-					HeightFieldPoints->push_back(osg::Vec3(i-64, j-63, 0));
-				}
-			}
-
-			HeightFieldGeometry->setVertexArray(HeightFieldPoints); 
-			HeightFieldGeometry->addPrimitiveSet(new osg::DrawArrays( GL_QUADS, 0, HeightFieldPoints->size()));
-			HeightFieldGeometry->getOrCreateStateSet()->setMode(GL_BLEND, osg::StateAttribute::ON);
-
-			//Set the Heightfield to be alpha invisible
-			HeightFieldGeometry->setColorBinding(osg::Geometry::BIND_OVERALL); 
-			osg::Vec4Array* col = new osg::Vec4Array(); HeightFieldGeometry->setColorArray(col); col->push_back(osg::Vec4(1,1,1,0.5));
-
-			//Create the containing geode
-			osg::ref_ptr< osg::Geode > geode = new osg::Geode(); geode->addDrawable(HeightFieldGeometry);
-
-			//Create the containing transform
-			float scale = 10; float x = 0; float y = 0; float z = 0;
-			osg::ref_ptr< osg::PositionAttitudeTransform > mt = new osg::PositionAttitudeTransform();
-			mt->setScale(osg::Vec3d(scale,scale,scale));
-			mt->setAttitude(osg::Quat(0,0,0,1));       
-			mt->setPosition(osg::Vec3d(x, y, z)); 
-			mt->addChild( geode.get() );  
-
-			//Set up the depth testing for the landscale
-			osg::Depth * depth = new osg::Depth();
-			depth->setWriteMask(true); depth->setFunction(osg::Depth::Function::LEQUAL);
-			mt->getOrCreateStateSet()->setAttributeAndModes(depth, osg::StateAttribute::ON);
-
-			//Set up the shadow masks
-			//mt->setNodeMask( rcvShadowMask );
-			//mt->getOrCreateStateSet()->setRenderBinDetails(0, "RenderBin");
-			//pat->getOrCreateStateSet()->setRenderBinDetails(1, "RenderBin");
-			//shadowedScene->getOrCreateStateSet()->setRenderBinDetails(1, "RenderBin");
-			
-			//At the heightmap twice, once for shadowing and once for occlusion
-			HeightFieldTransform->addChild(mt);
-			fgCamera.get()->addChild(HeightFieldTransform);
-		}*/
-
-		root->addChild(fgCamera.get());
-	}
-
-	~Renderer() {
-		cvReleaseImage(&scaleImage);
-	};
-
-	void addModel(string markerName, osg::Node *model) {
-		IplImage *markerIm = cvLoadImage(markerName.c_str());
-		arModels[markerName] = new ARNode(cvGetSize(markerIm), model);
-		cvReleaseImage(&markerIm);
-
-		fgCamera->addChild(arModels[markerName]);
-	}
-
-	void updateHeightMap(CvPoint3D32f *ground_grid) {
-		int index=0;
-		for(int y = 0; y < 479; y++) {
-			for(int x = 0; x < 639; x++) {
-				int c1 = (y*640)+x;
-				int c2 = (y*640)+x+1;
-				int c3 = ((y+1)*640)+x+1;
-				int c4 = ((y+1)*640)+x;
-				HeightFieldPoints->at(index++) = osg::Vec3(ground_grid[c1].x, ground_grid[c1].y, ground_grid[c1].z); 
-				HeightFieldPoints->at(index++) = osg::Vec3(ground_grid[c2].x, ground_grid[c2].y, ground_grid[c2].z);
-				HeightFieldPoints->at(index++) = osg::Vec3(ground_grid[c3].x, ground_grid[c3].y, ground_grid[c3].z); 
-				HeightFieldPoints->at(index++) = osg::Vec3(ground_grid[c4].x, ground_grid[c4].y, ground_grid[c4].z);
-			}
-		}
-		HeightFieldGeometry->dirtyDisplayList();
-	}
-
-	void render(IplImage* frame_input, vector<MarkerTransform> mt) { 
-		//Copy the frame into the background image
-		cvResize(frame_input, scaleImage); cvCvtColor(scaleImage, scaleImage, CV_RGB2BGR);
-		mVideoImage->setImage(scaleImage->width, scaleImage->height, 0, 3, GL_RGB, GL_UNSIGNED_BYTE, (unsigned char*)scaleImage->imageData, osg::Image::NO_DELETE);
-	
-		//Set the HeightFieldTransform
-		//if (mt.size()>0) HeightFieldTransform->setMatrix(osg::Matrixd(mt.at(0).transMat));
-
-		for (map<string, ARNode*>::iterator i = arModels.begin(); i!=arModels.end(); i++) {
-			i->second->setModelVisible(false); i->second->setBoundaryVisible(false);
-		}
-
-		for (int i = 0; i<mt.size(); i++) {
-			string filename = mt.at(i).marker.name;
-
-			//Set up the transform and visibility
-			arModels[filename]->setTransform(mt.at(i).transMat);
-			arModels[filename]->setModelVisible(true);
-			arModels[filename]->setBoundaryVisible(false);
-		}
-
-		viewer.frame();
-	}
-
-private:
-	osg::Image* mVideoImage;
-	osgViewer::Viewer viewer;
-	osg::ref_ptr<osg::Camera> fgCamera;
-
-	//HeightField
-	osg::Vec3Array* HeightFieldPoints;
-	osg::Geometry* HeightFieldGeometry;
-	osg::ref_ptr<osg::MatrixTransform> HeightFieldTransform;
-
-	map<string, ARNode*> arModels;
-
-	IplImage *scaleImage;
-	int _width, _height;
-};
-
+#ifndef RENDERERMODEL_H
+#define RENDERERMODEL_H
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+#include <osg/Texture2D>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osg/ShapeDrawable>
+#include <osg/MatrixTransform>
+#include <osg/PositionAttitudeTransform>
+#include <osg/io_utils>
+#include <osg/Depth>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include "Model.h"
+#include "Global.h"
+#include "MarkerRegistration.h"
+#include "VideoBackground.h"
+#include "HeightFieldMesh.h"
+#include "DepthOcclusion.h"
+#include "Latency.h"
+#include "AllocationTracker.h"
+
+class keyboardEventHandler : public osgGA::GUIEventHandler {
+    public:
+		virtual bool handle(const osgGA::GUIEventAdapter& ea,osgGA::GUIActionAdapter&) { 
+			if (ea.getEventType() == osgGA::GUIEventAdapter::KEYUP) {
+				if (ea.getKey()==osgGA::GUIEventAdapter::KEY_Escape)
+					checkKeyPress(27);
+				else 
+					checkKeyPress(ea.getKey());
+			}
+			return false;
+		}
+		virtual void accept(osgGA::GUIEventHandlerVisitor& v)   { v.visit(*this); };
+};
+
+
+// Draws the scene on its own thread at the display rate. The processing loop publishes each frame
+// and its marker poses into a double buffered snapshot, the render thread takes the newest snapshot
+// at the start of each of its frames and keeps animating the spider between them.
+class Renderer {
+public:
+	// Offscreen draws into a pbuffer instead of a window, for running without a display
+	Renderer(int Width, int Height, double *projMat, osgViewer::ViewerBase::ThreadingModel threadingModel = osgViewer::Viewer::SingleThreaded, bool offscreen = false) {
+		_width = Width; _height = Height;
+		front = &snapshots[0]; back = &snapshots[1]; fresh = false;
+		pendingHeightCols = pendingHeightRows = 0;
+		renderThread = 0; maxFrameRate = 60; displayLatency = 0; frameCount = 0; heightFieldMarker = -1;
+
+		osg::ref_ptr<osg::GraphicsContext> gc;
+		if (offscreen) {
+			osg::ref_ptr<osg::GraphicsContext::Traits> traits = new osg::GraphicsContext::Traits();
+			traits->x = 0; traits->y = 0; traits->width = _width; traits->height = _height;
+			traits->red = traits->green = traits->blue = traits->alpha = 8; traits->depth = 24;
+			traits->pbuffer = true; traits->doubleBuffer = false;
+			gc = osg::GraphicsContext::createGraphicsContext(traits.get());
+			if (!gc.valid()) printf("Could not create an offscreen buffer, drawing to a window\n");
+		}
+		if (gc.valid()) {
+			viewer.getCamera()->setGraphicsContext(gc.get());
+			viewer.getCamera()->setViewport(new osg::Viewport(0, 0, _width, _height));
+			viewer.getCamera()->setDrawBuffer(GL_FRONT); viewer.getCamera()->setReadBuffer(GL_FRONT);
+		} else {
+			viewer.addEventHandler(new osgViewer::WindowSizeHandler());
+			viewer.setUpViewInWindow(100, 100, _width, _height);
+		}
+
+		viewer.setThreadingModel(threadingModel);
+		viewer.setKeyEventSetsDone(0);
+		viewer.addEventHandler(new keyboardEventHandler());
+
+		osg::ref_ptr<osg::Group> root = new osg::Group();
+		viewer.setSceneData(root.get());
+
+	
+		// ----------------------------------------------------------------
+		// Video background
+		// ----------------------------------------------------------------
+		osg::ref_ptr<osg::Camera> bgCamera = new osg::Camera();
+		bgCamera->getOrCreateStateSet()->setRenderBinDetails(0, "RenderBin");
+		bgCamera->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+		bgCamera->setClearMask(GL_DEPTH_BUFFER_BIT);
+		bgCamera->getOrCreateStateSet()->setMode(GL_LIGHTING, GL_FALSE);
+		bgCamera->getOrCreateStateSet()->setMode(GL_DEPTH_TEST, GL_FALSE);
+		bgCamera->setProjectionMatrixAsOrtho2D(0, _width, 0, _height);
+	
+		videoBackground = new VideoBackground(_width, _height);
+		bgCamera->addChild(videoBackground.get());
+		root->addChild(bgCamera.get());
+	
+		// ----------------------------------------------------------------
+		// Foreground 3D content
+		// ----------------------------------------------------------------
+		fgCamera = new osg::Camera();
+		fgCamera->getOrCreateStateSet()->setRenderBinDetails(1, "RenderBin");
+		fgCamera->setReferenceFrame(osg::Transform::ABSOLUTE_RF_INHERIT_VIEWPOINT);
+		fgCamera->setClearMask(GL_DEPTH_BUFFER_BIT);
+		fgCamera->setProjectionMatrix(osg::Matrixf(projMat));
+
+		// Real world occlusion, written into the depth buffer before the models are drawn
+		occlusionPass = new DepthOcclusionPass(_width, _height, projMat);
+		occlusionPass->setNodeMask(0);
+		fgCamera->addChild(occlusionPass.get());
+
+		// Create the Heightfield, its mesh is made once the first height map arrives
+		{
+			HeightFieldTransform = new osg::MatrixTransform();
+			HeightFieldTransform->setDataVariance(osg::Object::DYNAMIC);
+			HeightFieldTransform->setNodeMask(0);
+
+			//Set the Heightfield to be alpha invisible
+			HeightFieldTransform->getOrCreateStateSet()->setMode(GL_BLEND, osg::StateAttribute::ON);
+			HeightFieldTransform->getOrCreateStateSet()->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+
+			//Set up the depth testing for the landscape
+			osg::Depth * depth = new osg::Depth();
+			depth->setWriteMask(true); depth->setFunction(osg::Depth::LEQUAL);
+			HeightFieldTransform->getOrCreateStateSet()->setAttributeAndModes(depth, osg::StateAttribute::ON);
+
+			fgCamera.get()->addChild(HeightFieldTransform);
+		}
+
+		root->addChild(fgCamera.get());
+	}
+
+	~Renderer() {
+		stop();
+		for (int i=0; i<2; i++) if (snapshots[i].frame) cvReleaseImage(&snapshots[i].frame);
+	};
+
+	// Start drawing on the render thread. Models must be added before this.
+	void start() {
+		if (renderThread) return;
+		renderThread = new RenderThread(this);
+		renderThread->start();
+	}
+
+	void stop() {
+		if (renderThread==0) return;
+		renderThread->done = true;
+		renderThread->join();
+		delete renderThread; renderThread = 0;
+	}
+
+	// The marker the Kinect is calibrated against, the heightfield is drawn on its pose. Set before start().
+	void setHeightFieldMarker(string markerName) { heightFieldMarker = markerHandles().get(markerName); }
+
+	// Returns the marker's handle, which indexes arModels
+	int addModel(string markerName, osg::Node *model) {
+		IplImage *markerIm = cvLoadImage(markerName.c_str());
+		int handle = markerHandles().get(markerName);
+		if (handle>=arModels.size()) arModels.resize(handle+1, 0);
+		arModels[handle] = new ARNode(cvGetSize(markerIm), model);
+		cvReleaseImage(&markerIm);
+
+		fgCamera->addChild(arModels[handle]);
+		return handle;
+	}
+
+	// Hand the render thread a new occlusion depth map from DepthReprojector (width x height of the window)
+	void updateDepthMap(const vector<unsigned short> &depthMap) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(snapshotMutex);
+		pendingDepthMap = depthMap;
+	}
+
+	// Hand the render thread a new height map of cols x rows points in marker space, it is shown
+	// relative to the first marker found
+	void updateHeightMap(CvPoint3D32f *ground_grid, int cols, int rows) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(snapshotMutex);
+		pendingHeightMap.assign(ground_grid, ground_grid+cols*rows);
+		pendingHeightCols = cols; pendingHeightRows = rows;
+	}
+
+	// Copy the frame and marker poses for the render thread, which shows them on its next frame
+	// captureTick is when the frame was captured, for timing it to the swap
+	void publish(IplImage* frame_input, vector<MarkerTransform> &mt, osg::Timer_t captureTick = 0) {
+		PROFILE_SCOPE("renderer.publish"); ALLOCATION_SCOPE("renderer.publish");
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(snapshotMutex);
+
+		if (back->frame==0 || back->frame->width!=frame_input->width || back->frame->height!=frame_input->height) {
+			if (back->frame) cvReleaseImage(&back->frame);
+			back->frame = cvCreateImage(cvGetSize(frame_input), frame_input->depth, frame_input->nChannels);
+		}
+		cvCopy(frame_input, back->frame);
+
+		back->poses.resize(mt.size());
+		for (int i=0; i<mt.size(); i++) {
+			back->poses[i].handle = markerHandles().find(mt.at(i).marker.name);
+			memcpy(back->poses[i].transMat, mt.at(i).transMat, 16*sizeof(double));
+		}
+
+		back->publishTime = osg::Timer::instance()->time_s();
+		back->captureTick = captureTick; back->publishTick = osg::Timer::instance()->tick();
+		fresh = true;
+	}
+
+	// Frames per second the render thread draws at most, 0 for as fast as it can
+	void setMaxFrameRate(double rate) { maxFrameRate = rate; }
+
+	// Frames drawn so far
+	int getFrameCount() { return frameCount; }
+
+	// Mean time from a snapshot being published to the end of the frame that drew it
+	double getDisplayLatency() {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(snapshotMutex);
+		return displayLatency;
+	}
+
+private:
+	struct MarkerPose {
+		int handle;
+		double transMat[16];
+	};
+
+	struct Snapshot {
+		Snapshot() { frame = 0; publishTime = 0; captureTick = publishTick = 0; }
+		IplImage *frame;
+		osg::Timer_t captureTick, publishTick;
+		vector<MarkerPose> poses;
+		double publishTime;
+	};
+
+	class RenderThread : public OpenThreads::Thread {
+	public:
+		RenderThread(Renderer *_renderer) { renderer = _renderer; done = false; }
+		virtual void run() { profiler().nameThread("render"); renderer->renderLoop(); }
+		volatile bool done;
+	private:
+		Renderer *renderer;
+	};
+
+	//The render thread only reads front, publish only writes back
+	Snapshot snapshots[2];
+	Snapshot *front, *back;
+	bool fresh;
+	OpenThreads::Mutex snapshotMutex;
+	double displayLatency;
+
+	RenderThread *renderThread;
+	double maxFrameRate;
+	volatile int frameCount;
+
+	void renderLoop() {
+		viewer.realize();
+		int cameraToSwap = profiler().stage("latency.camera_to_swap"), publishToSwap = profiler().stage("latency.publish_to_swap");
+
+		while (!renderThread->done && !viewer.done()) {
+			double frameStart = osg::Timer::instance()->time_s();
+
+			bool newSnapshot = applySnapshot();
+			{
+				PROFILE_SCOPE("render.draw"); ALLOCATION_SCOPE("osg");
+				viewer.frame();
+			}
+
+			//With the draw on its own thread the swap may still be pending, so this is the earliest it could be
+			osg::Timer_t swapTick = osg::Timer::instance()->tick();
+			latencyProbe().frameSwapped(swapTick);
+			if (newSnapshot && profiler().isEnabled()) {
+				if (front->captureTick) profiler().record(cameraToSwap, front->captureTick, swapTick);
+				profiler().record(publishToSwap, front->publishTick, swapTick);
+			}
+
+			double frameEnd = osg::Timer::instance()->time_s();
+			if (newSnapshot) {
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(snapshotMutex);
+				displayLatency = displayLatency*0.9 + (frameEnd-front->publishTime)*0.1;
+			}
+
+			frameCount++;
+
+			//Without vsync, don't draw faster than the display can show
+			double remaining = maxFrameRate>0 ? 1.0/maxFrameRate - (frameEnd-frameStart) : 0;
+			if (remaining>0) OpenThreads::Thread::microSleep((unsigned int)(remaining*1e6));
+		}
+
+		if (viewer.done()) checkKeyPress(27);
+	}
+
+	// Take the newest snapshot, if there is one, and apply it to the scene
+	bool applySnapshot() {
+		PROFILE_SCOPE("render.applySnapshot"); ALLOCATION_SCOPE("osg");
+		bool newSnapshot, newHeightMap = false, newDepthMap = false; int heightCols, heightRows;
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(snapshotMutex);
+			if (pendingDepthMap.size()==_width*_height) {
+				depthMap.swap(pendingDepthMap); pendingDepthMap.clear(); newDepthMap = true;
+			}
+			if (!pendingHeightMap.empty()) {
+				heightMap.swap(pendingHeightMap); pendingHeightMap.clear();
+				heightCols = pendingHeightCols; heightRows = pendingHeightRows; newHeightMap = true;
+			}
+			newSnapshot = fresh;
+			if (fresh) { std::swap(front, back); fresh = false; }
+		}
+
+		if (newDepthMap) {
+			occlusionPass->setDepthMap(&depthMap[0]);
+			occlusionPass->setNodeMask(~0u);
+		}
+
+		if (newHeightMap) {
+			if (!HeightFieldGeode.valid() || HeightFieldGeode->getCols()!=heightCols || HeightFieldGeode->getRows()!=heightRows) {
+				if (HeightFieldGeode.valid()) HeightFieldTransform->removeChild(HeightFieldGeode.get());
+				HeightFieldGeode = new HeightFieldMesh(heightCols, heightRows);
+				HeightFieldGeode->setColour(osg::Vec4(1,1,1,0.5));
+				HeightFieldTransform->addChild(HeightFieldGeode.get());
+				HeightFieldTransform->setNodeMask(~0u);
+			}
+			HeightFieldGeode->update(&heightMap[0]);
+		}
+
+		if (!newSnapshot) return false;
+
+		//Stream the frame into the background texture
+		videoBackground->setFrame(front->frame);
+	
+		//Set the HeightFieldTransform, the heights are in the Kinect's marker space which has z flipped from the marker's frame
+		for (int i=0; i<front->poses.size(); i++) {
+			if (front->poses[i].handle==heightFieldMarker) HeightFieldTransform->setMatrix(osg::Matrixd::scale(1,1,-1)*osg::Matrixd(front->poses[i].transMat));
+		}
+
+		//Only the models shown last frame need hiding
+		for (int i=0; i<visibleModels.size(); i++) {
+			arModels[visibleModels[i]]->setModelVisible(false); arModels[visibleModels[i]]->setBoundaryVisible(false);
+		}
+		visibleModels.clear();
+
+		for (int i = 0; i<front->poses.size(); i++) {
+			int handle = front->poses[i].handle;
+			if (handle<0 || handle>=arModels.size() || arModels[handle]==0) continue;
+
+			//Set up the transform and visibility
+			arModels[handle]->setTransform(front->poses[i].transMat);
+			arModels[handle]->setModelVisible(true);
+			arModels[handle]->setBoundaryVisible(false);
+			visibleModels.push_back(handle);
+		}
+
+		return true;
+	}
+
+	osg::ref_ptr<VideoBackground> videoBackground;
+	osgViewer::Viewer viewer;
+	osg::ref_ptr<osg::Camera> fgCamera;
+
+	//HeightField
+	osg::ref_ptr<HeightFieldMesh> HeightFieldGeode;
+	osg::ref_ptr<osg::MatrixTransform> HeightFieldTransform;
+	int heightFieldMarker;
+	vector<CvPoint3D32f> pendingHeightMap, heightMap;
+	int pendingHeightCols, pendingHeightRows;
+
+	//Occlusion
+	osg::ref_ptr<DepthOcclusionPass> occlusionPass;
+	vector<unsigned short> pendingDepthMap, depthMap;
+
+	//Models indexed by marker handle
+	vector<ARNode*> arModels;
+	vector<int> visibleModels;
+
+	int _width, _height;
+};
+
 #endif
\ No newline at end of file
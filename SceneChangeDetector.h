@@ -0,0 +1,164 @@
+#ifndef SCENECHANGEDETECTOR_H
+#define SCENECHANGEDETECTOR_H
+
+#include <cv.h>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define SCENECHANGE_SSE2
+#endif
+
+#include "MarkerRegistration.h"
+
+// Compares a small luminance thumbnail of each frame against a reference thumbnail. The thumbnail
+// is split into blocks 16 pixels wide, and the scene is considered changed when the mean absolute
+// difference of any block exceeds the threshold, so a hand entering one corner isn't averaged away.
+class SceneChangeDetector {
+public:
+	SceneChangeDetector(float _threshold = 4.0f, int _blockRows = 12) {
+		threshold = _threshold; blockRows = _blockRows;
+		small = 0; thumb = 0; reference = 0; hasReference = false;
+		lastDifference = 0;
+	}
+
+	~SceneChangeDetector() {
+		if (small) cvReleaseImage(&small);
+		if (thumb) cvReleaseImage(&thumb);
+		if (reference) cvReleaseImage(&reference);
+	}
+
+	// Builds the thumbnail for frame_input and returns true if it differs from the reference
+	bool hasChanged(IplImage *frame_input) {
+		makeThumbnail(frame_input);
+		if (!hasReference) return true;
+
+		lastDifference = maxBlockDifference(thumb, reference);
+		return lastDifference > threshold;
+	}
+
+	// Make the thumbnail of the last frame passed to hasChanged the new reference
+	void setReference() {
+		cvCopy(thumb, reference); hasReference = true;
+	}
+
+	void reset() { hasReference = false; }
+
+	float getLastDifference() { return lastDifference; }
+	void setThreshold(float _threshold) { threshold = _threshold; }
+
+private:
+	IplImage *small, *thumb, *reference;
+	bool hasReference;
+	float threshold, lastDifference;
+	int blockRows;
+
+	static const int thumbWidth = 80, thumbHeight = 60;
+
+	void makeThumbnail(IplImage *frame_input) {
+		if (thumb==0) {
+			thumb = cvCreateImage(cvSize(thumbWidth, thumbHeight), IPL_DEPTH_8U, 1);
+			reference = cvCreateImage(cvSize(thumbWidth, thumbHeight), IPL_DEPTH_8U, 1);
+		}
+		if (frame_input->nChannels==1) {
+			cvResize(frame_input, thumb, CV_INTER_AREA);
+		} else {
+			if (small==0 || small->nChannels!=frame_input->nChannels) {
+				if (small) cvReleaseImage(&small);
+				small = cvCreateImage(cvSize(thumbWidth, thumbHeight), IPL_DEPTH_8U, frame_input->nChannels);
+			}
+			cvResize(frame_input, small, CV_INTER_AREA);
+			cvCvtColor(small, thumb, CV_BGR2GRAY);
+		}
+	}
+
+	// Largest mean absolute difference of the 16 x blockRows pixel blocks
+	float maxBlockDifference(IplImage *a, IplImage *b) {
+		const int blocksX = thumbWidth/16;
+		unsigned int blockSum[thumbWidth/16];
+		unsigned int maxSum = 0;
+
+		for (int by=0; by<thumbHeight; by+=blockRows) {
+			for (int bx=0; bx<blocksX; bx++) blockSum[bx] = 0;
+			int rows = MIN(blockRows, thumbHeight-by);
+
+			for (int y=by; y<by+rows; y++) {
+				const unsigned char *rowA = (const unsigned char*)(a->imageData + y*a->widthStep);
+				const unsigned char *rowB = (const unsigned char*)(b->imageData + y*b->widthStep);
+				for (int bx=0; bx<blocksX; bx++) blockSum[bx] += sad16(rowA + bx*16, rowB + bx*16);
+			}
+
+			for (int bx=0; bx<blocksX; bx++) {
+				if (blockSum[bx]>maxSum) maxSum = blockSum[bx];
+			}
+		}
+
+		return float(maxSum)/float(16*blockRows);
+	}
+
+	// Sum of absolute differences of 16 bytes
+	static inline unsigned int sad16(const unsigned char *a, const unsigned char *b) {
+#ifdef SCENECHANGE_SSE2
+		__m128i sad = _mm_sad_epu8(_mm_loadu_si128((const __m128i*)a), _mm_loadu_si128((const __m128i*)b));
+		return _mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4);
+#else
+		unsigned int sum = 0;
+		for (int i=0; i<16; i++) sum += a[i]>b[i] ? a[i]-b[i] : b[i]-a[i];
+		return sum;
+#endif
+	}
+};
+
+// Reuses the previous registration result while the scene hasn't visibly changed since the last
+// frame that was registered, counting the frames skipped.
+class StaticSceneRegistration : public MarkerRegistration {
+public:
+	StaticSceneRegistration(MarkerRegistration *_reg, float threshold = 4.0f) : detector(threshold) {
+		reg = _reg; frameCount = 0; skipCount = 0;
+	}
+
+	~StaticSceneRegistration() {
+		clearMarkerTransforms(lastResult);
+		delete reg;
+	}
+
+	std::vector<MarkerTransform> performRegistration(IplImage *frame_input, CvMat *captureParams, CvMat *captureDistortion) {
+		frameCount++;
+
+		if (!detector.hasChanged(frame_input)) {
+			skipCount++;
+		} else {
+			clearMarkerTransforms(lastResult);
+			lastResult = reg->performRegistration(frame_input, captureParams, captureDistortion);
+			detector.setReference();
+		}
+
+		std::vector<MarkerTransform> retVal;
+		for (int i=0; i<lastResult.size(); i++) retVal.push_back(copyMarkerTransform(lastResult.at(i)));
+		return retVal;
+	}
+
+	void addResizedMarker(std::string markerName, int maxLengthSize) {
+		detector.reset(); reg->addResizedMarker(markerName, maxLengthSize);
+	}
+
+	void addResizedScaledMarker(std::string markerName, int maxLengthSize, int maxLengthScale) {
+		detector.reset(); reg->addResizedScaledMarker(markerName, maxLengthSize, maxLengthScale);
+	}
+
+	void removeMarker(std::string markerName) {
+		detector.reset(); clearMarkerTransforms(lastResult); reg->removeMarker(markerName);
+	}
+
+	int getFrameCount() { return frameCount; }
+	int getSkipCount() { return skipCount; }
+	SceneChangeDetector *getDetector() { return &detector; }
+
+private:
+	MarkerRegistration *reg;
+	SceneChangeDetector detector;
+	std::vector<MarkerTransform> lastResult;
+	int frameCount, skipCount;
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include <float.h>
+#include <math.h>
+#include <vector>
+
+// A uniform grid over an area of the marker plane, indexing items by their x, y position. Each cell
+// keeps a doubly linked list threaded through per item arrays, so insert, move and remove are O(1)
+// and a move within the same cell only updates the position. Items outside the area are kept in the
+// nearest edge cell, queries always test the true distance.
+class SpatialGrid {
+public:
+	SpatialGrid(float _minX, float _minY, float _maxX, float _maxY, float _cellSize) {
+		minX = _minX; minY = _minY; cellSize = _cellSize; invCellSize = 1.0f/cellSize;
+		cols = MAX(1, (int)ceil((_maxX-minX)*invCellSize)); rows = MAX(1, (int)ceil((_maxY-minY)*invCellSize));
+		head.assign(cols*rows, -1);
+		count = 0;
+	}
+
+	int getCols() { return cols; }
+	int getRows() { return rows; }
+	float getCellSize() { return cellSize; }
+	int size() { return count; }
+
+	// Items are identified by their index, typically the same as in the arrays of state they describe
+	void insert(int id, float x, float y) {
+		if (id>=cell.size()) {
+			cell.resize(id+1, -1); next.resize(id+1, -1); prev.resize(id+1, -1);
+			posX.resize(id+1); posY.resize(id+1);
+		}
+		if (cell[id]>=0) { move(id, x, y); return; }
+		posX[id] = x; posY[id] = y;
+		link(id, cellOf(x, y));
+		count++;
+	}
+
+	void move(int id, float x, float y) {
+		posX[id] = x; posY[id] = y;
+		int c = cellOf(x, y);
+		if (c==cell[id]) return;
+		unlink(id); link(id, c);
+	}
+
+	void remove(int id) {
+		if (id>=cell.size() || cell[id]<0) return;
+		unlink(id); cell[id] = -1;
+		count--;
+	}
+
+	void clear() {
+		head.assign(cols*rows, -1);
+		cell.clear(); next.clear(); prev.clear(); posX.clear(); posY.clear();
+		count = 0;
+	}
+
+	// Moves items 0 to n-1 to the given positions, inserting any not yet indexed
+	void update(const float *x, const float *y, int n) {
+		for (int i=0; i<n; i++) {
+			if (i<cell.size() && cell[i]>=0) move(i, x[i], y[i]); else insert(i, x[i], y[i]);
+		}
+		for (int i=n; i<cell.size(); i++) remove(i);
+	}
+
+	// Items within radius of (x, y), appended to results. Skip is left out, for excluding the item queried from.
+	void queryRadius(float x, float y, float radius, std::vector<int> &results, int skip = -1) {
+		int c0, r0, c1, r1;
+		cellRange(x-radius, y-radius, c0, r0); cellRange(x+radius, y+radius, c1, r1);
+		float r2 = radius*radius;
+		for (int r=r0; r<=r1; r++) {
+			for (int c=c0; c<=c1; c++) {
+				for (int i=head[r*cols+c]; i>=0; i=next[i]) {
+					float dx = posX[i]-x, dy = posY[i]-y;
+					if (dx*dx+dy*dy<=r2 && i!=skip) results.push_back(i);
+				}
+			}
+		}
+	}
+
+	// Radius queries for n points in one call. The results of query q are results[offsets[q]] to
+	// results[offsets[q+1]-1]. With excludeSelf, query q is taken to be item q and doesn't find itself.
+	void queryRadius(const float *x, const float *y, int n, float radius, std::vector<int> &offsets, std::vector<int> &results, bool excludeSelf = false) {
+		offsets.resize(n+1); results.clear();
+		for (int q=0; q<n; q++) {
+			offsets[q] = results.size();
+			queryRadius(x[q], y[q], radius, results, excludeSelf ? q : -1);
+		}
+		offsets[n] = results.size();
+	}
+
+	// The k nearest items to (x, y), nearest first, written to nearest (k entries, -1 where there are fewer items)
+	void queryNearest(float x, float y, int k, int *nearest, int skip = -1) {
+		bestDist.assign(k, FLT_MAX);
+		for (int j=0; j<k; j++) nearest[j] = -1;
+
+		//Search rings of cells outwards until the ring can't hold anything nearer than the kth so far
+		int qc, qr; cellRange(x, y, qc, qr);
+		int maxRing = MAX(cols, rows);
+		for (int ring=0; ring<=maxRing; ring++) {
+			if (nearest[k-1]>=0) {
+				float reach = (ring-1)*cellSize;
+				if (reach>0 && reach*reach>bestDist[k-1]) break;
+			}
+			for (int r=qr-ring; r<=qr+ring; r++) {
+				if (r<0 || r>=rows) continue;
+				bool edgeRow = r==qr-ring || r==qr+ring;
+				for (int c=qc-ring; c<=qc+ring; c += edgeRow ? 1 : 2*ring) {
+					if (c>=0 && c<cols) {
+						for (int i=head[r*cols+c]; i>=0; i=next[i]) {
+							if (i==skip) continue;
+							float dx = posX[i]-x, dy = posY[i]-y, d = dx*dx+dy*dy;
+							if (d>=bestDist[k-1]) continue;
+							int j = k-1;
+							while (j>0 && bestDist[j-1]>d) { bestDist[j] = bestDist[j-1]; nearest[j] = nearest[j-1]; j--; }
+							bestDist[j] = d; nearest[j] = i;
+						}
+					}
+					if (ring==0) break;
+				}
+			}
+		}
+	}
+
+	// k nearest queries for n points, query q's neighbours are nearest[q*k] to nearest[q*k+k-1]
+	void queryNearest(const float *x, const float *y, int n, int k, std::vector<int> &nearest, bool excludeSelf = false) {
+		nearest.resize(n*k);
+		for (int q=0; q<n; q++) queryNearest(x[q], y[q], k, &nearest[q*k], excludeSelf ? q : -1);
+	}
+
+private:
+	float minX, minY, cellSize, invCellSize;
+	int cols, rows, count;
+
+	std::vector<int> head;
+	std::vector<int> cell, next, prev;
+	std::vector<float> posX, posY;
+	std::vector<float> bestDist;
+
+	inline void cellRange(float x, float y, int &c, int &r) {
+		c = (int)floor((x-minX)*invCellSize); r = (int)floor((y-minY)*invCellSize);
+		c = MIN(MAX(c, 0), cols-1); r = MIN(MAX(r, 0), rows-1);
+	}
+
+	inline int cellOf(float x, float y) {
+		int c, r; cellRange(x, y, c, r);
+		return r*cols + c;
+	}
+
+	inline void link(int id, int c) {
+		cell[id] = c; prev[id] = -1; next[id] = head[c];
+		if (head[c]>=0) prev[head[c]] = id;
+		head[c] = id;
+	}
+
+	inline void unlink(int id) {
+		if (prev[id]>=0) next[prev[id]] = next[id]; else head[cell[id]] = next[id];
+		if (next[id]>=0) prev[next[id]] = prev[id];
+	}
+};
+
+#endif
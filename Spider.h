@@ -1,176 +1,313 @@
-#ifndef SPIDER_H
-#define SPIDER_H
-
-#include <osgDB/ReadFile>
-#include <osg/Sequence>
-#include <osg/PositionAttitudeTransform>
-#include "tinyxml.h"
-#include "global.h"
-
-template <typename T>
-class CollectTypeNodeVisitor : public osg::NodeVisitor {
-protected:
-	osg::NodeList mCollectedNodes;
-
-public:
-	CollectTypeNodeVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) { }
-    
-    virtual void apply(osg::Node& node) {
-		if (T t = dynamic_cast< T >(&node)) {
-			mCollectedNodes.push_back(&node);
-		}
-		traverse(node);
-    }
-
-	inline const osg::NodeList& getCollectedNodes() { return mCollectedNodes; }
-};
-
-class AnimationSequenceCallback : public osg::NodeCallback 
-{
-public:
-	void setValues(int _endVal) { endVal = _endVal; loop = false; }
-	void setValues(int _startVal, int _endVal) { endVal = _endVal; startVal = _startVal; loop = true; }
-
-   virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
-   {
-	  osg::ref_ptr<osg::Sequence> seq = dynamic_cast<osg::Sequence*> (node);
-	  if(seq->getValue() >= endVal)
-		  if (loop) { seq->setValue(startVal); } else { seq->setValue(endVal); }
-
-	  traverse(node, nv); 
-   }
-
-private:
-	int endVal, startVal;
-	bool loop;
-};
-
-class Spider {
-public:
-	Spider(char *modelFile, char *animationFile) {
-		model = osgDB::readNodeFile(modelFile);
-		osg::PositionAttitudeTransform *scale = new osg::PositionAttitudeTransform(); scale->setScale(osg::Vec3(0.4,0.4,0.4)); scale->addChild(model);
-		transform = new osg::PositionAttitudeTransform(); transform->addChild(scale);
-		
-		// Get Animation Nodes and apply callback
-		CollectTypeNodeVisitor<osg::Sequence*> ctnv; aniSeqCB = new AnimationSequenceCallback();
-		model->accept(ctnv); animationNodes = ctnv.getCollectedNodes();
-		for (osg::NodeList::iterator iter = animationNodes.begin(); iter != animationNodes.end(); iter++)
-			if (osg::Sequence* seq = dynamic_cast<osg::Sequence*>((*iter).get()))
-				seq->addUpdateCallback(aniSeqCB);
-
-		readXML(animationFile);
-		setAnimation(0);
-		lX=lY=lZ=0; lAng = 0; 
-		aniPathCB = new SpiderAnimationPathCallback(this); _isAnimating = false;
-	}
-
-	~Spider() {}
-
-	osg::Node* getModel() {
-		return transform;
-	}
-
-	void setPosition(float x, float y, float z) {
-		transform->setPosition(osg::Vec3d(x,y,z));
-	}
-
-	osg::Vec3 getPosition() {
-		return transform->getPosition();
-	}
-
-	bool isAnimating() {
-		return _isAnimating;
-	}
-
-	void moveTo(float x, float y, float z) {
-		float ang = atan2(lY-y, lX-x)-osg::PI_2;
-		_isAnimating = true; aniPathCB->reset();
-		aniPathCB->setAnimationPath(createAnimationPath(osg::Vec3(lX, lY, lZ), lAng, osg::Vec3(x, y, z), ang));
-		transform->setUpdateCallback(aniPathCB);
-		setAnimation(2);
-		
-		lX = x; lY=y; lZ=z; lAng = ang;
-	}
-
-	void setAnimation(int index) {
-		aniSeqCB->setValues(Animations.at(index).start, Animations.at(index).end);
-
-		for (osg::NodeList::iterator iter = animationNodes.begin(); iter != animationNodes.end(); iter++)
-			if (osg::Sequence* seq = dynamic_cast<osg::Sequence*>((*iter).get())) {
-				seq->setValue(Animations.at(index).start);
-			}
-	}
-
-	bool _isAnimating;
-private:
-	osg::Node *model;
-	osg::PositionAttitudeTransform *transform;
-
-	AnimationSequenceCallback *aniSeqCB;
-	osg::NodeList animationNodes;
-
-	osg::AnimationPathCallback *aniPathCB;
-	
-
-	float lX, lY, lZ, lAng;
-
-	struct Animation {
-		Animation() {}
-		Animation(std::string _name, int _start, int _end) {name = _name; start = _start; end = _end; }
-		std::string name;
-		int start, end;
-	};
-	std::vector <Animation> Animations;
-
-	class SpiderAnimationPathCallback: public osg::AnimationPathCallback
-	{
-	public:
-		SpiderAnimationPathCallback(Spider *_s) {spider = _s;}
-
-		void SpiderAnimationPathCallback::operator() (osg::Node *node, osg::NodeVisitor *nv){ 
-			osg::AnimationPathCallback::operator()(node,nv); // Call Original Method
-			if (this->getAnimationTime()> this->getAnimationPath()->getLastTime()) {
-				spider->setAnimation(0); spider->_isAnimating = false;
-			}
-			float z=getSpiderHeight();
-			if (z>500) z = lastZ;
-			osg::Vec3 p= spider->getPosition();
-			spider->setPosition(p.x(),p.y(), z);
-			lastZ = z;
-		}
-
-	private:
-		Spider *spider;
-		int lastZ;
-	};
-
-	void readXML(char *filename) {
-		TiXmlDocument doc( filename ); doc.LoadFile();
-
-		TiXmlElement* animation = doc.FirstChildElement();
-
-		while (animation) {
-			Animations.push_back(Animation(animation->Attribute("name"), atoi(animation->Attribute("start")), atoi(animation->Attribute("end"))));
-			animation = animation->NextSiblingElement();
-		}
-	}
-
-	osg::AnimationPath* createAnimationPath(osg::Vec3 begin, float lAng, osg::Vec3 end, float ang)
-	{
-		// set up the animation path 
-		osg::AnimationPath* animationPath = new osg::AnimationPath;
-		animationPath->setLoopMode(osg::AnimationPath::LoopMode::NO_LOOPING);
-		
-		float dist = sqrt((begin.x()-end.x())*(begin.x()-end.x())+(begin.y()-end.y())*(begin.y()-end.y()));
-		animationPath->insert(0.0,osg::AnimationPath::ControlPoint(begin, osg::Quat(lAng, osg::Vec3f(0,0,1))));
-		animationPath->insert(abs(ang-lAng)/2.0,osg::AnimationPath::ControlPoint(begin, osg::Quat(ang, osg::Vec3f(0,0,1))));
-		animationPath->insert(abs(ang-lAng)/2.0+dist/8.0,osg::AnimationPath::ControlPoint(end, osg::Quat(ang, osg::Vec3f(0,0,1))));
-		
-		return animationPath;    
-	}
-
-
-};
-
+#ifndef SPIDER_H
+#define SPIDER_H
+
+#include <osgDB/ReadFile>
+#include <osg/Sequence>
+#include <osg/PositionAttitudeTransform>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include "tinyxml.h"
+#include "GroundHeightMap.h"
+#include "Latency.h"
+#include "AllocationTracker.h"
+
+template <typename T>
+class CollectTypeNodeVisitor : public osg::NodeVisitor {
+protected:
+	osg::NodeList mCollectedNodes;
+
+public:
+	CollectTypeNodeVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) { }
+    
+    virtual void apply(osg::Node& node) {
+		if (T t = dynamic_cast< T >(&node)) {
+			mCollectedNodes.push_back(&node);
+		}
+		traverse(node);
+    }
+
+	inline const osg::NodeList& getCollectedNodes() { return mCollectedNodes; }
+};
+
+class AnimationSequenceCallback : public osg::NodeCallback 
+{
+public:
+	void setValues(int _endVal) { endVal = _endVal; loop = false; }
+	void setValues(int _startVal, int _endVal) { endVal = _endVal; startVal = _startVal; loop = true; }
+
+   virtual void operator()(osg::Node* node, osg::NodeVisitor* nv)
+   {
+	  //Only ever attached to sequences
+	  osg::Sequence *seq = static_cast<osg::Sequence*> (node);
+	  if(seq->getValue() >= endVal)
+		  if (loop) { seq->setValue(startVal); } else { seq->setValue(endVal); }
+
+	  traverse(node, nv); 
+   }
+
+private:
+	int endVal, startVal;
+	bool loop;
+};
+
+// A named range of frames of the spider's animation sequence, as listed in media/animations.xml
+struct AnimationClip {
+	AnimationClip() {}
+	AnimationClip(std::string _name, int _start, int _end) {name = _name; start = _start; end = _end; }
+	std::string name;
+	int start, end;
+};
+
+inline std::vector<AnimationClip> readAnimationClips(const char *filename) {
+	std::vector<AnimationClip> clips;
+	TiXmlDocument doc( filename ); doc.LoadFile();
+
+	TiXmlElement* animation = doc.FirstChildElement();
+
+	while (animation) {
+		clips.push_back(AnimationClip(animation->Attribute("name"), atoi(animation->Attribute("start")), atoi(animation->Attribute("end"))));
+		animation = animation->NextSiblingElement();
+	}
+	return clips;
+}
+
+class Spider {
+public:
+	Spider(const char *modelFile, const char *animationFile) {
+		init(osgDB::readNodeFile(modelFile), animationFile);
+	}
+
+	// A spider drawn with an already loaded model
+	Spider(osg::Node *_model, const char *animationFile) {
+		init(_model, animationFile);
+	}
+
+	~Spider() {}
+
+	osg::Node* getModel() {
+		return root;
+	}
+
+	// Thread safe versions of moveTo, setAnimation, getPosition and isAnimating for use off the render
+	// thread. Requests are applied on the next update traversal and the state is that of the last one.
+	// Stamp is when the target was sensed, for timing the spider's reaction to it
+	void requestMoveTo(float x, float y, float z, osg::Timer_t stamp = 0) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(stateMutex);
+		moveRequested = true; moveWaypoints.assign(1, osg::Vec3(x, y, z)); moveStamp = stamp;
+		publishedAnimating = true;
+	}
+
+	// Walks through each waypoint in turn, turning towards the next as it reaches each one
+	void requestMoveAlong(const std::vector<osg::Vec3> &waypoints, osg::Timer_t stamp = 0) {
+		if (waypoints.empty()) return;
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(stateMutex);
+		moveRequested = true; moveWaypoints.assign(waypoints.begin(), waypoints.end()); moveStamp = stamp;
+		publishedAnimating = true;
+	}
+
+	void requestAnimation(int index) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(stateMutex);
+		requestedAnimation = index;
+	}
+
+	void getState(osg::Vec3 &position, bool &animating) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(stateMutex);
+		position = publishedPosition; animating = publishedAnimating;
+	}
+
+	// The spider follows the height of the surface under it
+	void setGroundHeightMap(GroundHeightMap *_ground) { ground = _ground; }
+
+	void setPosition(float x, float y, float z) {
+		lX = x; lY = y; lZ = z;
+		transform->setPosition(osg::Vec3d(x,y,z));
+	}
+
+	osg::Vec3 getPosition() {
+		return transform->getPosition();
+	}
+
+	bool isAnimating() {
+		return _isAnimating;
+	}
+
+	// Heads for a new target from wherever the spider is now, it can be called every frame to follow a moving target
+	void moveTo(float x, float y, float z, osg::Timer_t stamp = 0) {
+		targets.resize(1); targets[0].set(x, y, z);
+		targetIndex = 0; _isAnimating = true; targetStamp = stamp;
+	}
+
+	// Walks through each waypoint in turn, replacing any it was walking through
+	void moveAlong(const std::vector<osg::Vec3> &waypoints, osg::Timer_t stamp = 0) {
+		if (waypoints.empty()) return;
+		targets.assign(waypoints.begin(), waypoints.end());
+		targetIndex = 0; _isAnimating = true; targetStamp = stamp;
+	}
+
+	// Top walking speed in marker units per second, top turning speed in radians per second, and the
+	// tightest turn taken while walking. Sharper turns than that are made on the spot.
+	void setMotionLimits(float _maxSpeed, float _maxTurnRate, float _minTurnRadius) {
+		maxSpeed = _maxSpeed; maxTurnRate = _maxTurnRate; minTurnRadius = _minTurnRadius;
+	}
+
+	void setAnimation(int index) {
+		aniSeqCB->setValues(Animations.at(index).start, Animations.at(index).end);
+
+		for (osg::NodeList::iterator iter = animationNodes.begin(); iter != animationNodes.end(); iter++)
+			if (osg::Sequence* seq = dynamic_cast<osg::Sequence*>((*iter).get())) {
+				seq->setValue(Animations.at(index).start);
+			}
+	}
+
+	bool _isAnimating;
+private:
+	void init(osg::Node *_model, const char *animationFile) {
+		model = _model;
+		osg::PositionAttitudeTransform *scale = new osg::PositionAttitudeTransform(); scale->setScale(osg::Vec3(0.4,0.4,0.4)); scale->addChild(model);
+		transform = new osg::PositionAttitudeTransform(); transform->addChild(scale);
+		transform->setDataVariance(osg::Object::DYNAMIC);
+		
+		// Get Animation Nodes and apply callback
+		CollectTypeNodeVisitor<osg::Sequence*> ctnv; aniSeqCB = new AnimationSequenceCallback();
+		model->accept(ctnv); animationNodes = ctnv.getCollectedNodes();
+		for (osg::NodeList::iterator iter = animationNodes.begin(); iter != animationNodes.end(); iter++)
+			if (osg::Sequence* seq = dynamic_cast<osg::Sequence*>((*iter).get())) {
+				seq->addUpdateCallback(aniSeqCB); seq->setDataVariance(osg::Object::DYNAMIC);
+			}
+
+		Animations = readAnimationClips(animationFile);
+		setAnimation(0);
+		lX=lY=lZ=0; lAng = 0; ground = 0;
+		setMotionLimits(8, 2, 10);
+		targetIndex = 0; _isAnimating = walking = false;
+		transform->setUpdateCallback(new SpiderMotionCallback(this));
+
+		//The root publishes the spider's state for other threads and applies their move requests
+		root = new osg::Group(); root->addChild(transform);
+		root->setUpdateCallback(new SpiderStateCallback(this));
+		moveRequested = false; publishedAnimating = false; requestedAnimation = -1; moveStamp = targetStamp = 0;
+	}
+
+	osg::Node *model;
+	osg::PositionAttitudeTransform *transform;
+	osg::ref_ptr<osg::Group> root;
+
+	OpenThreads::Mutex stateMutex;
+	bool moveRequested, publishedAnimating;
+	int requestedAnimation;
+	std::vector<osg::Vec3> moveWaypoints;
+	osg::Timer_t moveStamp;
+	osg::Vec3 publishedPosition;
+
+	class SpiderStateCallback : public osg::NodeCallback {
+	public:
+		SpiderStateCallback(Spider *_s) { spider = _s; }
+
+		virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
+			PROFILE_SCOPE("spider.state"); ALLOCATION_SCOPE("spider");
+			bool move = false; int animation; osg::Timer_t stamp;
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(spider->stateMutex);
+				move = spider->moveRequested; spider->moveRequested = false; stamp = spider->moveStamp;
+				if (move) waypoints.swap(spider->moveWaypoints);
+				animation = spider->requestedAnimation; spider->requestedAnimation = -1;
+			}
+			if (move) spider->moveAlong(waypoints, stamp);
+			if (animation>=0) spider->setAnimation(animation);
+
+			traverse(node, nv);
+
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(spider->stateMutex);
+			spider->publishedPosition = spider->getPosition();
+			spider->publishedAnimating = spider->_isAnimating || spider->moveRequested;
+		}
+
+	private:
+		Spider *spider;
+		std::vector<osg::Vec3> waypoints;
+	};
+
+	AnimationSequenceCallback *aniSeqCB;
+	osg::NodeList animationNodes;
+
+	float lX, lY, lZ, lAng;
+	GroundHeightMap *ground;
+
+	std::vector<osg::Vec3> targets;
+	int targetIndex;
+	osg::Timer_t targetStamp;
+	bool walking;
+	float maxSpeed, maxTurnRate, minTurnRadius;
+
+	std::vector <AnimationClip> Animations;
+
+	// Steps the spider towards its current target by dt seconds. While walking it moves along an arc of
+	// constant curvature for the step, so the pose is exact for any dt and the turn never gets tighter
+	// than minTurnRadius. A target too far round to reach that way is turned to on the spot first.
+	void step(double dt) {
+		if (!_isAnimating || dt<=0) return;
+
+		//The model faces -y, so it walks in the direction lAng-90 degrees
+		float dir = lAng - osg::PI_2;
+		osg::Vec3 target = targets[targetIndex];
+		float dx = target.x()-lX, dy = target.y()-lY, dist = sqrt(dx*dx+dy*dy);
+		bool last = targetIndex==targets.size()-1;
+		if (dist<(last ? 1.0f : minTurnRadius)) {
+			if (!last) { targetIndex++; return; }
+			if (walking) setAnimation(0);
+			_isAnimating = walking = false;
+			return;
+		}
+		if (!walking) { walking = true; setAnimation(2); }
+
+		float error = atan2(dy, dx) - dir;
+		error -= 2*osg::PI*floor((error+osg::PI)/(2*osg::PI));
+
+		float speed = 0, turn;
+		if (fabs(error)>osg::PI_4) {
+			turn = error>0 ? maxTurnRate : -maxTurnRate;
+		} else {
+			//Slow down for the final target, and turn no sharper than the turning circle allows at this speed
+			speed = last ? MIN(maxSpeed, dist) : maxSpeed;
+			turn = MIN(MAX(error*4, -speed/minTurnRadius), speed/minTurnRadius);
+			turn = MIN(MAX(turn, -maxTurnRate), maxTurnRate);
+		}
+		if (fabs(turn*dt)>fabs(error)) turn = error/dt;
+
+		float turned = turn*dt;
+		if (fabs(turned)>1e-5f) {
+			float radius = speed/turn;
+			lX += radius*(sin(dir+turned)-sin(dir)); lY -= radius*(cos(dir+turned)-cos(dir));
+		} else {
+			lX += speed*dt*cos(dir); lY += speed*dt*sin(dir);
+		}
+		lAng += turned;
+
+		//The spider reacts to a newly sensed target once it walks towards it, not while it turns on the spot to face it
+		if (targetStamp && speed>0) { latencyProbe().reacted(targetStamp); targetStamp = 0; }
+	}
+
+	class SpiderMotionCallback : public osg::NodeCallback {
+	public:
+		SpiderMotionCallback(Spider *_s) { spider = _s; lastTime = -1; }
+
+		virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
+			PROFILE_SCOPE("spider.motion"); ALLOCATION_SCOPE("spider");
+			double time = nv->getFrameStamp() ? nv->getFrameStamp()->getSimulationTime() : 0;
+			//Don't leap across the marker after a stall
+			if (lastTime>=0) spider->step(MIN(time-lastTime, 0.1));
+			lastTime = time;
+
+			if (spider->ground) spider->lZ = spider->ground->getHeight(spider->lX, spider->lY);
+			spider->transform->setPosition(osg::Vec3d(spider->lX, spider->lY, spider->lZ));
+			spider->transform->setAttitude(osg::Quat(spider->lAng, osg::Vec3f(0,0,1)));
+			traverse(node, nv);
+		}
+
+	private:
+		Spider *spider;
+		double lastTime;
+	};
+};
+
 #endif
\ No newline at end of file
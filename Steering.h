@@ -0,0 +1,278 @@
+#ifndef STEERING_H
+#define STEERING_H
+
+#include <math.h>
+#include <vector>
+
+#include <osg/Math>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include "ThreadPool.h"
+#include "SpatialGrid.h"
+#include "Profiler.h"
+#include "AllocationTracker.h"
+
+// Steering for a crowd of agents on the marker plane, stepped at a fixed timestep. Every agent seeks
+// a shared target, flees the hand when it comes near, keeps apart from its neighbours, wanders, and is
+// pushed back when it leaves the area. State is kept as parallel arrays and each step is split across
+// a thread pool. It can run on its own thread at its own rate, publishing the agents' positions and
+// headings for the renderer to pick up.
+class CrowdSimulation {
+public:
+	struct Params {
+		Params() {
+			maxSpeed = 60; maxForce = 240;
+			separationRadius = 20; fleeRadius = 120; arriveRadius = 80;
+			wanderDistance = 30; wanderRadius = 15; wanderJitter = 3;
+			seekWeight = 1; fleeWeight = 4; separationWeight = 3; wanderWeight = 1; containWeight = 4;
+		}
+		float maxSpeed, maxForce;
+		float separationRadius, fleeRadius, arriveRadius;
+		float wanderDistance, wanderRadius, wanderJitter;
+		float seekWeight, fleeWeight, separationWeight, wanderWeight, containWeight;
+	};
+
+	CrowdSimulation(const float *startX, const float *startY, int _count, float _minX, float _minY, float _maxX, float _maxY,
+		float agentRadius, double _timestep = 1.0/60.0, int threads = 0) : grid(_minX, _minY, _maxX, _maxY, 2*agentRadius), pool(threads)
+	{
+		count = _count; timestep = _timestep; accumulator = 0;
+		minX = _minX; minY = _minY; maxX = _maxX; maxY = _maxY;
+		params.separationRadius = 2*agentRadius;
+
+		x.assign(startX, startX+count); y.assign(startY, startY+count);
+		vx.assign(count, 0); vy.assign(count, 0); nvx.assign(count, 0); nvy.assign(count, 0);
+		heading.assign(count, 0); speed.assign(count, 0);
+		wanderAngle.resize(count); seeds.resize(count);
+		for (int i=0; i<count; i++) { seeds[i] = 2463534242u + 7919u*i; wanderAngle[i] = 2*osg::PI*random(seeds[i]); }
+		if (count>0) grid.update(&x[0], &y[0], count);
+
+		publishedX = x; publishedY = y; publishedHeading = heading; publishedSpeed = speed;
+		hasTarget = hasHand = hasBounds = false;
+		thread = 0;
+	}
+
+	~CrowdSimulation() { stop(); }
+
+	int size() { return count; }
+	Params &getParams() { return params; }
+	double getTimestep() { return timestep; }
+
+	// Inputs, safe to set from any thread, taken at the start of each step
+	void setTarget(float tx, float ty) { OpenThreads::ScopedLock<OpenThreads::Mutex> lock(inputMutex); target.set(tx, ty); hasTarget = true; }
+	void clearTarget() { OpenThreads::ScopedLock<OpenThreads::Mutex> lock(inputMutex); hasTarget = false; }
+	void setHand(float hx, float hy) { OpenThreads::ScopedLock<OpenThreads::Mutex> lock(inputMutex); hand.set(hx, hy); hasHand = true; }
+	void clearHand() { OpenThreads::ScopedLock<OpenThreads::Mutex> lock(inputMutex); hasHand = false; }
+
+	// Moves the area agents are kept to, each agent keeping its relative place in it. Taken at the start of the next step.
+	void setBounds(float _minX, float _minY, float _maxX, float _maxY) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(inputMutex);
+		bounds[0] = _minX; bounds[1] = _minY; bounds[2] = _maxX; bounds[3] = _maxY; hasBounds = true;
+	}
+
+	// Which of the first n agents can see the hand, only those flee it. All of them can until this is set.
+	void setHandVisibility(const unsigned char *visible, int n) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(inputMutex);
+		handVisible.assign(visible, visible+MIN(n, count));
+	}
+
+	// Runs as many fixed steps as fit in dt and publishes the result, for driving from another loop
+	void advance(double dt) {
+		//Don't try to catch up on more than a few steps after a stall
+		accumulator = MIN(accumulator+dt, 4*timestep);
+		bool stepped = false;
+		while (accumulator>=timestep) { step(); accumulator -= timestep; stepped = true; }
+		if (stepped) publish();
+	}
+
+	// One fixed timestep of every agent
+	void step() {
+		PROFILE_SCOPE("crowd.step"); ALLOCATION_SCOPE("crowd");
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(inputMutex);
+			stepTarget = target; stepHasTarget = hasTarget;
+			stepHand = hand; stepHasHand = hasHand;
+			stepHandVisible.assign(handVisible.begin(), handVisible.end());
+			if (hasBounds) { applyBounds(bounds[0], bounds[1], bounds[2], bounds[3]); hasBounds = false; }
+		}
+
+		//Forces only read positions, so agents can be split across threads, then integrated the same way
+		int chunks = pool.getThreadCount()*4;
+		if (scratch.size()<chunks) scratch.resize(chunks);
+		SteerJob steer(this, chunks); pool.parallelFor(chunks, &steer);
+		IntegrateJob integrate(this, chunks); pool.parallelFor(chunks, &integrate);
+		if (count>0) grid.update(&x[0], &y[0], count);
+	}
+
+	// Starts stepping on a thread of its own in real time
+	void start() {
+		if (thread) return;
+		thread = new SimulationThread(this);
+		thread->start();
+	}
+
+	void stop() {
+		if (thread==0) return;
+		thread->done = true;
+		thread->join();
+		delete thread; thread = 0;
+	}
+
+	// Copies out the last published state, n agents from the first
+	void getState(float *outX, float *outY, float *outHeading, float *outSpeed, int n) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(publishMutex);
+		n = MIN(n, count);
+		for (int i=0; i<n; i++) {
+			outX[i] = publishedX[i]; outY[i] = publishedY[i];
+			outHeading[i] = publishedHeading[i]; outSpeed[i] = publishedSpeed[i];
+		}
+	}
+
+private:
+	int count;
+	float minX, minY, maxX, maxY;
+	double timestep, accumulator;
+	Params params;
+
+	std::vector<float> x, y, vx, vy, nvx, nvy, heading, speed, wanderAngle;
+	std::vector<unsigned int> seeds;
+	SpatialGrid grid;
+	ThreadPool pool;
+	std::vector<std::vector<int> > scratch;
+
+	OpenThreads::Mutex inputMutex, publishMutex;
+	osg::Vec2 target, hand, stepTarget, stepHand;
+	bool hasTarget, hasHand, stepHasTarget, stepHasHand, hasBounds;
+	float bounds[4];
+	std::vector<float> publishedX, publishedY, publishedHeading, publishedSpeed;
+	std::vector<unsigned char> handVisible, stepHandVisible;
+
+	class SimulationThread : public OpenThreads::Thread {
+	public:
+		SimulationThread(CrowdSimulation *_sim) { sim = _sim; done = false; }
+		virtual void run() {
+			profiler().nameThread("crowd");
+			osg::Timer_t last = osg::Timer::instance()->tick();
+			while (!done) {
+				osg::Timer_t now = osg::Timer::instance()->tick();
+				sim->advance(osg::Timer::instance()->delta_s(last, now));
+				last = now;
+				double spare = sim->timestep - osg::Timer::instance()->delta_s(now, osg::Timer::instance()->tick());
+				if (spare>0) microSleep((unsigned int)(spare*1e6));
+			}
+		}
+		volatile bool done;
+	private:
+		CrowdSimulation *sim;
+	};
+	SimulationThread *thread;
+
+	// xorshift, each agent has its own state so threads don't share one
+	static float random(unsigned int &s) {
+		s ^= s<<13; s ^= s>>17; s ^= s<<5;
+		return (s & 0xffffff)/float(0x1000000);
+	}
+
+	static void truncate(float &fx, float &fy, float limit) {
+		float l2 = fx*fx+fy*fy;
+		if (l2>limit*limit) { float s = limit/sqrt(l2); fx *= s; fy *= s; }
+	}
+
+	void steer(int i, std::vector<int> &neighbours) {
+		const Params &p = params;
+		float fx = 0, fy = 0;
+
+		//Seek, slowing down inside arriveRadius so agents settle around the target
+		if (stepHasTarget) {
+			float dx = stepTarget.x()-x[i], dy = stepTarget.y()-y[i], d = sqrt(dx*dx+dy*dy);
+			if (d>1e-3f) {
+				float desired = p.maxSpeed*MIN(d/p.arriveRadius, 1.0f);
+				fx += p.seekWeight*(dx/d*desired - vx[i]); fy += p.seekWeight*(dy/d*desired - vy[i]);
+			}
+		}
+
+		//Flee, harder the closer the hand is
+		if (stepHasHand && (i>=stepHandVisible.size() || stepHandVisible[i])) {
+			float dx = x[i]-stepHand.x(), dy = y[i]-stepHand.y(), d = sqrt(dx*dx+dy*dy);
+			if (d<p.fleeRadius && d>1e-3f) {
+				float urgency = 1 - d/p.fleeRadius;
+				fx += p.fleeWeight*urgency*(dx/d*p.maxSpeed - vx[i]); fy += p.fleeWeight*urgency*(dy/d*p.maxSpeed - vy[i]);
+			}
+		}
+
+		//Separation, inversely proportional to distance
+		neighbours.clear();
+		grid.queryRadius(x[i], y[i], p.separationRadius, neighbours, i);
+		for (int n=0; n<neighbours.size(); n++) {
+			int j = neighbours[n];
+			float dx = x[i]-x[j], dy = y[i]-y[j], d2 = dx*dx+dy*dy;
+			if (d2<1e-6f) { dx = random(seeds[i])-0.5f; dy = random(seeds[i])-0.5f; d2 = dx*dx+dy*dy+1e-6f; }
+			fx += p.separationWeight*p.maxSpeed*dx/d2; fy += p.separationWeight*p.maxSpeed*dy/d2;
+		}
+
+		//Wander, a point jittered around a circle ahead of the agent
+		wanderAngle[i] += (random(seeds[i])-0.5f)*p.wanderJitter*timestep*2*osg::PI;
+		float h = heading[i]-osg::PI_2;
+		float wx = cos(h)*p.wanderDistance + cos(wanderAngle[i])*p.wanderRadius;
+		float wy = sin(h)*p.wanderDistance + sin(wanderAngle[i])*p.wanderRadius;
+		float wl = sqrt(wx*wx+wy*wy);
+		if (wl>1e-3f) { fx += p.wanderWeight*(wx/wl*p.maxSpeed*0.5f - vx[i]); fy += p.wanderWeight*(wy/wl*p.maxSpeed*0.5f - vy[i]); }
+
+		//Containment, back towards the area in proportion to how far out the agent is
+		if (x[i]<minX) fx += p.containWeight*(minX-x[i]); else if (x[i]>maxX) fx += p.containWeight*(maxX-x[i]);
+		if (y[i]<minY) fy += p.containWeight*(minY-y[i]); else if (y[i]>maxY) fy += p.containWeight*(maxY-y[i]);
+
+		truncate(fx, fy, p.maxForce);
+		nvx[i] = vx[i] + fx*timestep; nvy[i] = vy[i] + fy*timestep;
+		truncate(nvx[i], nvy[i], p.maxSpeed);
+	}
+
+	void integrate(int i) {
+		vx[i] = nvx[i]; vy[i] = nvy[i];
+		x[i] += vx[i]*timestep; y[i] += vy[i]*timestep;
+		speed[i] = sqrt(vx[i]*vx[i]+vy[i]*vy[i]);
+
+		//Face the direction of travel, the model faces -y so the spider's angle is a right angle on
+		if (speed[i]>1e-2f) heading[i] = atan2(vy[i], vx[i]) + osg::PI_2;
+	}
+
+	void applyBounds(float _minX, float _minY, float _maxX, float _maxY) {
+		float sx = maxX>minX ? (_maxX-_minX)/(maxX-minX) : 1, sy = maxY>minY ? (_maxY-_minY)/(maxY-minY) : 1;
+		for (int i=0; i<count; i++) { x[i] = _minX + (x[i]-minX)*sx; y[i] = _minY + (y[i]-minY)*sy; }
+		minX = _minX; minY = _minY; maxX = _maxX; maxY = _maxY;
+		grid = SpatialGrid(minX, minY, maxX, maxY, grid.getCellSize());
+		if (count>0) grid.update(&x[0], &y[0], count);
+	}
+
+	void publish() {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(publishMutex);
+		publishedX = x; publishedY = y; publishedHeading = heading; publishedSpeed = speed;
+	}
+
+	class SteerJob : public ParallelJob {
+	public:
+		SteerJob(CrowdSimulation *_sim, int _chunks) { sim = _sim; chunks = _chunks; }
+		virtual void run(int index) {
+			int begin, end; sim->pool.getRange(sim->count, index, chunks, begin, end);
+			for (int i=begin; i<end; i++) sim->steer(i, sim->scratch[index]);
+		}
+	private:
+		CrowdSimulation *sim;
+		int chunks;
+	};
+
+	class IntegrateJob : public ParallelJob {
+	public:
+		IntegrateJob(CrowdSimulation *_sim, int _chunks) { sim = _sim; chunks = _chunks; }
+		virtual void run(int index) {
+			int begin, end; sim->pool.getRange(sim->count, index, chunks, begin, end);
+			for (int i=begin; i<end; i++) sim->integrate(i);
+		}
+	private:
+		CrowdSimulation *sim;
+		int chunks;
+	};
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef SURFREGISTRATION_H
+#define SURFREGISTRATION_H
+
+#include <cv.h>
+#include <highgui.h>
+#include <string>
+#include <vector>
+
+#include "MarkerRegistration.h"
+#include "TiledSurfExtractor.h"
+
+struct SurfMatch {
+	int queryIdx, trainIdx;
+};
+
+// Approximate nearest neighbour search over SURF descriptors with FLANN's randomised k-d trees,
+// used to match a frame against the descriptors of every marker at once. Matches pass Lowe's ratio
+// test on the two nearest neighbours found.
+class SurfIndex {
+public:
+	SurfIndex(int _trees = 4, int _checks = 64) { trees = _trees; checks = _checks; index = 0; }
+	~SurfIndex() { if (index) delete index; }
+
+	void build(const std::vector<float> &descriptors, int size) {
+		if (index) { delete index; index = 0; }
+		int rows = descriptors.size()/size; train = cv::Mat();
+		if (rows==0) return;
+		train.create(rows, size, CV_32F);
+		memcpy(train.data, &descriptors[0], descriptors.size()*sizeof(float));
+		index = new cv::flann::Index(train, cv::flann::KDTreeIndexParams(trees));
+	}
+
+	void match(const std::vector<float> &query, int size, std::vector<SurfMatch> &matches, float ratio = 0.7f) {
+		matches.clear();
+		int nQuery = query.size()/size;
+		if (index==0 || train.rows<2 || nQuery==0) return;
+
+		cv::Mat queryMat(nQuery, size, CV_32F, (void*)&query[0]);
+		if (indices.rows<nQuery) { indices.create(nQuery, 2, CV_32S); dists.create(nQuery, 2, CV_32F); }
+		cv::Mat ind = indices.rowRange(0, nQuery), dist = dists.rowRange(0, nQuery);
+		index->knnSearch(queryMat, ind, dist, 2, cv::flann::SearchParams(checks));
+
+		//Distances are squared, so is the ratio
+		for (int q=0; q<nQuery; q++) {
+			if (dist.at<float>(q,0) < ratio*ratio*dist.at<float>(q,1)) {
+				SurfMatch m; m.queryIdx = q; m.trainIdx = ind.at<int>(q,0);
+				matches.push_back(m);
+			}
+		}
+	}
+
+private:
+	int trees, checks;
+	cv::Mat train, indices, dists;
+	cv::flann::Index *index;
+};
+
+// SURF natural feature registration with keypoint extraction spread over all cores. Marker features
+// are extracted once when the marker is added and all markers share one SurfIndex, frames are split
+// into tiles by TiledSurfExtractor.
+class SurfRegistration : public MarkerRegistration {
+public:
+	SurfRegistration(int threads = 0, double hessianThreshold = 500) : pool(threads), extractor(&pool, hessianThreshold) {
+		grey = 0; minInliers = 12; indexDirty = false;
+	}
+
+	~SurfRegistration() {
+		if (grey) cvReleaseImage(&grey);
+	}
+
+	std::vector<MarkerTransform> performRegistration(IplImage *frame_input, CvMat *captureParams, CvMat *captureDistortion) {
+		std::vector<MarkerTransform> retVal;
+
+		if (grey==0 || grey->width!=frame_input->width || grey->height!=frame_input->height) {
+			if (grey) cvReleaseImage(&grey);
+			grey = cvCreateImage(cvGetSize(frame_input), IPL_DEPTH_8U, 1);
+		}
+		if (frame_input->nChannels==1) cvCopy(frame_input, grey); else cvCvtColor(frame_input, grey, CV_BGR2GRAY);
+
+		extractor.extract(grey, keypoints, descriptors);
+		if (markers.empty()) return retVal;
+
+		//Match against every marker at once, then share the matches out between the markers
+		if (indexDirty) buildIndex();
+		index.match(descriptors, extractor.getDescriptorSize(), matches);
+
+		for (int m=0; m<markers.size(); m++) markerMatches[m].clear();
+		for (int i=0; i<matches.size(); i++) markerMatches[descriptorMarker[matches[i].trainIdx]].push_back(i);
+
+		for (int m=0; m<markers.size(); m++) {
+			if (markerMatches[m].size()<minInliers) continue;
+			SurfMarker &marker = markers.at(m);
+
+			std::vector<CvPoint2D32f> markerPts(markerMatches[m].size()), framePts(markerMatches[m].size());
+			for (int i=0; i<markerMatches[m].size(); i++) {
+				const SurfMatch &match = matches[markerMatches[m][i]];
+				framePts[i] = keypoints[match.queryIdx].pt;
+				markerPts[i] = allKeypoints[match.trainIdx].pt;
+			}
+
+			MarkerTransform mt;
+			if (estimateMarkerTransform(markerPts, framePts, marker.name, marker.size, marker.scale, captureParams, captureDistortion, minInliers, mt)) retVal.push_back(mt);
+		}
+
+		return retVal;
+	}
+
+	void addResizedMarker(std::string markerName, int maxLengthSize) {
+		addMarker(markerName, maxLengthSize, 0);
+	}
+
+	// The marker is measured in units such that its longest side is maxLengthScale long
+	void addResizedScaledMarker(std::string markerName, int maxLengthSize, int maxLengthScale) {
+		addMarker(markerName, maxLengthSize, maxLengthScale);
+	}
+
+	void removeMarker(std::string markerName) {
+		for (std::vector<SurfMarker>::iterator m = markers.begin(); m!=markers.end(); m++) {
+			if (m->name==markerName) { markers.erase(m); indexDirty = true; return; }
+		}
+	}
+
+	int getThreadCount() { return pool.getThreadCount(); }
+
+private:
+	struct SurfMarker {
+		std::string name;
+		CvSize size;
+		float scale;
+		std::vector<CvSURFPoint> keypoints;
+		std::vector<float> descriptors;
+	};
+
+	ThreadPool pool;
+	TiledSurfExtractor extractor;
+	std::vector<SurfMarker> markers;
+	int minInliers;
+
+	//Descriptors of all the markers, indexed together
+	SurfIndex index;
+	std::vector<CvSURFPoint> allKeypoints;
+	std::vector<float> allDescriptors;
+	std::vector<int> descriptorMarker;
+	std::vector<std::vector<int> > markerMatches;
+	bool indexDirty;
+
+	IplImage *grey;
+	std::vector<CvSURFPoint> keypoints;
+	std::vector<float> descriptors;
+	std::vector<SurfMatch> matches;
+
+	bool addMarker(std::string markerName, int maxLengthSize, int maxLengthScale) {
+		IplImage *markerIm = cvLoadImage(markerName.c_str(), CV_LOAD_IMAGE_GRAYSCALE);
+		if (markerIm==0) { printf("Could not load marker %s\n", markerName.c_str()); return false; }
+
+		SurfMarker marker; marker.name = markerName;
+		float resize = float(maxLengthSize)/float(MAX(markerIm->width, markerIm->height));
+		marker.size = cvSize(cvRound(markerIm->width*resize), cvRound(markerIm->height*resize));
+		marker.scale = maxLengthScale>0 ? float(maxLengthScale)/float(MAX(marker.size.width, marker.size.height)) : 1;
+
+		IplImage *resized = cvCreateImage(marker.size, IPL_DEPTH_8U, 1);
+		cvResize(markerIm, resized, CV_INTER_AREA);
+		extractor.extract(resized, marker.keypoints, marker.descriptors);
+		cvReleaseImage(&resized); cvReleaseImage(&markerIm);
+
+		markers.push_back(marker); indexDirty = true;
+		return true;
+	}
+
+	void buildIndex() {
+		allKeypoints.clear(); allDescriptors.clear(); descriptorMarker.clear();
+		for (int m=0; m<markers.size(); m++) {
+			allKeypoints.insert(allKeypoints.end(), markers[m].keypoints.begin(), markers[m].keypoints.end());
+			allDescriptors.insert(allDescriptors.end(), markers[m].descriptors.begin(), markers[m].descriptors.end());
+			descriptorMarker.resize(allKeypoints.size(), m);
+		}
+		index.build(allDescriptors, extractor.getDescriptorSize());
+		markerMatches.resize(markers.size());
+		indexDirty = false;
+	}
+};
+
+#endif
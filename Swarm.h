@@ -0,0 +1,357 @@
+#ifndef SWARM_H
+#define SWARM_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <osg/Group>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/TextureRectangle>
+#include <osg/Program>
+#include <osg/Uniform>
+#include <osgUtil/CullVisitor>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include "VertexAnimation.h"
+#include "Impostor.h"
+#include "SpatialGrid.h"
+#include "Steering.h"
+#include "GroundHeightMap.h"
+#include "Profiler.h"
+
+// Thousands of animated spiders drawn with instanced draws of the baked animation. The state of every
+// spider is kept as parallel arrays and advanced in bulk on the update traversal. On the cull traversal
+// each spider's projected size picks its tier, the full mesh, one of two decimated meshes or an impostor
+// sprite, and its position, heading and animation frames are written to a float texture grouped by
+// tier. Each tier is one instanced draw that reads its spiders from the texture by instance ID.
+class SpiderSwarm : public osg::Group {
+public:
+	// Per spider state, one entry per spider in each array. Phase is in frames from the clip's start.
+	struct State {
+		std::vector<float> x, y, z, heading, phase;
+		std::vector<int> clip;
+		int size() { return x.size(); }
+	};
+
+	enum Tier { FULL_MESH, NEAR_MESH, FAR_MESH, IMPOSTOR, TIER_COUNT };
+
+	SpiderSwarm(VertexAnimation *_animation, int _maxSpiders, float _scale = 0.4f) : osg::Group() {
+		animation = _animation; maxSpiders = _maxSpiders; scale = _scale; impostors = 0; grid = 0; simulation = 0; ground = 0;
+		areaChanged = false;
+		frameRate = 30.0f; lastTime = -1;
+		radius = animation->getBound().radius()*scale;
+
+		//Projected diameters in pixels below which each tier gives way to the next
+		tierPixels[FULL_MESH] = 150; tierPixels[NEAR_MESH] = 60; tierPixels[FAR_MESH] = 32; tierPixels[IMPOSTOR] = 0;
+
+		//Two texels per spider: position and heading, then frame A, frame B, blend and clip + phase fraction
+		instanceRows = (maxSpiders+instancesPerRow-1)/instancesPerRow;
+		instanceImage = new osg::Image();
+		instanceImage->allocateImage(2*instancesPerRow, MAX(instanceRows, 1), 1, GL_RGBA, GL_FLOAT);
+		instanceImage->setInternalTextureFormat(GL_RGBA32F_ARB);
+		instanceImage->setDataVariance(osg::Object::DYNAMIC);
+
+		osg::ref_ptr<osg::TextureRectangle> texture = new osg::TextureRectangle(instanceImage.get());
+		texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+		texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+
+		osg::StateSet *ss = getOrCreateStateSet();
+		if (animation->getStateSet()) ss->merge(*animation->getStateSet());
+		ss->setDataVariance(osg::Object::DYNAMIC);
+		ss->setTextureAttributeAndModes(1, texture.get());
+		ss->addUniform(new osg::Uniform("diffuseMap", 0));
+		ss->addUniform(new osg::Uniform("instanceData", 1));
+		ss->addUniform(new osg::Uniform("scale", scale));
+
+		if (animation->getVertexCount()>0) {
+			osg::ref_ptr<osg::Program> meshProgram = createMeshProgram();
+			animation->apply(ss, 2, meshProgram.get());
+			ss->setAttributeAndModes(meshProgram.get());
+
+			//The impostors are rendered from the far mesh, so they match the tier they take over from
+			const float nearDecimation = 1.0f/48, farDecimation = 1.0f/24;
+			addTier(FULL_MESH, animation->createGeometry());
+			addTier(NEAR_MESH, animation->createGeometry(nearDecimation));
+			addTier(FAR_MESH, animation->createGeometry(farDecimation));
+
+			impostors = new ImpostorAtlas(animation, 8, 8, 32, 45, farDecimation);
+			addTier(IMPOSTOR, impostors->createGeometry());
+			osg::StateSet *iss = tiers[IMPOSTOR].geode->getOrCreateStateSet();
+			impostors->apply(iss, 4, scale);
+			iss->setAttributeAndModes(createImpostorProgram());
+			iss->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+		}
+
+		//Spiders are positioned in the shaders, so the geometry's bounds mean nothing
+		setCullingActive(false);
+		setUpdateCallback(new SwarmUpdateCallback(this));
+		setCullCallback(new SwarmCullCallback(this));
+	}
+
+	~SpiderSwarm() { if (impostors) delete impostors; if (grid) delete grid; }
+
+	// The area of the marker plane the spiders keep to, indexed by a grid of cells a spider across.
+	// Safe to call from any thread, the grid is rebuilt on the next update.
+	void setArea(float minX, float minY, float maxX, float maxY) {
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(areaMutex);
+		area[0] = minX; area[1] = minY; area[2] = maxX; area[3] = maxY; areaChanged = true;
+	}
+
+	// Spider positions as of the last update, null until the first update after setArea
+	SpatialGrid *getGrid() { return grid; }
+
+	// Moves the spiders with a crowd simulation of the same size, picking the idle, walk or run clip by speed
+	void setSimulation(CrowdSimulation *_simulation) {
+		simulation = _simulation;
+		idleClip = findClip("idle"); walkClip = findClip("walk"); runClip = findClip("run");
+		speed.assign(state.size(), 0);
+	}
+
+	// Spiders stand on the surface under them rather than keeping the height they were added at
+	void setGroundHeightMap(GroundHeightMap *_ground) { ground = _ground; }
+
+	// Radius of a spider's bounding sphere in marker units
+	float getRadius() { return radius; }
+
+	// Adds a spider playing clip from a random phase, returns its index or -1 if the swarm is full
+	int addSpider(float x, float y, float z, float heading, int clip) {
+		if (state.size()>=maxSpiders) return -1;
+		state.x.push_back(x); state.y.push_back(y); state.z.push_back(z); state.heading.push_back(heading);
+		state.clip.push_back(clip); state.phase.push_back(rand()%animation->getClipLength(clip));
+		return state.size()-1;
+	}
+
+	// Only touch from the render thread's update traversal, or before the renderer starts
+	State &getState() { return state; }
+
+	void setFrameRate(float fps) { frameRate = fps; }
+	void setTierPixels(Tier tier, float pixels) { tierPixels[tier] = pixels; }
+
+	// Spiders drawn in a tier last frame, for tuning the thresholds
+	int getTierCount(Tier tier) { return tiers.size()>tier ? tiers[tier].count : 0; }
+
+	// Advances every spider's animation by dt seconds
+	void update(double dt) {
+		PROFILE_SCOPE("swarm.update");
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(areaMutex);
+			if (areaChanged) {
+				if (grid) delete grid;
+				grid = new SpatialGrid(area[0], area[1], area[2], area[3], 2*radius);
+				areaChanged = false;
+			}
+		}
+		int n = state.size();
+		if (simulation && n>0) {
+			simulation->getState(&state.x[0], &state.y[0], &state.heading[0], &speed[0], n);
+			float walkSpeed = simulation->getParams().maxSpeed*0.1f, runSpeed = simulation->getParams().maxSpeed*0.7f;
+			for (int i=0; i<n; i++) {
+				int clip = speed[i]<walkSpeed ? idleClip : speed[i]<runSpeed ? walkClip : runClip;
+				if (clip!=state.clip[i]) { state.clip[i] = clip; state.phase[i] = 0; }
+			}
+		}
+
+		float advance = dt*frameRate;
+		for (int i=0; i<n; i++) {
+			float length = animation->getClipLength(state.clip[i]);
+			float p = state.phase[i] + advance;
+			state.phase[i] = p>=length ? fmodf(p, length) : p;
+		}
+		if (ground && n>0) ground->getHeights(&state.x[0], &state.y[0], &state.z[0], n);
+		if (grid && n>0) grid->update(&state.x[0], &state.y[0], n);
+	}
+
+	// Picks each spider's tier from its projected size, dropping those outside the view, and writes the
+	// instance data grouped by tier. The matrices are the swarm's model view and projection.
+	void selectTiers(const osg::Matrix &modelView, const osg::Matrix &projection, float viewportHeight) {
+		PROFILE_SCOPE("swarm.selectTiers");
+		int n = state.size();
+		if (tiers.empty()) return;
+
+		//For a perspective projection the projected diameter is pixelScale/depth
+		float pixelScale = 2*radius*fabs(projection(1,1))*viewportHeight*0.5f;
+		float marginX = radius*fabs(projection(0,0)), marginY = radius*fabs(projection(1,1));
+		osg::Matrix mvp = modelView*projection;
+
+		tierOf.resize(n);
+		int counts[TIER_COUNT+1] = {0};
+		for (int i=0; i<n; i++) {
+			osg::Vec3 p(state.x[i], state.y[i], state.z[i]);
+			osg::Vec4 clip = osg::Vec4(p, 1)*mvp;
+			float depth = -(p*modelView).z();
+			if (depth<=0 || fabs(clip.x())>clip.w()+marginX || fabs(clip.y())>clip.w()+marginY) { tierOf[i] = -1; continue; }
+
+			float pixels = pixelScale/depth;
+			int t = FULL_MESH;
+			while (t<IMPOSTOR && pixels<tierPixels[t]) t++;
+			tierOf[i] = t; counts[t+1]++;
+		}
+		for (int t=1; t<=TIER_COUNT; t++) counts[t] += counts[t-1];
+
+		float *data = (float*)instanceImage->data();
+		int cursor[TIER_COUNT];
+		for (int t=0; t<TIER_COUNT; t++) cursor[t] = counts[t];
+		for (int i=0; i<n; i++) {
+			if (tierOf[i]<0) continue;
+			float *texel = data + 8*cursor[tierOf[i]]++;
+			texel[0] = state.x[i]; texel[1] = state.y[i]; texel[2] = state.z[i]; texel[3] = state.heading[i];
+			animation->getFrames(state.clip[i], state.phase[i], texel[4], texel[5], texel[6]);
+			texel[7] = state.clip[i] + state.phase[i]/animation->getClipLength(state.clip[i]);
+		}
+		instanceImage->dirty();
+
+		//A draw with no instances would draw one spider at the origin, so empty tiers are hidden
+		for (int t=0; t<TIER_COUNT; t++) {
+			TierBatch &b = tiers[t];
+			b.count = counts[t+1]-counts[t];
+			b.geode->setNodeMask(b.count>0 ? 0xffffffff : 0);
+			b.draw->setNumInstances(b.count);
+			b.offset->set(counts[t]);
+		}
+	}
+
+private:
+	static const int instancesPerRow = 1024;
+
+	struct TierBatch {
+		osg::ref_ptr<osg::Geode> geode;
+		osg::ref_ptr<osg::PrimitiveSet> draw;
+		osg::ref_ptr<osg::Uniform> offset;
+		int count;
+	};
+
+	VertexAnimation *animation;
+	ImpostorAtlas *impostors;
+	SpatialGrid *grid;
+	OpenThreads::Mutex areaMutex;
+	float area[4];
+	bool areaChanged;
+	CrowdSimulation *simulation;
+	GroundHeightMap *ground;
+	int idleClip, walkClip, runClip;
+	std::vector<float> speed;
+	std::vector<TierBatch> tiers;
+	float tierPixels[TIER_COUNT];
+	int maxSpiders, instanceRows;
+	float frameRate, scale, radius;
+	double lastTime;
+
+	State state;
+	std::vector<int> tierOf;
+	osg::ref_ptr<osg::Image> instanceImage;
+
+	int findClip(const char *name) {
+		for (int c=0; c<animation->getClipCount(); c++) if (animation->getClips()[c].name==name) return c;
+		return 0;
+	}
+
+	void addTier(Tier tier, osg::Geometry *geometry) {
+		TierBatch b;
+		geometry->setDataVariance(osg::Object::DYNAMIC);
+		b.draw = geometry->getPrimitiveSet(0);
+		b.draw->setDataVariance(osg::Object::DYNAMIC);
+		b.geode = new osg::Geode(); b.geode->addDrawable(geometry);
+		b.geode->setCullingActive(false); b.geode->setNodeMask(0);
+		b.offset = new osg::Uniform("instanceOffset", 0); b.offset->setDataVariance(osg::Object::DYNAMIC);
+		b.geode->getOrCreateStateSet()->addUniform(b.offset.get());
+		b.count = 0;
+		addChild(b.geode.get());
+		if (tiers.size()<=tier) tiers.resize(tier+1);
+		tiers[tier] = b;
+	}
+
+	static const char *instanceSource() {
+		return
+			"uniform sampler2DRect instanceData;\n"
+			"uniform int instanceOffset;\n"
+			"uniform float scale;\n"
+			"vec2 instanceTexel() {\n"
+			"	float id = float(instanceOffset + gl_InstanceIDARB);\n"
+			"	return vec2(2.0*mod(id, 1024.0), floor(id/1024.0)) + 0.5;\n"
+			"}\n";
+	}
+
+	osg::Program *createMeshProgram() {
+		osg::Program *program = new osg::Program();
+		program->addShader(new osg::Shader(osg::Shader::VERTEX, std::string(
+			"#extension GL_ARB_draw_instanced : enable\n") + VertexAnimation::vertexAnimationSource() + instanceSource() +
+			"varying float diffuse;\n"
+			"void main() {\n"
+			"	vec2 texel = instanceTexel();\n"
+			"	vec4 s = texture2DRect(instanceData, texel);\n"
+			"	vec4 frame = texture2DRect(instanceData, texel + vec2(1.0, 0.0));\n"
+			"	vec3 p, n;\n"
+			"	vatSample(frame.x, frame.y, frame.z, p, n);\n"
+			"	float c = cos(s.w), sn = sin(s.w);\n"
+			"	p *= scale;\n"
+			"	p = vec3(c*p.x - sn*p.y, sn*p.x + c*p.y, p.z) + s.xyz;\n"
+			"	n = vec3(c*n.x - sn*n.y, sn*n.x + c*n.y, n.z);\n"
+			"	diffuse = 0.3 + 0.7*max(dot(normalize(gl_NormalMatrix*n), normalize(gl_LightSource[0].position.xyz)), 0.0);\n"
+			"	gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+			"	gl_Position = gl_ModelViewProjectionMatrix*vec4(p, 1.0);\n"
+			"}\n"));
+		program->addShader(new osg::Shader(osg::Shader::FRAGMENT,
+			"uniform sampler2D diffuseMap;\n"
+			"varying float diffuse;\n"
+			"void main() {\n"
+			"	vec4 colour = texture2D(diffuseMap, gl_TexCoord[0].xy);\n"
+			"	gl_FragColor = vec4(colour.rgb*diffuse, colour.a);\n"
+			"}\n"));
+		return program;
+	}
+
+	osg::Program *createImpostorProgram() {
+		osg::Program *program = new osg::Program();
+		program->addShader(new osg::Shader(osg::Shader::VERTEX, std::string(
+			"#extension GL_ARB_draw_instanced : enable\n"
+			"#extension GL_ARB_texture_rectangle : enable\n") + instanceSource() + ImpostorAtlas::impostorSource() +
+			"void main() {\n"
+			"	vec2 texel = instanceTexel();\n"
+			"	vec4 s = texture2DRect(instanceData, texel);\n"
+			"	vec4 frame = texture2DRect(instanceData, texel + vec2(1.0, 0.0));\n"
+			"	gl_Position = impostorPosition(s.xyz, s.w, floor(frame.w), fract(frame.w));\n"
+			"}\n"));
+		program->addShader(new osg::Shader(osg::Shader::FRAGMENT,
+			"#extension GL_ARB_texture_rectangle : enable\n"
+			"uniform sampler2DRect impostorAtlas;\n"
+			"void main() {\n"
+			"	vec4 colour = texture2DRect(impostorAtlas, gl_TexCoord[0].xy);\n"
+			"	if (colour.a<0.5) discard;\n"
+			"	gl_FragColor = colour;\n"
+			"}\n"));
+		return program;
+	}
+
+	class SwarmUpdateCallback : public osg::NodeCallback {
+	public:
+		SwarmUpdateCallback(SpiderSwarm *_s) { swarm = _s; }
+
+		virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
+			double t = nv->getFrameStamp() ? nv->getFrameStamp()->getSimulationTime() : 0;
+			swarm->update(swarm->lastTime<0 ? 0 : t-swarm->lastTime);
+			swarm->lastTime = t;
+			traverse(node, nv);
+		}
+
+	private:
+		SpiderSwarm *swarm;
+	};
+
+	class SwarmCullCallback : public osg::NodeCallback {
+	public:
+		SwarmCullCallback(SpiderSwarm *_s) { swarm = _s; }
+
+		virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
+			osgUtil::CullVisitor *cv = dynamic_cast<osgUtil::CullVisitor*>(nv);
+			if (cv) swarm->selectTiers(*cv->getModelViewMatrix(), *cv->getProjectionMatrix(), cv->getViewport() ? cv->getViewport()->height() : 480);
+			traverse(node, nv);
+		}
+
+	private:
+		SpiderSwarm *swarm;
+	};
+};
+
+#endif
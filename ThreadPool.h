@@ -0,0 +1,117 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
+// A unit of work run by ThreadPool::parallelFor, run() is called once for each index
+class ParallelJob {
+public:
+	virtual ~ParallelJob() {}
+	virtual void run(int index) = 0;
+};
+
+// A fixed set of worker threads sharing indexed jobs. The calling thread works on the job too, so a
+// pool of N threads starts N-1 workers.
+class ThreadPool {
+public:
+	ThreadPool(int threads = 0) {
+		if (threads<=0) threads = OpenThreads::GetNumberOfProcessors();
+		job = 0; jobCount = 0; nextIndex = 0; remaining = 0; generation = 0; quit = false;
+
+		for (int i=0; i<threads-1; i++) {
+			Worker *w = new Worker(this);
+			workers.push_back(w); w->start();
+		}
+	}
+
+	~ThreadPool() {
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+			quit = true; wake.broadcast();
+		}
+		for (int i=0; i<workers.size(); i++) { workers.at(i)->join(); delete workers.at(i); }
+	}
+
+	// Run job->run(i) for every i in [0, count) and wait until they have all completed
+	void parallelFor(int count, ParallelJob *_job) {
+		if (count<=0) return;
+		if (workers.empty() || count==1) {
+			for (int i=0; i<count; i++) _job->run(i);
+			return;
+		}
+
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+			job = _job; jobCount = count; nextIndex = 0; remaining = count;
+			generation++; wake.broadcast();
+		}
+
+		work();
+
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+		while (remaining>0) done.wait(&mutex);
+		job = 0;
+	}
+
+	int getThreadCount() { return workers.size()+1; }
+
+	// Split count items into roughly equal ranges, one per thread
+	void getRange(int count, int index, int chunks, int &begin, int &end) {
+		begin = (count*index)/chunks; end = (count*(index+1))/chunks;
+	}
+
+private:
+	class Worker : public OpenThreads::Thread {
+	public:
+		Worker(ThreadPool *_pool) { pool = _pool; }
+
+		virtual void run() {
+			int seen = 0;
+			while (true) {
+				{
+					OpenThreads::ScopedLock<OpenThreads::Mutex> lock(pool->mutex);
+					while (!pool->quit && pool->generation==seen) pool->wake.wait(&pool->mutex);
+					if (pool->quit) return;
+					seen = pool->generation;
+				}
+				pool->work();
+			}
+		}
+
+	private:
+		ThreadPool *pool;
+	};
+
+	std::vector<Worker*> workers;
+
+	OpenThreads::Mutex mutex;
+	OpenThreads::Condition wake, done;
+
+	ParallelJob *job;
+	int jobCount, nextIndex, remaining, generation;
+	bool quit;
+
+	// Take indices from the current job until there are none left
+	void work() {
+		while (true) {
+			ParallelJob *current; int index;
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+				if (job==0 || nextIndex>=jobCount) return;
+				current = job; index = nextIndex++;
+			}
+
+			current->run(index);
+
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(mutex);
+			if (--remaining==0) done.broadcast();
+		}
+	}
+};
+
+#endif
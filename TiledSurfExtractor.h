@@ -0,0 +1,186 @@
+#ifndef TILEDSURFEXTRACTOR_H
+#define TILEDSURFEXTRACTOR_H
+
+#include <cv.h>
+#include <algorithm>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// SURF keypoint detection and description spread over a thread pool.
+//
+// Detection runs on overlapping tiles. Each tile is its core region plus a margin wide enough for
+// the largest SURF box filter, and tile origins are aligned to the coarsest octave's sampling step,
+// so a keypoint in a tile's core is found exactly as it would be on the whole frame. Keypoints are
+// kept only by the tile whose core contains them, and any near identical pair straddling a seam is
+// reduced to one. Descriptors are then computed on the whole frame for slices of the merged
+// keypoints, so they match the serial path.
+class TiledSurfExtractor {
+public:
+	TiledSurfExtractor(ThreadPool *_pool, double hessianThreshold = 500, bool extended = false) {
+		pool = _pool;
+		params = cvSURFParams(hessianThreshold, extended ? 1 : 0);
+
+		//Largest box filter used by SURF, plus the neighbourhood used for interpolation
+		int maxFilter = 3*((2<<(params.nOctaves-1))*(params.nOctaveLayers+2)+1);
+		alignment = 1<<params.nOctaves;
+		margin = ((maxFilter/2 + 2*alignment + alignment-1)/alignment)*alignment;
+		seamBand = 2.0f;
+	}
+
+	int getDescriptorSize() { return params.extended ? 128 : 64; }
+
+	void extract(IplImage *grey, std::vector<CvSURFPoint> &keypoints, std::vector<float> &descriptors) {
+		keypoints.clear(); descriptors.clear();
+		setupTiles(cvGetSize(grey));
+
+		//Detect the keypoints in each tile
+		DetectJob detect(this, grey);
+		pool->parallelFor(tiles.size(), &detect);
+
+		for (int t=0; t<tiles.size(); t++) keypoints.insert(keypoints.end(), detect.tileKeypoints[t].begin(), detect.tileKeypoints[t].end());
+		removeSeamDuplicates(keypoints);
+		std::sort(keypoints.begin(), keypoints.end(), compareKeypoints);
+
+		//Describe slices of the keypoints against the whole frame
+		descriptors.resize(keypoints.size()*getDescriptorSize());
+		DescribeJob describe(this, grey, keypoints, descriptors, pool->getThreadCount()*2);
+		pool->parallelFor(describe.chunks, &describe);
+	}
+
+private:
+	struct Tile {
+		CvRect core;   // Keypoints are kept if they lie in here
+		CvRect area;   // The region of the frame SURF is run on
+	};
+
+	ThreadPool *pool;
+	CvSURFParams params;
+	int margin, alignment;
+	float seamBand;
+
+	CvSize frameSize;
+	std::vector<Tile> tiles;
+	std::vector<int> seamsX, seamsY;
+
+	class DetectJob : public ParallelJob {
+	public:
+		DetectJob(TiledSurfExtractor *_e, IplImage *_grey) : e(_e), grey(_grey), tileKeypoints(_e->tiles.size()) {}
+
+		void run(int index) {
+			const Tile &tile = e->tiles.at(index);
+			CvMat tileMat; cvGetSubRect(grey, &tileMat, tile.area);
+
+			CvMemStorage *storage = cvCreateMemStorage(0);
+			CvSeq *kp = 0;
+			cvExtractSURF(&tileMat, 0, &kp, 0, storage, e->params);
+
+			for (int i=0; i<kp->total; i++) {
+				CvSURFPoint p = *(CvSURFPoint*)cvGetSeqElem(kp, i);
+				p.pt.x += tile.area.x; p.pt.y += tile.area.y;
+				if (p.pt.x>=tile.core.x && p.pt.y>=tile.core.y && p.pt.x<tile.core.x+tile.core.width && p.pt.y<tile.core.y+tile.core.height)
+					tileKeypoints[index].push_back(p);
+			}
+			cvReleaseMemStorage(&storage);
+		}
+
+		TiledSurfExtractor *e;
+		IplImage *grey;
+		std::vector<std::vector<CvSURFPoint> > tileKeypoints;
+	};
+
+	class DescribeJob : public ParallelJob {
+	public:
+		DescribeJob(TiledSurfExtractor *_e, IplImage *_grey, std::vector<CvSURFPoint> &_keypoints, std::vector<float> &_descriptors, int _chunks)
+			: e(_e), grey(_grey), keypoints(_keypoints), descriptors(_descriptors), chunks(_chunks) {}
+
+		void run(int index) {
+			int begin, end; e->pool->getRange(keypoints.size(), index, chunks, begin, end);
+			if (begin>=end) return;
+
+			CvMemStorage *storage = cvCreateMemStorage(0);
+			CvSeq *kp = cvCreateSeq(0, sizeof(CvSeq), sizeof(CvSURFPoint), storage);
+			cvSeqPushMulti(kp, &keypoints[begin], end-begin);
+
+			CvSeq *desc = 0;
+			cvExtractSURF(grey, 0, &kp, &desc, storage, e->params, 1);
+
+			int size = e->getDescriptorSize();
+			for (int i=0; i<desc->total && begin+i<end; i++) {
+				memcpy(&descriptors[(begin+i)*size], cvGetSeqElem(desc, i), size*sizeof(float));
+				keypoints[begin+i] = *(CvSURFPoint*)cvGetSeqElem(kp, i);
+			}
+			cvReleaseMemStorage(&storage);
+		}
+
+		TiledSurfExtractor *e;
+		IplImage *grey;
+		std::vector<CvSURFPoint> &keypoints;
+		std::vector<float> &descriptors;
+		int chunks;
+	};
+
+	static bool compareKeypoints(const CvSURFPoint &a, const CvSURFPoint &b) {
+		if (a.pt.y!=b.pt.y) return a.pt.y<b.pt.y;
+		if (a.pt.x!=b.pt.x) return a.pt.x<b.pt.x;
+		return a.size<b.size;
+	}
+
+	// Choose the tile grid with the smallest tile (including margins) for the number of threads
+	void setupTiles(CvSize size) {
+		if (!tiles.empty() && size.width==frameSize.width && size.height==frameSize.height) return;
+		frameSize = size; tiles.clear(); seamsX.clear(); seamsY.clear();
+
+		int threads = pool->getThreadCount(), bestX = 1, bestY = 1; double bestArea = -1;
+		for (int tx=1; tx<=threads; tx++) {
+			int ty = threads/tx; if (tx*ty!=threads) continue;
+			double area = double(MIN(size.width, size.width/tx + 2*margin)) * double(MIN(size.height, size.height/ty + 2*margin));
+			if (bestArea<0 || area<bestArea) { bestArea = area; bestX = tx; bestY = ty; }
+		}
+
+		std::vector<int> xs(bestX+1), ys(bestY+1);
+		for (int i=0; i<=bestX; i++) xs[i] = i==bestX ? size.width : ((size.width*i/bestX)/alignment)*alignment;
+		for (int i=0; i<=bestY; i++) ys[i] = i==bestY ? size.height : ((size.height*i/bestY)/alignment)*alignment;
+		for (int i=1; i<bestX; i++) seamsX.push_back(xs[i]);
+		for (int i=1; i<bestY; i++) seamsY.push_back(ys[i]);
+
+		for (int y=0; y<bestY; y++) {
+			for (int x=0; x<bestX; x++) {
+				Tile t;
+				t.core = cvRect(xs[x], ys[y], xs[x+1]-xs[x], ys[y+1]-ys[y]);
+				int x0 = MAX(0, xs[x]-margin), y0 = MAX(0, ys[y]-margin);
+				int x1 = MIN(size.width, xs[x+1]+margin), y1 = MIN(size.height, ys[y+1]+margin);
+				t.area = cvRect(x0, y0, x1-x0, y1-y0);
+				tiles.push_back(t);
+			}
+		}
+	}
+
+	bool nearSeam(const CvSURFPoint &p) {
+		for (int i=0; i<seamsX.size(); i++) if (fabs(p.pt.x-seamsX[i])<seamBand) return true;
+		for (int i=0; i<seamsY.size(); i++) if (fabs(p.pt.y-seamsY[i])<seamBand) return true;
+		return false;
+	}
+
+	// A keypoint interpolated onto opposite sides of a seam by two tiles is kept only once
+	void removeSeamDuplicates(std::vector<CvSURFPoint> &keypoints) {
+		std::vector<int> seam;
+		for (int i=0; i<keypoints.size(); i++) if (nearSeam(keypoints[i])) seam.push_back(i);
+
+		std::vector<bool> removed(keypoints.size(), false);
+		for (int a=0; a<seam.size(); a++) {
+			for (int b=a+1; b<seam.size(); b++) {
+				CvSURFPoint &p = keypoints[seam[a]], &q = keypoints[seam[b]];
+				if (removed[seam[a]] || removed[seam[b]] || p.laplacian!=q.laplacian) continue;
+				if (fabs(p.pt.x-q.pt.x)<1 && fabs(p.pt.y-q.pt.y)<1 && abs(p.size-q.size)<=MAX(1, p.size/10))
+					removed[p.hessian>=q.hessian ? seam[b] : seam[a]] = true;
+			}
+		}
+
+		int n = 0;
+		for (int i=0; i<keypoints.size(); i++) if (!removed[i]) keypoints[n++] = keypoints[i];
+		keypoints.resize(n);
+	}
+};
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef VERTEXANIMATION_H
+#define VERTEXANIMATION_H
+
+#include <map>
+#include <vector>
+
+#include <osg/Geometry>
+#include <osg/TextureRectangle>
+#include <osg/Geode>
+#include <osg/TriangleIndexFunctor>
+#include <osg/Program>
+#include <osg/Uniform>
+#include "Spider.h"
+
+// The spider model's animation as flat triangle meshes, one per frame of its sequence, with every
+// transform below the sequence applied. All frames share the texture coordinates and state of the first.
+class SpiderMeshFrames {
+public:
+	SpiderMeshFrames(const char *modelFile) {
+		osg::ref_ptr<osg::Node> model = osgDB::readNodeFile(modelFile);
+		if (!model.valid()) { printf("Couldn't load spider model %s\n", modelFile); return; }
+
+		CollectTypeNodeVisitor<osg::Sequence*> ctnv; model->accept(ctnv);
+		osg::Sequence *seq = ctnv.getCollectedNodes().empty() ? 0 : dynamic_cast<osg::Sequence*>(ctnv.getCollectedNodes()[0].get());
+
+		//A model without a sequence is a single still frame
+		if (seq) {
+			for (int i=0; i<seq->getNumChildren(); i++) addFrame(seq->getChild(i));
+		} else addFrame(model.get());
+	}
+
+	int getFrameCount() { return frames.size(); }
+	osg::Vec3Array *getVertices(int frame) { return frames[frame].vertices.get(); }
+	osg::Vec3Array *getNormals(int frame) { return frames[frame].normals.get(); }
+	osg::Vec2Array *getTexCoords() { return texCoords.get(); }
+	osg::StateSet *getStateSet() { return stateSet.get(); }
+
+private:
+	struct Frame {
+		osg::ref_ptr<osg::Vec3Array> vertices, normals;
+	};
+	std::vector<Frame> frames;
+	osg::ref_ptr<osg::Vec2Array> texCoords;
+	osg::ref_ptr<osg::StateSet> stateSet;
+
+	struct TriangleIndices {
+		std::vector<unsigned int> *indices;
+		void operator()(unsigned int i1, unsigned int i2, unsigned int i3) {
+			indices->push_back(i1); indices->push_back(i2); indices->push_back(i3);
+		}
+	};
+
+	class FlattenVisitor : public osg::NodeVisitor {
+	public:
+		FlattenVisitor(Frame *_frame, osg::Vec2Array *_texCoords) : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {
+			frame = _frame; texCoords = _texCoords; stateSet = 0; matrices.push_back(osg::Matrix::identity());
+		}
+
+		virtual void apply(osg::Transform &t) {
+			osg::Matrix m = matrices.back(); t.computeLocalToWorldMatrix(m, this);
+			matrices.push_back(m); traverse(t); matrices.pop_back();
+		}
+
+		virtual void apply(osg::Geode &geode) {
+			for (int i=0; i<geode.getNumDrawables(); i++) {
+				osg::Geometry *geom = geode.getDrawable(i)->asGeometry();
+				osg::Vec3Array *v = geom ? dynamic_cast<osg::Vec3Array*>(geom->getVertexArray()) : 0;
+				if (!v) continue;
+				if (!stateSet) stateSet = geom->getStateSet() ? geom->getStateSet() : geode.getStateSet();
+
+				osg::Vec3Array *n = geom->getNormalBinding()==osg::Geometry::BIND_PER_VERTEX ? dynamic_cast<osg::Vec3Array*>(geom->getNormalArray()) : 0;
+				osg::Vec2Array *t = dynamic_cast<osg::Vec2Array*>(geom->getTexCoordArray(0));
+
+				std::vector<unsigned int> indices;
+				osg::TriangleIndexFunctor<TriangleIndices> tif; tif.indices = &indices;
+				geom->accept(tif);
+
+				const osg::Matrix &m = matrices.back();
+				for (int j=0; j+2<indices.size(); j+=3) {
+					osg::Vec3 p[3];
+					for (int k=0; k<3; k++) p[k] = (*v)[indices[j+k]] * m;
+					osg::Vec3 face = (p[1]-p[0]) ^ (p[2]-p[0]); face.normalize();
+					for (int k=0; k<3; k++) {
+						frame->vertices->push_back(p[k]);
+						osg::Vec3 normal = n ? osg::Matrix::transform3x3(m, (*n)[indices[j+k]]) : face; normal.normalize();
+						frame->normals->push_back(normal);
+						if (texCoords) texCoords->push_back(t ? (*t)[indices[j+k]] : osg::Vec2(0, 0));
+					}
+				}
+			}
+		}
+
+		osg::StateSet *stateSet;
+
+	private:
+		Frame *frame;
+		osg::Vec2Array *texCoords;
+		std::vector<osg::Matrix> matrices;
+	};
+
+	void addFrame(osg::Node *node) {
+		Frame f; f.vertices = new osg::Vec3Array(); f.normals = new osg::Vec3Array();
+
+		//Texture coordinates only come from the first frame, the rest must match its topology
+		bool first = frames.empty();
+		if (first) texCoords = new osg::Vec2Array();
+		FlattenVisitor fv(&f, first ? texCoords.get() : 0);
+		node->accept(fv);
+		if (first) stateSet = fv.stateSet;
+
+		if (!first && f.vertices->size()!=frames[0].vertices->size()) {
+			printf("Spider frame %d doesn't match the first frame's topology\n", (int)frames.size());
+			f = frames.back();
+		}
+		frames.push_back(f);
+	}
+};
+
+// The frames of the animation clips baked into textures for the vertex shader. Vertices shared by
+// every frame are welded, positions are quantised to 16 bits within the animation's bounds and
+// normals to 8 bits, and texel frame*vertexCount + vertex holds a vertex of a frame. Only frames
+// belonging to a clip are baked, so clip c plays baked frames getClipStart(c) onwards.
+class VertexAnimation {
+public:
+	VertexAnimation(SpiderMeshFrames *mesh, const std::vector<AnimationClip> &_clips) {
+		clips = _clips; vertexCount = 0;
+		if (mesh->getFrameCount()==0) return;
+		weld(mesh);
+		stateSet = mesh->getStateSet();
+
+		//Bake each clip's frames contiguously, clips sharing frames are baked twice
+		for (int c=0; c<clips.size(); c++) {
+			clipStart.push_back(frames.size());
+			for (int f=clips[c].start; f<=clips[c].end; f++) frames.push_back(MIN(MAX(f, 0), mesh->getFrameCount()-1));
+		}
+		bake(mesh);
+	}
+
+	int getVertexCount() { return vertexCount; }
+	int getFrameCount() { return frames.size(); }
+	int getClipCount() { return clips.size(); }
+	int getClipLength(int clip) { return clips[clip].end-clips[clip].start+1; }
+	int getClipStart(int clip) { return clipStart[clip]; }
+	const std::vector<AnimationClip> &getClips() { return clips; }
+	osg::StateSet *getStateSet() { return stateSet.get(); }
+
+	// The baked frames either side of phase (in frames from the clip's start) of a looping clip, and how far between them
+	void getFrames(int clip, float phase, float &frameA, float &frameB, float &blend) {
+		int length = getClipLength(clip);
+		int a = int(phase); blend = phase-a;
+		a = a%length; frameA = clipStart[clip] + a; frameB = clipStart[clip] + (a+1)%length;
+	}
+
+	// Welded mesh in the first clip's first frame, with the baked vertex index as attribute vertexIndexAttrib.
+	// A cellFraction above 0 gives a decimated mesh, see decimate().
+	osg::Geometry *createGeometry(float cellFraction = 0) {
+		osg::Geometry *geom = new osg::Geometry();
+		geom->setUseDisplayList(false);
+		geom->setUseVertexBufferObjects(true);
+		geom->setVertexArray(restVertices.get());
+		geom->setNormalArray(restNormals.get()); geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+		geom->setTexCoordArray(0, texCoords.get());
+
+		if (!vertexIndices.valid()) {
+			vertexIndices = new osg::FloatArray(vertexCount);
+			for (int i=0; i<vertexCount; i++) (*vertexIndices)[i] = i;
+		}
+		geom->setVertexAttribArray(vertexIndexAttrib, vertexIndices.get());
+		geom->setVertexAttribBinding(vertexIndexAttrib, osg::Geometry::BIND_PER_VERTEX);
+
+		std::vector<unsigned int> triangles = cellFraction>0 ? decimate(cellFraction) : indices;
+		osg::DrawElementsUInt *draw = new osg::DrawElementsUInt(GL_TRIANGLES, triangles.begin(), triangles.end());
+		geom->addPrimitiveSet(draw);
+		return geom;
+	}
+
+	// Vertex clustering on the first frame: vertices in the same cell of a grid cellFraction of the mesh's
+	// size collapse onto the first of them and triangles left without area are dropped. The survivors are
+	// still baked vertices, so the decimated mesh animates with the same textures.
+	std::vector<unsigned int> decimate(float cellFraction) {
+		float cell = MAX(boundsExtent.x(), MAX(boundsExtent.y(), boundsExtent.z()))*cellFraction;
+		std::map<long long, unsigned int> clusters;
+		std::vector<unsigned int> representative(vertexCount);
+		for (int i=0; i<vertexCount; i++) {
+			osg::Vec3 p = ((*restVertices)[i]-boundsMin)/cell;
+			long long key = ((long long)p.x()<<42) | ((long long)p.y()<<21) | (long long)p.z();
+			std::map<long long, unsigned int>::iterator it = clusters.find(key);
+			if (it==clusters.end()) it = clusters.insert(std::make_pair(key, (unsigned int)i)).first;
+			representative[i] = it->second;
+		}
+
+		std::vector<unsigned int> triangles;
+		for (int i=0; i+2<indices.size(); i+=3) {
+			unsigned int a = representative[indices[i]], b = representative[indices[i+1]], c = representative[indices[i+2]];
+			if (a==b || b==c || a==c) continue;
+			triangles.push_back(a); triangles.push_back(b); triangles.push_back(c);
+		}
+		return triangles;
+	}
+
+	// A baked vertex decoded on the CPU
+	osg::Vec3 getPosition(int frame, int vertex) {
+		const unsigned short *p = (const unsigned short*)positionImage->data() + 4*(frame*vertexCount + vertex);
+		return osg::Vec3(boundsMin.x() + boundsExtent.x()*p[0]/65535.0f, boundsMin.y() + boundsExtent.y()*p[1]/65535.0f, boundsMin.z() + boundsExtent.z()*p[2]/65535.0f);
+	}
+
+	osg::Vec3 getNormal(int frame, int vertex) {
+		const unsigned char *n = normalImage->data() + 4*(frame*vertexCount + vertex);
+		osg::Vec3 normal(n[0]/127.5f-1.0f, n[1]/127.5f-1.0f, n[2]/127.5f-1.0f); normal.normalize();
+		return normal;
+	}
+
+	osg::Vec2 getTexCoord(int vertex) { return (*texCoords)[vertex]; }
+
+	// Binds the baked textures to units unit and unit+1 along with the uniforms vertexAnimationSource() needs
+	void apply(osg::StateSet *ss, int unit, osg::Program *program) {
+		ss->setTextureAttributeAndModes(unit, positionTexture.get());
+		ss->setTextureAttributeAndModes(unit+1, normalTexture.get());
+		ss->addUniform(new osg::Uniform("vatPositions", unit));
+		ss->addUniform(new osg::Uniform("vatNormals", unit+1));
+		ss->addUniform(new osg::Uniform("vatMin", boundsMin));
+		ss->addUniform(new osg::Uniform("vatExtent", boundsExtent));
+		ss->addUniform(new osg::Uniform("vatVertexCount", float(vertexCount)));
+		program->addBindAttribLocation("vertexIndex", vertexIndexAttrib);
+	}
+
+	// GLSL declaring vertexIndex and vatSample(), which returns the interpolated position and normal of this vertex
+	static const char *vertexAnimationSource() {
+		return
+			"#extension GL_ARB_texture_rectangle : enable\n"
+			"uniform sampler2DRect vatPositions, vatNormals;\n"
+			"uniform vec3 vatMin, vatExtent;\n"
+			"uniform float vatVertexCount;\n"
+			"attribute float vertexIndex;\n"
+			"vec2 vatTexel(float frame) {\n"
+			"	float i = frame*vatVertexCount + vertexIndex;\n"
+			"	return vec2(mod(i, 1024.0), floor(i/1024.0)) + 0.5;\n"
+			"}\n"
+			"void vatSample(float frameA, float frameB, float blend, out vec3 position, out vec3 normal) {\n"
+			"	vec2 a = vatTexel(frameA), b = vatTexel(frameB);\n"
+			"	position = vatMin + vatExtent*mix(texture2DRect(vatPositions, a).xyz, texture2DRect(vatPositions, b).xyz, blend);\n"
+			"	normal = normalize(mix(texture2DRect(vatNormals, a).xyz, texture2DRect(vatNormals, b).xyz, blend)*2.0 - 1.0);\n"
+			"}\n";
+	}
+
+	// Bounds of the mesh over every baked frame
+	osg::BoundingBox getBound() { return osg::BoundingBox(boundsMin, boundsMin+boundsExtent); }
+
+	static const int vertexIndexAttrib = 6;
+
+private:
+	static const int textureWidth = 1024;
+
+	std::vector<AnimationClip> clips;
+	std::vector<int> clipStart, frames;
+
+	int vertexCount;
+	std::vector<unsigned int> indices, sources;
+	osg::ref_ptr<osg::Vec3Array> restVertices, restNormals;
+	osg::ref_ptr<osg::Vec2Array> texCoords;
+	osg::ref_ptr<osg::FloatArray> vertexIndices;
+	osg::ref_ptr<osg::StateSet> stateSet;
+	osg::Vec3 boundsMin, boundsExtent;
+	osg::ref_ptr<osg::Image> positionImage, normalImage;
+	osg::ref_ptr<osg::TextureRectangle> positionTexture, normalTexture;
+
+	// Merges triangle corners that have the same texture coordinate, position and normal in every frame
+	void weld(SpiderMeshFrames *mesh) {
+		int corners = mesh->getTexCoords()->size();
+		std::multimap<unsigned int, unsigned int> seen;
+		std::vector<unsigned int> hashes(corners);
+		for (int i=0; i<corners; i++) {
+			const osg::Vec2 &t = (*mesh->getTexCoords())[i];
+			unsigned int h = hashFloat(2166136261u, t.x()); h = hashFloat(h, t.y());
+			for (int f=0; f<mesh->getFrameCount(); f++) {
+				const osg::Vec3 &v = (*mesh->getVertices(f))[i];
+				h = hashFloat(hashFloat(hashFloat(h, v.x()), v.y()), v.z());
+			}
+			hashes[i] = h;
+		}
+
+		for (int i=0; i<corners; i++) {
+			int found = -1;
+			std::pair<std::multimap<unsigned int, unsigned int>::iterator, std::multimap<unsigned int, unsigned int>::iterator> range = seen.equal_range(hashes[i]);
+			for (std::multimap<unsigned int, unsigned int>::iterator it = range.first; it != range.second && found<0; it++) {
+				if (sameCorner(mesh, sources[it->second], i)) found = it->second;
+			}
+			if (found<0) {
+				found = sources.size();
+				sources.push_back(i);
+				seen.insert(std::make_pair(hashes[i], (unsigned int)found));
+			}
+			indices.push_back(found);
+		}
+		vertexCount = sources.size();
+
+		texCoords = new osg::Vec2Array(vertexCount);
+		for (int i=0; i<vertexCount; i++) (*texCoords)[i] = (*mesh->getTexCoords())[sources[i]];
+	}
+
+	static unsigned int hashFloat(unsigned int h, float value) {
+		unsigned char *b = (unsigned char*)&value;
+		for (int i=0; i<sizeof(float); i++) { h ^= b[i]; h *= 16777619u; }
+		return h;
+	}
+
+	static bool sameCorner(SpiderMeshFrames *mesh, int a, int b) {
+		if ((*mesh->getTexCoords())[a] != (*mesh->getTexCoords())[b]) return false;
+		for (int f=0; f<mesh->getFrameCount(); f++) {
+			if ((*mesh->getVertices(f))[a] != (*mesh->getVertices(f))[b]) return false;
+			if ((*mesh->getNormals(f))[a] != (*mesh->getNormals(f))[b]) return false;
+		}
+		return true;
+	}
+
+	void bake(SpiderMeshFrames *mesh) {
+		osg::BoundingBox bb;
+		for (int f=0; f<frames.size(); f++) {
+			osg::Vec3Array *v = mesh->getVertices(frames[f]);
+			for (int i=0; i<vertexCount; i++) bb.expandBy((*v)[sources[i]]);
+		}
+		boundsMin = bb._min; boundsExtent = bb._max-bb._min;
+		for (int k=0; k<3; k++) if (boundsExtent[k]<=0) boundsExtent[k] = 1;
+
+		int texels = frames.size()*vertexCount, rows = (texels+textureWidth-1)/textureWidth;
+		positionImage = new osg::Image(); normalImage = new osg::Image();
+		osg::Image *positions = positionImage.get(), *normals = normalImage.get();
+		positions->allocateImage(textureWidth, rows, 1, GL_RGBA, GL_UNSIGNED_SHORT); positions->setInternalTextureFormat(GL_RGBA16);
+		normals->allocateImage(textureWidth, rows, 1, GL_RGBA, GL_UNSIGNED_BYTE); normals->setInternalTextureFormat(GL_RGBA8);
+		memset(positions->data(), 0, positions->getTotalSizeInBytes()); memset(normals->data(), 0, normals->getTotalSizeInBytes());
+
+		unsigned short *p = (unsigned short*)positions->data(); unsigned char *n = normals->data();
+		for (int f=0; f<frames.size(); f++) {
+			osg::Vec3Array *v = mesh->getVertices(frames[f]), *vn = mesh->getNormals(frames[f]);
+			for (int i=0; i<vertexCount; i++, p+=4, n+=4) {
+				const osg::Vec3 &pos = (*v)[sources[i]], &nor = (*vn)[sources[i]];
+				for (int k=0; k<3; k++) {
+					p[k] = (unsigned short)((pos[k]-boundsMin[k])/boundsExtent[k]*65535.0f + 0.5f);
+					n[k] = (unsigned char)(MIN(MAX(nor[k], -1.0f), 1.0f)*127.5f + 127.5f);
+				}
+			}
+		}
+
+		positionTexture = createTexture(positions);
+		normalTexture = createTexture(normals);
+
+		//Kept for bounds and drawing without the shader
+		restVertices = new osg::Vec3Array(vertexCount); restNormals = new osg::Vec3Array(vertexCount);
+		for (int i=0; i<vertexCount; i++) {
+			(*restVertices)[i] = (*mesh->getVertices(frames[0]))[sources[i]];
+			(*restNormals)[i] = (*mesh->getNormals(frames[0]))[sources[i]];
+		}
+	}
+
+	static osg::TextureRectangle *createTexture(osg::Image *image) {
+		osg::TextureRectangle *texture = new osg::TextureRectangle(image);
+		texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+		texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+		texture->setUnRefImageDataAfterApply(true);
+		return texture;
+	}
+};
+
+#endif
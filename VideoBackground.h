@@ -0,0 +1,131 @@
+#ifndef VIDEOBACKGROUND_H
+#define VIDEOBACKGROUND_H
+
+#include <cv.h>
+#include <string.h>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/TextureRectangle>
+#include <osg/BufferObject>
+#include <osg/Version>
+
+#ifndef GL_BGR
+#define GL_BGR 0x80E0
+#endif
+
+#if OSG_MIN_VERSION_REQUIRED(2,9,7)
+typedef osg::GLBufferObject::Extensions BufferExtensions;
+inline BufferExtensions *getBufferExtensions(unsigned int contextID) { return osg::GLBufferObject::getExtensions(contextID, true); }
+#else
+typedef osg::BufferObject::Extensions BufferExtensions;
+inline BufferExtensions *getBufferExtensions(unsigned int contextID) { return osg::BufferObject::getExtensions(contextID, true); }
+#endif
+
+// Streams camera frames into a rectangle texture at their native size. The BGR rows are handed to
+// GL as they are (GL_BGR, 4 byte row alignment as IplImage uses), so there is no resize or channel
+// swap on the CPU. Each frame is copied into one of two pixel buffer objects in turn and the texture
+// is updated from it, so writing a frame never waits on the GPU still reading the previous one.
+// Without PBO support (some software GL) frames are uploaded straight from client memory.
+class VideoSubloadCallback : public osg::TextureRectangle::SubloadCallback {
+public:
+	VideoSubloadCallback() { frame = 0; frameId = 0; }
+
+	void setFrame(IplImage *_frame) { frame = _frame; frameId++; }
+
+	virtual void load(const osg::TextureRectangle &texture, osg::State &state) const {
+		glTexImage2D(texture.getTextureTarget(), 0, GL_RGB8, texture.getTextureWidth(), texture.getTextureHeight(), 0, GL_BGR, GL_UNSIGNED_BYTE, 0);
+		subload(texture, state);
+	}
+
+	virtual void subload(const osg::TextureRectangle &texture, osg::State &state) const {
+		ContextBuffers &cb = contextBuffers[state.getContextID()];
+		if (frame==0 || cb.uploadedId==frameId) return;
+		if (frame->width!=texture.getTextureWidth() || frame->height!=texture.getTextureHeight()) return;
+
+		BufferExtensions *ext = getBufferExtensions(state.getContextID());
+		int size = frame->widthStep*frame->height;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+		if (ext->isPBOSupported()) {
+			if (cb.pbo[0]==0) ext->glGenBuffers(2, cb.pbo);
+			GLuint pbo = cb.pbo[cb.next]; cb.next = 1-cb.next;
+
+			ext->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, pbo);
+			//Orphan the old storage so the driver can hand out fresh memory rather than sync
+			ext->glBufferData(GL_PIXEL_UNPACK_BUFFER_ARB, size, 0, GL_STREAM_DRAW_ARB);
+			void *dst = ext->glMapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+			if (dst) {
+				memcpy(dst, frame->imageData, size);
+				ext->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER_ARB);
+				glTexSubImage2D(texture.getTextureTarget(), 0, 0, 0, frame->width, frame->height, GL_BGR, GL_UNSIGNED_BYTE, 0);
+			}
+			ext->glBindBuffer(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+		} else {
+			glTexSubImage2D(texture.getTextureTarget(), 0, 0, 0, frame->width, frame->height, GL_BGR, GL_UNSIGNED_BYTE, frame->imageData);
+		}
+
+		cb.uploadedId = frameId;
+	}
+
+private:
+	struct ContextBuffers {
+		ContextBuffers() { pbo[0] = pbo[1] = 0; next = 0; uploadedId = 0; }
+		GLuint pbo[2];
+		int next;
+		unsigned int uploadedId;
+	};
+
+	IplImage *frame;
+	unsigned int frameId;
+	mutable osg::buffered_object<ContextBuffers> contextBuffers;
+};
+
+// A full window quad showing the camera frames, its texture sized to match the frames
+class VideoBackground : public osg::Geode {
+public:
+	VideoBackground(int _width, int _height) : osg::Geode() {
+		width = _width; height = _height;
+		videoWidth = 0; videoHeight = 0;
+
+		texture = new osg::TextureRectangle();
+		texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+		texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+		texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+		texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+		texture->setDataVariance(osg::Object::DYNAMIC);
+
+		subload = new VideoSubloadCallback();
+		texture->setSubloadCallback(subload.get());
+	}
+
+	// The frame must stay valid until it has been drawn
+	void setFrame(IplImage *frame) {
+		if (frame->width!=videoWidth || frame->height!=videoHeight) resize(frame->width, frame->height);
+		subload->setFrame(frame);
+	}
+
+private:
+	int width, height, videoWidth, videoHeight;
+	osg::ref_ptr<osg::TextureRectangle> texture;
+	osg::ref_ptr<VideoSubloadCallback> subload;
+
+	// Rectangle textures are addressed in texels, so the quad is rebuilt whenever the video size changes
+	void resize(int w, int h) {
+		videoWidth = w; videoHeight = h;
+		texture->setTextureSize(w, h);
+		texture->dirtyTextureObject();
+
+		removeDrawables(0, getNumDrawables());
+		osg::ref_ptr<osg::Geometry> quad = osg::createTexturedQuadGeometry(osg::Vec3(0, 0, 0), osg::X_AXIS * width, osg::Y_AXIS * height, 0, h, w, 0);
+		quad->getOrCreateStateSet()->setTextureAttributeAndModes(0, texture.get());
+		quad->setUseDisplayList(false);
+
+		//Dynamic, so threaded draws finish with the frame before the next one is handed over
+		quad->setDataVariance(osg::Object::DYNAMIC); quad->getStateSet()->setDataVariance(osg::Object::DYNAMIC);
+		addDrawable(quad.get());
+	}
+};
+
+#endif
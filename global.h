@@ -1,7 +1,6 @@
-#ifndef GLOBAL_H
-#define GLOBAL_H
-
-void checkKeyPress(int key);
-float getSpiderHeight();
-
-#endif
+#ifndef GLOBAL_H
+#define GLOBAL_H
+
+void checkKeyPress(int key);
+
+#endif
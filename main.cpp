@@ -1,180 +1,512 @@
-#define _CRTDBG_MAP_ALLOC
-#include <stdlib.h>
-#include <crtdbg.h>
-
-#include "Kinect.h"
-
-#include "stdlib.h"
-#include "GL\glut.h"
-
-#include "OpiraLibraryMT.h"
-#include "OpiraLibrary.h"
-#include "CaptureLibrary.h"
-#include "RegistrationAlgorithms\OCVSurf.h"
-#include "RegistrationAlgorithms\SIFT.h"
-
-#include "global.h"
-#include "spider.h"
-
-#include "Renderer.h"
-
-using namespace OPIRALibrary;
-
-bool running = true;
-bool bRegKinect = false;
-
-Spider *spider;
-KinectAR *kinect;
-
-void main(int argc, char **argv) {
-	_CrtSetDbgFlag ( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
-	_CrtSetReportMode ( _CRT_ERROR, _CRTDBG_MODE_DEBUG);
-//	_CrtSetBreakAlloc(20226);
-
-	//Initialise our Camera
-	Capture* camera = new Camera(0,cvSize(640,480), "Data/camera.yml");
-	((Camera*)camera)->setAutoWhiteBalance(false);
-
-	//Initialise the Kinect
-	kinect = new KinectAR("Data/SamplesConfig.xml", "Data/kinect.yml");
-
-	//Initialise the Registration Class
-	Registration *regAR = new RegistrationOPIRAMT(new OCVSurf()); 
-	Registration *regKinect = new RegistrationOPIRAMT(new OCVSurf()); regKinect->addResizedMarker("media/celica.bmp", 400);
-
-	//Initialise the Spider
-	spider = new Spider("media/spider01.ive", "media/animations.xml");
-
-	//Initialise the OpenSceneGraph Renderer
-	Renderer *renderer = new Renderer(640, 480, calcProjection(camera->getParameters(), camera->getDistortion(), cvSize(640,480)));
-	renderer->addModel("media/celica.bmp", spider->getModel());
-
-	
-	while (running) {
-		//Grab a frame from the AR Camera
-		IplImage *new_frame = camera->getFrame();
-
-		//Grab a frame from the Kinect
-		kinect->getNewFrame();
-		IplImage *kinectColour = kinect->getColour();
-		IplImage *kinectDepth = kinect->getDepth();
-		IplImage *kinectDepthMask = kinect->getDepthMask();
-
-		if (bRegKinect) {
-			vector<MarkerTransform> mt = regKinect->performRegistration(kinectColour, kinect->getParameters(), kinect->getDistortion());
-			if (mt.size()>0) kinect->calculateTransform(mt.at(0).marker.size, mt.at(0).homography);
-			for (int i=0; i<mt.size(); i++) {mt.at(i).clear();} mt.clear(); 
-
-			regAR->removeMarker("media/celica.bmp");
-			regAR->addResizedScaledMarker("media/celica.bmp", 400, kinect->getRealMarkerSize().width);
-			printf("load: %d\t %d\n", kinect->getRealMarkerSize().width, kinect->getRealMarkerSize().height);
-
-			bRegKinect = false;
-		}
-
-		double minV, maxV; CvPoint minL, maxL;
-		cvMinMaxLoc(kinectDepth, &minV, &maxV, &minL, &maxL, kinectDepthMask);
-		//printf("%f - %f\n", minV, maxV);
-		double scale = 255.0/float(maxV-minV), shift = minV*scale;
-		IplImage *depthIm8 = cvCreateImage(cvGetSize(kinectDepth), 8, 1); IplImage *depthIm83 = cvCreateImage(cvGetSize(kinectDepth), 8, 3);
-		
-		cvConvertScale(kinectDepth, depthIm8, scale, -shift); cvMerge(depthIm8, depthIm8, depthIm8, 0, depthIm83);
-		cvCircle(depthIm83, minL, 3, cvScalar(255,0,0), 2); cvCircle(depthIm83, maxL, 3, cvScalar(0,0,255), 2);
-		CvPoint3D32f p = kinect->getTransformedPoint(minL); p.y = -p.y; osg::Vec3 sP = spider->getPosition();
-		if (!spider->isAnimating()) {
-			float dist = sqrt((p.x-sP.x())*(p.x-sP.x())+(p.y-sP.y())*(p.y-sP.y()));
-			//printf("D: %f\n", dist);
-			if (dist>50) spider->moveTo(p.x, p.y, 0);
-		}
-		//printf("%.2f, %.2f, %.2f\t%.2f, %.2f, %.2f\n", p.x, p.y, p.z, sP.x(), sP.y(), sP.z());
-		cvShowImage("col", kinectColour); cvShowImage("depth", depthIm83); cvShowImage("depthMask", kinectDepthMask);
-		cvReleaseImage(&depthIm8); cvReleaseImage(&depthIm83);
-
-		if (new_frame!=0) {
-			vector<MarkerTransform> mt = regAR->performRegistration(new_frame, camera->getParameters(), camera->getDistortion());
-
-			/*if (kinect->getTransform()!=0) {
-				CvPoint *p = (CvPoint *)malloc(640*480*sizeof(CvPoint));
-				for (int y=0; y<480; y++) {
-					for (int x=0; x<640; x++) {
-						p[x+(y*640)].x = x; p[x+(y*640)].y = y;
-					}
-				}
-				CvPoint3D32f *ground_grid = kinect->getTransformedPoints(p,640*480);
-				renderer->updateHeightMap(ground_grid);
-				free(p); free(ground_grid);
-			}*/
-
-
-			renderer->render(new_frame, mt);
-
-			for (int i=0; i<mt.size(); i++) {mt.at(i).clear();} mt.clear();
-
-			//Check for the escape key and give the computer some processing time
-			checkKeyPress (cvWaitKey(1));
-		
-		}
-
-		//Clean up
-		cvReleaseImage(&new_frame);
-		cvReleaseImage(&kinectColour);
-		cvReleaseImage(&kinectDepth);
-		cvReleaseImage(&kinectDepthMask);
-
-	};
-
-	delete renderer;
-	delete spider;
-	delete regAR; delete regKinect;
-	delete camera; delete kinect;
-}
-
-void checkKeyPress(int key) {
-	switch (key) {
-		/*case 'q':
-			spider->setPosition(0, 0, 0); break;
-		case 'w':
-			spider->setPosition(kinect->getRealMarkerSize().width, 0, 0); break;
-		case 'e':
-			spider->setPosition(kinect->getRealMarkerSize().width, -kinect->getRealMarkerSize().height, 0); break;
-		case 'r':
-			spider->setPosition(0, -kinect->getRealMarkerSize().height, 0); break;*/
-		case 'q':
-			spider->moveTo(0, 0, 0); break;
-		case 'w':
-			spider->moveTo(kinect->getRealMarkerSize().width, 0, 0); break;
-		case 'e':
-			spider->moveTo(kinect->getRealMarkerSize().width, -kinect->getRealMarkerSize().height, 0); break;
-		case 'r':
-			spider->moveTo(0, -kinect->getRealMarkerSize().height, 0); break;
-		case 27:
-			running = false; break;
-			break;
-		case ' ':
-			bRegKinect = true; break;
-		case '1':
-			spider->setAnimation(1); break;
-		case '2':
-			spider->setAnimation(2); break;
-		case '3':
-			spider->setAnimation(3); break;
-		case '4':
-			spider->setAnimation(4); break;
-		case '5':
-			spider->setAnimation(5); break;
-		case '6':
-			spider->setAnimation(6); break;
-		case '7':
-			spider->setAnimation(7); break;
-		case '8':
-			spider->setAnimation(8); break;
-		case '9':
-			spider->setAnimation(9); break;
-	}
-}
-
-float getSpiderHeight() {
-	osg::Vec3 sP = spider->getPosition();
-	CvPoint3D32f p = kinect->getInverseTransformedPoint(cvPoint3D32f(sP.x(), -sP.y(), sP.z()));
-	return kinect->getTransformedPoint(cvPoint(p.x, p.y)).z;
+#ifdef _MSC_VER
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+#include <float.h>
+
+#include "Kinect.h"
+
+#include "stdlib.h"
+#include "GL\glut.h"
+
+#include "OpiraLibraryMT.h"
+#include "OpiraLibrary.h"
+#include "CaptureLibrary.h"
+#include "RegistrationAlgorithms\OCVSurf.h"
+#include "RegistrationAlgorithms\SIFT.h"
+
+#include "global.h"
+#include "spider.h"
+
+#include "Renderer.h"
+#include "MarkerRegistration.h"
+#include "MarkerTracker.h"
+#include "PyramidRegistration.h"
+#include "PoseFilter.h"
+#include "SceneChangeDetector.h"
+#include "BinaryRegistration.h"
+#include "SurfRegistration.h"
+#include "RegistrationBenchmark.h"
+#include "DepthOcclusion.h"
+#include "Swarm.h"
+#include "Steering.h"
+#include "OccupancyGrid.h"
+#include "PathPlanner.h"
+#include "GroundHeightMap.h"
+#include "HeightFieldRaycaster.h"
+#include "Profiler.h"
+#include "Latency.h"
+//The allocation hooks are defined here, once for the executable
+#define ALLOCATION_TRACKER_HOOKS
+#include "AllocationTracker.h"
+
+using namespace OPIRALibrary;
+
+//Set from key presses on either the main or the render thread
+volatile bool running = true;
+volatile bool bRegKinect = false;
+
+//Registration is performed every regInterval frames, the pose filter predicts the frames between
+int regInterval = 1;
+
+//Spacing in depth pixels of the heightfield mesh vertices, 0 to disable the heightfield
+int heightFieldStep = 0;
+
+//Hide the spider behind real objects using the Kinect depth
+bool occlusion = false;
+
+//Number of extra spiders swarming over the marker, 0 for just the one
+int swarmSize = 0;
+
+//Replace the hand with one jumping across the marker every few seconds and time the spider's reaction
+bool latencyTest = false;
+
+//Run recorded or synthetic frames through the loop as fast as it goes and report how long it took,
+//replayFrames frames are timed after replayWarmup frames
+char *replaySource = 0;
+int replayFrames = 0;
+const int replayWarmup = 10;
+
+//The marker area assumed until the Kinect has been calibrated against the marker, an A4 sheet in mm
+const CvSize defaultMarkerSize = cvSize(297, 210);
+
+Spider *spider;
+KinectAR *kinect;
+
+//Create the registration algorithm selected on the command line ("surf" or "binary")
+MarkerRegistration *createRegistration(string features) {
+	if (features=="binary") return new BinaryRegistration();
+	if (features=="tiled-surf") return new SurfRegistration();
+	return new OPIRARegistration(new RegistrationOPIRAMT(new OCVSurf()));
+}
+
+int main(int argc, char **argv) {
+#ifdef _MSC_VER
+	_CrtSetDbgFlag ( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
+	_CrtSetReportMode ( _CRT_ERROR, _CRTDBG_MODE_DEBUG);
+//	_CrtSetBreakAlloc(20226);
+#endif
+
+	//Parse the command line
+	string features = "surf", threading = "single"; char *benchmarkSource = 0, *markerList = 0, *profileName = 0;
+	bool allocTrack = false; int allocBudget = -1;
+	char *kinectSource = "Data/SamplesConfig.xml";
+	for (int i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-features")==0 && i+1<argc) features = argv[++i];
+		else if (strcmp(argv[i], "-benchreg")==0 && i+1<argc) benchmarkSource = argv[++i];
+		else if (strcmp(argv[i], "-markers")==0 && i+1<argc) markerList = argv[++i];
+		else if (strcmp(argv[i], "-threading")==0 && i+1<argc) threading = argv[++i];
+		else if (strcmp(argv[i], "-heightfield")==0 && i+1<argc) heightFieldStep = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-occlusion")==0) occlusion = true;
+		else if (strcmp(argv[i], "-swarm")==0 && i+1<argc) swarmSize = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-profile")==0 && i+1<argc) profileName = argv[++i];
+		else if (strcmp(argv[i], "-latencytest")==0) latencyTest = true;
+		else if (strcmp(argv[i], "-alloctrack")==0) allocTrack = true;
+		else if (strcmp(argv[i], "-replay")==0 && i+1<argc) replaySource = argv[++i];
+		else if (strcmp(argv[i], "-replayframes")==0 && i+1<argc) replayFrames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-kinect")==0 && i+1<argc) kinectSource = argv[++i];
+		else if (strcmp(argv[i], "-allocbudget")==0 && i+1<argc) { allocTrack = true; allocBudget = atoi(argv[++i]); }
+	}
+	if (latencyTest && profileName==0) profileName = "latency";
+	if (replaySource && profileName==0) profileName = "replay";
+
+	//Time each stage of the frame, written to <name>.csv and <name>.json on exit
+	if (profileName) {
+		profiler().setEnabled(true, true);
+		profiler().nameThread("main");
+	}
+
+	//Count allocations per frame and subsystem, aborting on a frame over the budget once warmed up
+	if (allocTrack) allocationTracker().setEnabled(true, allocBudget, 30, allocBudget>=0);
+
+	//Compare the registration algorithms on recorded frames instead of running live
+	if (benchmarkSource) {
+		vector<MarkerRegistration*> regs; vector<string> names;
+		names.push_back("surf"); names.push_back("tiled-surf"); names.push_back("binary");
+		for (int i=0; i<names.size(); i++) {
+			regs.push_back(createRegistration(names.at(i)));
+			regs.at(i)->addResizedMarker("media/celica.bmp", 400);
+		}
+		benchmarkRegistration(regs, names, benchmarkSource, "Data/camera.yml", "registration_benchmark.csv");
+		for (int i=0; i<regs.size(); i++) delete regs.at(i);
+		return 0;
+	}
+
+	//Initialise our Camera, or the frames replayed in its place ("synthetic" to make some)
+	Capture* camera = 0; CvMat *cameraParams, *cameraDistortion;
+	vector<IplImage*> replay;
+	if (replaySource) {
+		replay = strcmp(replaySource, "synthetic")==0 ? createSyntheticFrames("media/celica.bmp", cvSize(640,480), 300) : loadRecordedFrames(replaySource);
+		if (replay.empty()) { printf("No frames could be loaded from %s\n", replaySource); return 1; }
+		if (!loadCameraParameters("Data/camera.yml", cvGetSize(replay.at(0)), &cameraParams, &cameraDistortion)) { printf("Could not load Data/camera.yml\n"); return 1; }
+		if (replayFrames<=0) replayFrames = replay.size();
+	} else {
+		camera = new Camera(0,cvSize(640,480), "Data/camera.yml");
+		((Camera*)camera)->setAutoWhiteBalance(false);
+		cameraParams = camera->getParameters(); cameraDistortion = camera->getDistortion();
+	}
+
+	//Initialise the Kinect, or play back a recording of it given with -kinect
+	kinect = new KinectAR(kinectSource, "Data/kinect.yml");
+
+	//Initialise the Registration Class
+	StaticSceneRegistration *staticAR = new StaticSceneRegistration(new MarkerTracker(new PyramidRegistration(createRegistration(features), 1)));
+	MarkerRegistration *regAR = staticAR;
+	Registration *regKinect = new RegistrationOPIRAMT(new OCVSurf()); regKinect->addResizedMarker("media/celica.bmp", 400);
+
+	//Initialise the Spider, walking on the surface of the marker as the Kinect sees it
+	spider = new Spider("media/spider01.ive", "media/animations.xml");
+	GroundHeightMap *groundMap = new GroundHeightMap(0, -defaultMarkerSize.height, defaultMarkerSize.width, 0, 10);
+	spider->setGroundHeightMap(groundMap);
+
+	//Initialise the OpenSceneGraph Renderer
+	osgViewer::ViewerBase::ThreadingModel threadingModel = osgViewer::Viewer::SingleThreaded;
+	if (threading=="cull-draw") threadingModel = osgViewer::Viewer::CullDrawThreadPerContext;
+	else if (threading=="draw") threadingModel = osgViewer::Viewer::DrawThreadPerContext;
+	double *projection = calcProjection(cameraParams, cameraDistortion, cvSize(640,480));
+	Renderer *renderer = new Renderer(640, 480, projection, threadingModel, replaySource!=0);
+	osg::ref_ptr<osg::Group> spiderScene = new osg::Group(); spiderScene->addChild(spider->getModel());
+
+	//The swarm wanders the marker on its own, spiders start anywhere on it walking or idling. Until the Kinect
+	//is calibrated that's the default marker area, they're spread over the real one once it is.
+	VertexAnimation *swarmAnimation = 0; SpiderSwarm *swarm = 0; CrowdSimulation *crowd = 0;
+	if (swarmSize>0) {
+		SpiderMeshFrames *frames = new SpiderMeshFrames("media/spider01.ive");
+		swarmAnimation = new VertexAnimation(frames, readAnimationClips("media/animations.xml"));
+		delete frames;
+		swarm = new SpiderSwarm(swarmAnimation, swarmSize);
+		CvSize area = defaultMarkerSize;
+		for (int i=0; i<swarmSize; i++) {
+			swarm->addSpider(area.width*float(rand())/RAND_MAX, -area.height*float(rand())/RAND_MAX, 0, 2*osg::PI*rand()/RAND_MAX, rand()%2 ? 1 : 5);
+		}
+		swarm->setArea(0, -area.height, area.width, 0);
+		swarm->setGroundHeightMap(groundMap);
+
+		//The swarm steers on its own thread, following the spider and fleeing the hand
+		SpiderSwarm::State &s = swarm->getState();
+		crowd = new CrowdSimulation(&s.x[0], &s.y[0], s.size(), 0, -area.height, area.width, 0, swarm->getRadius());
+		swarm->setSimulation(crowd);
+		spiderScene->addChild(swarm);
+	}
+	renderer->addModel("media/celica.bmp", spiderScene.get());
+	renderer->setHeightFieldMarker("media/celica.bmp");
+
+	//Additional markers, one image filename per line, each showing the spider
+	vector<string> extraMarkers;
+	if (markerList) {
+		FILE *list = fopen(markerList, "r"); char line[1024];
+		if (list==0) printf("Could not open marker list %s\n", markerList);
+		while (list && fgets(line, sizeof(line), list)) {
+			string markerName = line;
+			markerName.erase(markerName.find_last_not_of(" \t\r\n")+1);
+			if (markerName.empty() || markerName=="media/celica.bmp") continue;
+			regAR->addResizedMarker(markerName, 400);
+			renderer->addModel(markerName, spider->getModel());
+			extraMarkers.push_back(markerName);
+		}
+		if (list) fclose(list);
+	}
+
+	//Initialise the Pose Filter
+	PoseFilter *poseFilter = new PoseFilter();
+	int frameCount = 0;
+	vector<CvPoint> heightSamples;
+
+	//The ground height and the obstacles the spider walks around are found from every groundStep'th depth pixel
+	const int groundStep = 4;
+	OccupancyGrid *occupancy = new OccupancyGrid(0, -defaultMarkerSize.height, defaultMarkerSize.width, 0, 10);
+	PathPlanner *planner = new PathPlanner(occupancy);
+	vector<CvPoint> groundSamples; vector<osg::Vec2> path; vector<osg::Vec3> waypoints;
+
+	//Swarm spiders only flee the hand when nothing on the table hides it from them
+	HeightFieldRaycaster *raycaster = crowd ? new HeightFieldRaycaster() : 0;
+	vector<float> crowdX, crowdY, crowdZ, crowdHeading, crowdSpeed, handX, handY, handZ;
+	vector<unsigned char> handBlocked, handVisible;
+
+	//Initialise the Occlusion
+	DepthReprojector *reprojector = occlusion ? new DepthReprojector(640, 480, projection) : 0;
+	float xzFactor, yzFactor; kinect->getRealWorldFactors(xzFactor, yzFactor);
+
+	//Spans from the camera frame, the rest of the chain is timed by the renderer and the spider
+	int cameraToRegistered = profiler().stage("latency.camera_to_registered");
+	const double latencyStepPeriod = 3.0; int latencySide = -1;
+
+	//Replays calibrate the Kinect in their warm up frames and draw as fast as they can
+	int replayed = 0, replayRendered = 0; vector<double> replayFrameTimes; osg::Timer_t replayStart = 0; bool replayFailed = false;
+	if (replaySource) { bRegKinect = true; renderer->setMaxFrameRate(0); }
+
+	renderer->start();
+	if (crowd) crowd->start();
+	
+	while (running) {
+		PROFILE_SCOPE("main.frame");
+		osg::Timer_t frameTick = osg::Timer::instance()->tick();
+
+		//Grab a frame from the AR Camera
+		IplImage *new_frame;
+		{
+			PROFILE_SCOPE("main.capture");
+			new_frame = replaySource ? cvCloneImage(replay.at(replayed % replay.size())) : camera->getFrame();
+		}
+		double captureTime = osg::Timer::instance()->time_s();
+		osg::Timer_t captureTick = osg::Timer::instance()->tick();
+
+		//Grab a frame from the Kinect
+		kinect->getNewFrame();
+		IplImage *kinectColour = kinect->getColour();
+		IplImage *kinectDepth = kinect->getDepth();
+		IplImage *kinectDepthMask = kinect->getDepthMask();
+
+		if (bRegKinect) {
+			PROFILE_SCOPE("main.kinectRegistration"); ALLOCATION_SCOPE("registration");
+			vector<MarkerTransform> mt = regKinect->performRegistration(kinectColour, kinect->getParameters(), kinect->getDistortion());
+			bool calibrated = mt.size()>0 && kinect->calculateTransform(mt.at(0).marker.size, mt.at(0).homography);
+			for (int i=0; i<mt.size(); i++) {mt.at(i).clear();} mt.clear(); 
+
+			//Only a marker size measured by a successful calibration is worth rescaling and rebuilding the grids for
+			if (calibrated) {
+				CvSize markerSize = kinect->getRealMarkerSize();
+				regAR->removeMarker("media/celica.bmp");
+				regAR->addResizedScaledMarker("media/celica.bmp", 400, markerSize.width);
+				//The Kinect only measures the celica marker, the others are taken to be printed at the same width
+				for (int i=0; i<extraMarkers.size(); i++) {
+					regAR->removeMarker(extraMarkers.at(i));
+					regAR->addResizedScaledMarker(extraMarkers.at(i), 400, markerSize.width);
+				}
+				poseFilter->clear();
+				delete planner; delete occupancy;
+				occupancy = new OccupancyGrid(0, -markerSize.height, markerSize.width, 0, 10);
+				planner = new PathPlanner(occupancy);
+				groundMap->setArea(0, -markerSize.height, markerSize.width, 0, 10);
+				//The swarm was seeded over the default area, each spider moves to the same relative place on the marker
+				if (swarm) swarm->setArea(0, -markerSize.height, markerSize.width, 0);
+				if (crowd) crowd->setBounds(0, -markerSize.height, markerSize.width, 0);
+				printf("load: %d\t %d\n", markerSize.width, markerSize.height);
+			}
+
+			//A replay keeps trying through its warm up, a timed run without the ground and planning stages compares with nothing
+			if (calibrated || !replaySource) bRegKinect = false;
+			else if (replayed>=replayWarmup-1) {
+				printf("The Kinect couldn't be calibrated against the marker in %d frames, stopping the replay\n", replayWarmup);
+				replayFailed = true; running = false;
+			}
+		}
+
+		double minV, maxV; CvPoint minL, maxL;
+		{
+			PROFILE_SCOPE("main.minMaxLoc");
+			cvMinMaxLoc(kinectDepth, &minV, &maxV, &minL, &maxL, kinectDepthMask);
+		}
+		//printf("%f - %f\n", minV, maxV);
+		double scale = 255.0/float(maxV-minV), shift = minV*scale;
+		IplImage *depthIm8, *depthIm83;
+		{
+			ALLOCATION_SCOPE("main.images");
+			depthIm8 = cvCreateImage(cvGetSize(kinectDepth), 8, 1); depthIm83 = cvCreateImage(cvGetSize(kinectDepth), 8, 3);
+		}
+		
+		cvConvertScale(kinectDepth, depthIm8, scale, -shift); cvMerge(depthIm8, depthIm8, depthIm8, 0, depthIm83);
+		cvCircle(depthIm83, minL, 3, cvScalar(255,0,0), 2); cvCircle(depthIm83, maxL, 3, cvScalar(0,0,255), 2);
+		CvPoint3D32f p = kinect->getTransformedPoint(minL); p.y = -p.y;
+
+		//A known step of the hand, taken as seen in this Kinect frame
+		if (latencyTest) {
+			int side = int(osg::Timer::instance()->time_s()/latencyStepPeriod) % 2;
+			CvSize area = kinect->getTransform()!=0 ? kinect->getRealMarkerSize() : defaultMarkerSize;
+			p = cvPoint3D32f(area.width*(side ? 0.8f : 0.2f), -area.height*0.5f, 0);
+			if (side!=latencySide) { latencyProbe().injectStep(kinect->getFrameTick()); latencySide = side; }
+		}
+
+		//Rebuild the ground height, mark the cells with something standing in them and repair the spider's plan around them
+		if (kinect->getTransform()!=0) {
+			PROFILE_SCOPE("main.ground");
+			groundSamples.clear();
+			for (int y=0; y<kinectDepth->height; y+=groundStep) {
+				unsigned short *row = (unsigned short*)(kinectDepth->imageData + y*kinectDepth->widthStep);
+				for (int x=0; x<kinectDepth->width; x+=groundStep) if (row[x]!=0) groundSamples.push_back(cvPoint(x, y));
+			}
+			if (groundSamples.size()>0) {
+				CvPoint3D32f *groundPoints = kinect->getTransformedPoints(&groundSamples[0], groundSamples.size());
+				groundMap->update(groundPoints, groundSamples.size());
+				occupancy->setHand(p.x, p.y);
+				planner->update(occupancy->update(groundPoints, groundSamples.size()));
+				free(groundPoints);
+			}
+		}
+
+		//The spider retargets every frame, so it follows the hand as it moves rather than where it was
+		osg::Vec3 sP; bool spiderAnimating; spider->getState(sP, spiderAnimating);
+		if (crowd) { crowd->setHand(p.x, p.y); crowd->setTarget(sP.x(), sP.y()); }
+		if (raycaster && kinect->getTransform()!=0 && raycaster->update(groundMap)) {
+			PROFILE_SCOPE("main.handVisibility");
+			int n = crowd->size();
+			crowdX.resize(n); crowdY.resize(n); crowdZ.resize(n); crowdHeading.resize(n); crowdSpeed.resize(n);
+			handX.resize(n); handY.resize(n); handZ.resize(n); handBlocked.resize(n); handVisible.resize(n);
+			crowd->getState(&crowdX[0], &crowdY[0], &crowdHeading[0], &crowdSpeed[0], n);
+			groundMap->getHeights(&crowdX[0], &crowdY[0], &crowdZ[0], n);
+			for (int i=0; i<n; i++) {
+				//Look from just above the spider to a point short of the hand, so the hand doesn't hide itself
+				float dx = p.x-crowdX[i], dy = p.y-crowdY[i], d = sqrt(dx*dx+dy*dy), f = d>50 ? (d-50)/d : 0;
+				crowdZ[i] += 5;
+				handX[i] = crowdX[i] + dx*f; handY[i] = crowdY[i] + dy*f; handZ[i] = crowdZ[i] + (p.z-crowdZ[i])*f;
+			}
+			raycaster->occluded(&crowdX[0], &crowdY[0], &crowdZ[0], &handX[0], &handY[0], &handZ[0], n, &handBlocked[0]);
+			for (int i=0; i<n; i++) handVisible[i] = !handBlocked[i];
+			crowd->setHandVisibility(&handVisible[0], n);
+		}
+		float dist = sqrt((p.x-sP.x())*(p.x-sP.x())+(p.y-sP.y())*(p.y-sP.y()));
+		//printf("D: %f\n", dist);
+		if (dist>50) {
+			PROFILE_SCOPE("main.plan");
+			//Head straight for the hand when there's no plan, off the marker or with no Kinect transform yet
+			if (kinect->getTransform()!=0 && planner->findPath(sP.x(), sP.y(), p.x, p.y, path)) {
+				waypoints.clear();
+				for (int i=0; i<path.size(); i++) waypoints.push_back(osg::Vec3(path.at(i).x(), path.at(i).y(), 0));
+				spider->requestMoveAlong(waypoints, kinect->getFrameTick());
+			} else spider->requestMoveTo(p.x, p.y, 0, kinect->getFrameTick());
+		}
+		//printf("%.2f, %.2f, %.2f\t%.2f, %.2f, %.2f\n", p.x, p.y, p.z, sP.x(), sP.y(), sP.z());
+		if (!replaySource) { cvShowImage("col", kinectColour); cvShowImage("depth", depthIm83); cvShowImage("depthMask", kinectDepthMask); }
+		cvReleaseImage(&depthIm8); cvReleaseImage(&depthIm83);
+
+		if (new_frame!=0) {
+			if (frameCount++ % regInterval == 0) {
+				PROFILE_SCOPE("main.registration"); ALLOCATION_SCOPE("registration");
+				vector<MarkerTransform> regMT = regAR->performRegistration(new_frame, cameraParams, cameraDistortion);
+				poseFilter->update(regMT, captureTime);
+				clearMarkerTransforms(regMT);
+				profiler().recordSince(cameraToRegistered, captureTick);
+			}
+
+			//Smooth the poses and predict them forward to when this frame will be displayed
+			double now = osg::Timer::instance()->time_s();
+			vector<MarkerTransform> mt = poseFilter->predict(now + renderer->getDisplayLatency());
+
+			//Reproject the Kinect depth into the view this frame is drawn with, for occlusion
+			for (int i=0; reprojector && kinect->getTransform()!=0 && i<mt.size(); i++) {
+				if (mt.at(i).marker.name!="media/celica.bmp") continue;
+				renderer->updateDepthMap(reprojector->reproject((unsigned short*)kinectDepth->imageData, cvGetSize(kinectDepth), xzFactor, yzFactor, kinect->getTransform(), mt.at(i).transMat));
+			}
+
+			//Update the heightfield from the Kinect, sampling every heightFieldStep depth pixels
+			if (heightFieldStep>0 && kinect->getTransform()!=0) {
+				PROFILE_SCOPE("main.heightField");
+				int cols = (640-1)/heightFieldStep+1, rows = (480-1)/heightFieldStep+1;
+				if (heightSamples.size()!=cols*rows) {
+					heightSamples.resize(cols*rows);
+					for (int y=0; y<rows; y++) for (int x=0; x<cols; x++) heightSamples[x+(y*cols)] = cvPoint(x*heightFieldStep, y*heightFieldStep);
+				}
+				CvPoint3D32f *ground_grid = kinect->getTransformedPoints(&heightSamples[0], cols*rows);
+				renderer->updateHeightMap(ground_grid, cols, rows);
+				free(ground_grid);
+			}
+
+			renderer->publish(new_frame, mt, captureTick);
+
+			for (int i=0; i<mt.size(); i++) {mt.at(i).clear();} mt.clear();
+
+			//Check for the escape key and give the computer some processing time
+			if (!replaySource) checkKeyPress (cvWaitKey(1));
+		
+		}
+
+		//Clean up
+		cvReleaseImage(&new_frame);
+		cvReleaseImage(&kinectColour);
+		cvReleaseImage(&kinectDepth);
+		cvReleaseImage(&kinectDepthMask);
+
+		if (profileName) profiler().collect();
+		allocationTracker().endFrame();
+
+		if (replaySource) {
+			replayFrameTimes.push_back(osg::Timer::instance()->delta_m(frameTick, osg::Timer::instance()->tick()));
+			//Timing starts once the warm up frames are done
+			if (++replayed==replayWarmup) {
+				profiler().reset(); replayFrameTimes.clear();
+				replayStart = osg::Timer::instance()->tick(); replayRendered = renderer->getFrameCount();
+			}
+			if (replayed==replayWarmup+replayFrames) running = false;
+		}
+	};
+
+	if (replaySource && !replayFrameTimes.empty()) {
+		double seconds = osg::Timer::instance()->delta_s(replayStart, osg::Timer::instance()->tick());
+		int n = replayFrameTimes.size(); std::sort(replayFrameTimes.begin(), replayFrameTimes.end());
+		printf("Replayed %d frames in %.2f s: %.1f frames/s processed, %.1f frames/s drawn\n", n, seconds, n/seconds, (renderer->getFrameCount()-replayRendered)/seconds);
+		printf("Frame time p50 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n", replayFrameTimes[MIN(n-1, n/2)],
+			replayFrameTimes[MIN(n-1, int(n*0.99))], replayFrameTimes[MIN(n-1, int(n*0.999))], replayFrameTimes[n-1]);
+		profiler().printSummary();
+	}
+
+	printf("Registration skipped for %d of %d frames\n", staticAR->getSkipCount(), staticAR->getFrameCount());
+	if (latencyTest) {
+		printf("Step response over %d steps: p50 %.1f ms, p99 %.1f ms\n", latencyProbe().getStepCount(),
+			profiler().getPercentile("latency.step_response", 0.5), profiler().getPercentile("latency.step_response", 0.99));
+	}
+	if (allocTrack) allocationTracker().printReport();
+	if (profileName) {
+		profiler().writeCSV((string(profileName) + ".csv").c_str());
+		profiler().writeChromeTrace((string(profileName) + ".json").c_str());
+	}
+
+	delete poseFilter;
+	if (raycaster) delete raycaster;
+	delete planner; delete occupancy;
+	if (reprojector) delete reprojector;
+	delete renderer;
+	if (crowd) delete crowd;
+	delete spider; delete groundMap;
+	if (swarmAnimation) delete swarmAnimation;
+	delete regAR; delete regKinect;
+	if (camera) delete camera;
+	else { cvReleaseMat(&cameraParams); cvReleaseMat(&cameraDistortion); }
+	for (int i=0; i<replay.size(); i++) cvReleaseImage(&replay.at(i));
+	delete kinect;
+	return replayFailed ? 1 : 0;
+}
+
+void checkKeyPress(int key) {
+	switch (key) {
+		/*case 'q':
+			spider->setPosition(0, 0, 0); break;
+		case 'w':
+			spider->setPosition(kinect->getRealMarkerSize().width, 0, 0); break;
+		case 'e':
+			spider->setPosition(kinect->getRealMarkerSize().width, -kinect->getRealMarkerSize().height, 0); break;
+		case 'r':
+			spider->setPosition(0, -kinect->getRealMarkerSize().height, 0); break;*/
+		case 'q':
+			spider->requestMoveTo(0, 0, 0); break;
+		case 'w':
+			spider->requestMoveTo(kinect->getRealMarkerSize().width, 0, 0); break;
+		case 'e':
+			spider->requestMoveTo(kinect->getRealMarkerSize().width, -kinect->getRealMarkerSize().height, 0); break;
+		case 'r':
+			spider->requestMoveTo(0, -kinect->getRealMarkerSize().height, 0); break;
+		case 27:
+			running = false; break;
+			break;
+		case ' ':
+			bRegKinect = true; break;
+		case '1':
+			spider->requestAnimation(1); break;
+		case '2':
+			spider->requestAnimation(2); break;
+		case '3':
+			spider->requestAnimation(3); break;
+		case '4':
+			spider->requestAnimation(4); break;
+		case '5':
+			spider->requestAnimation(5); break;
+		case '6':
+			spider->requestAnimation(6); break;
+		case '7':
+			spider->requestAnimation(7); break;
+		case '8':
+			spider->requestAnimation(8); break;
+		case '9':
+			spider->requestAnimation(9); break;
+	}
 }
\ No newline at end of file